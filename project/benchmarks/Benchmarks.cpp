@@ -0,0 +1,714 @@
+//Standard includes
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+//Project includes
+#include "../src/ThreadPool.h"
+#include "../src/Utils.h"
+
+using namespace dae;
+
+namespace
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	double ElapsedMilliseconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	TriangleMesh LoadBunny()
+	{
+		TriangleMesh mesh{};
+		mesh.cullMode = TriangleCullMode::BackFaceCulling;
+		Utils::ParseOBJ(std::string(RESOURCES_DIR) + "lowpoly_bunny.obj", mesh.positions, mesh.normals, mesh.indices);
+
+		mesh.Scale({ 2.f, 2.f, 2.f });
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	//Bumpy UV sphere with 2 * rings * segments triangles
+	TriangleMesh CreateSyntheticMesh(int rings, int segments)
+	{
+		std::vector<Vector3> positions{};
+		std::vector<int> indices{};
+
+		for (int ring{ 0 }; ring <= rings; ++ring)
+		{
+			const float theta{ PI * ring / rings };
+			for (int segment{ 0 }; segment <= segments; ++segment)
+			{
+				const float phi{ PI_2 * segment / segments };
+				const float radius{ 2.f + .1f * sinf(13.f * theta) * cosf(17.f * phi) };
+				positions.emplace_back(radius * sinf(theta) * cosf(phi), 2.f + radius * cosf(theta), radius * sinf(theta) * sinf(phi));
+			}
+		}
+
+		for (int ring{ 0 }; ring < rings; ++ring)
+		{
+			for (int segment{ 0 }; segment < segments; ++segment)
+			{
+				const int i0{ ring * (segments + 1) + segment };
+				const int i1{ i0 + segments + 1 };
+
+				indices.insert(indices.end(), { i0, i0 + 1, i1 });
+				indices.insert(indices.end(), { i1, i0 + 1, i1 + 1 });
+			}
+		}
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	//Long, thin diagonal planks, every one of them spans most of the box so their bounds overlap badly
+	TriangleMesh CreateSliverMesh(int triangleCount)
+	{
+		std::vector<Vector3> positions{};
+		std::vector<int> indices{};
+
+		uint32_t seed{ 12345 };
+		const auto random = [&seed](float min, float max)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				return min + (max - min) * ((seed >> 8) / float(1 << 24));
+			};
+
+		const Vector3 along{ Vector3{ 1.f, 0.f, 1.f }.Normalized() };
+		const Vector3 across{ Vector3{ 1.f, 0.f, -1.f }.Normalized() };
+		for (int i{ 0 }; i < triangleCount; ++i)
+		{
+			const Vector3 center{ across * random(-3.f, 3.f) + Vector3{ 0.f, random(0.f, 6.f), 0.f } };
+			const Vector3 start{ center - along * 4.f };
+			const Vector3 end{ center + along * 4.f };
+
+			positions.insert(positions.end(), { start, end, start + Vector3{ 0.f, .02f, 0.f } });
+			const int first{ static_cast<int>(positions.size()) - 3 };
+			indices.insert(indices.end(), { first, first + 1, first + 2 });
+		}
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	//Primary rays of a camera at the reference scene position, looking down +z, in raster order
+	std::vector<Ray> CreateCameraRays(int width = 640, int height = 480)
+	{
+		const float aspectRatio{ float(width) / height };
+		const float fov{ tanf(45.f * TO_RADIANS / 2.f) };
+
+		std::vector<Ray> rays{};
+		rays.reserve(width * height);
+		for (int py{ 0 }; py < height; ++py)
+		{
+			for (int px{ 0 }; px < width; ++px)
+			{
+				const Vector3 direction{ (2.f * (px + .5f) / width - 1.f) * aspectRatio * fov, (1.f - 2.f * (py + .5f) / height) * fov, 1.f };
+				rays.push_back({ { 0.f, 3.f, -9.f }, direction.Normalized() });
+			}
+		}
+		return rays;
+	}
+
+	struct TraversalResult
+	{
+		double closestHitMs{};
+		double anyHitMs{};
+		size_t hitCount{};
+	};
+
+	TraversalResult TraceRays(const TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		TraversalResult result{};
+
+		auto start = Clock::now();
+		for (const Ray& ray : rays)
+		{
+			HitRecord hitRecord{};
+			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord)) ++result.hitCount;
+		}
+		result.closestHitMs = ElapsedMilliseconds(start);
+
+		start = Clock::now();
+		for (const Ray& ray : rays)
+		{
+			GeometryUtils::HitTest_TriangleMesh(mesh, ray);
+		}
+		result.anyHitMs = ElapsedMilliseconds(start);
+
+		return result;
+	}
+
+	void PrintLayout(const std::string& name, size_t nodeBytes, const TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		//Primitive indices are shared by all layouts and counted for each of them
+		const size_t totalBytes{ nodeBytes + mesh.bvh.primitiveIndices.size() * sizeof(uint32_t) };
+		const TraversalResult result{ TraceRays(mesh, rays) };
+
+		std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(10) << totalBytes / double(mesh.indices.size() / 3) << " bytes/tri"
+			<< std::setw(10) << rays.size() / (result.closestHitMs * 1000.0) << " Mrays/s closest"
+			<< std::setw(10) << rays.size() / (result.anyHitMs * 1000.0) << " Mrays/s any\n";
+	}
+
+	//Binary BVH against the collapsed 4-wide BVH with SSE node tests, in full float and quantized form
+	void BenchmarkNodeLayouts(const std::string& meshName, TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles)\n";
+
+		mesh.useWideBVH = false;
+		mesh.useCompressedBVH = false;
+		mesh.UpdateBVH();
+		PrintLayout("binary BVH", mesh.bvh.nodes.size() * sizeof(BVHNode), mesh, rays);
+
+		mesh.useWideBVH = true;
+		mesh.UpdateBVH();
+		PrintLayout("4-wide BVH", mesh.wideBvh.nodes.size() * sizeof(WideBVHNode), mesh, rays);
+
+		mesh.useCompressedBVH = true;
+		mesh.UpdateBVH();
+		PrintLayout("4-wide 8-bit", mesh.compressedBvh.nodes.size() * sizeof(CompressedWideBVHNode), mesh, rays);
+
+		mesh.useCompressedBVH = false;
+		mesh.UpdateBVH();
+	}
+
+	//Serial and parallel binned SAH build against the linear builder, reported per million triangles
+	void BenchmarkBuild(const std::string& meshName, TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		struct BuildConfig
+		{
+			std::string name;
+			BVHBuilder builder;
+			uint32_t parallelBuildThreshold;
+		};
+
+		const BuildConfig configs[]{
+			{ "SAH serial", BVHBuilder::BinnedSAH, UINT32_MAX },
+			{ "SAH parallel", BVHBuilder::BinnedSAH, 0 },
+			{ "LBVH serial", BVHBuilder::Linear, UINT32_MAX },
+			{ "LBVH parallel", BVHBuilder::Linear, 0 }
+		};
+
+		const double millionTriangles{ mesh.indices.size() / 3 / 1e6 };
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles, " << mesh.pThreadPool->GetThreadCount() << " threads)\n";
+
+		constexpr int repetitions{ 5 };
+		for (const BuildConfig& config : configs)
+		{
+			mesh.bvh.builder = config.builder;
+			mesh.bvh.parallelBuildThreshold = config.parallelBuildThreshold;
+			mesh.bvh.pThreadPool = mesh.pThreadPool;
+
+			const auto start = Clock::now();
+			for (int i{ 0 }; i < repetitions; ++i)
+			{
+				mesh.bvh.Build(mesh.triangleBounds);
+			}
+			const double buildMs{ ElapsedMilliseconds(start) / repetitions };
+
+			mesh.wideBvh.Collapse(mesh.bvh);
+			const TraversalResult result{ TraceRays(mesh, rays) };
+
+			std::cout << "  " << std::left << std::setw(14) << config.name << std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << buildMs / millionTriangles << " ms per Mtri"
+				<< std::setw(10) << mesh.bvh.nodes.size() << " nodes"
+				<< std::setw(10) << mesh.bvh.buildCost << " SAH cost"
+				<< std::setw(10) << rays.size() / (result.closestHitMs * 1000.0) << " Mrays/s closest\n";
+		}
+
+		mesh.bvh.builder = BVHBuilder::BinnedSAH;
+		mesh.bvh.parallelBuildThreshold = BVH{}.parallelBuildThreshold;
+		mesh.UpdateBVH();
+	}
+
+	//Node and triangle tests per ray of a closest hit traversal over the binary BVH
+	TraversalStats CountTraversalSteps(const TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		TraversalStats stats{};
+		for (const Ray& ray : rays)
+		{
+			Ray closestRay{ ray };
+			HitRecord hitRecord{};
+			GeometryUtils::TraverseBVH(mesh.bvh, closestRay, [&](uint32_t triangleIndex)
+				{
+					const size_t index{ triangleIndex * size_t(3) };
+					Triangle triangle{ mesh.transformedPositions[mesh.indices[index]], mesh.transformedPositions[mesh.indices[index + 1]],
+						mesh.transformedPositions[mesh.indices[index + 2]], mesh.transformedNormals[triangleIndex] };
+					triangle.cullMode = mesh.cullMode;
+
+					if (GeometryUtils::HitTest_Triangle(triangle, closestRay, hitRecord)) closestRay.max = hitRecord.t;
+					return false;
+				}, &stats);
+		}
+		return stats;
+	}
+
+	constexpr size_t CacheLineSize{ 64 };
+	constexpr size_t PageSize{ 4096 };
+
+	//Distinct blocks of blockSize bytes behind a list of element indices, as if the array started on a block boundary
+	size_t CountBlocks(const std::vector<uint32_t>& elementIndices, size_t elementSize, size_t blockSize, std::vector<size_t>& blocks)
+	{
+		blocks.clear();
+		for (const uint32_t index : elementIndices)
+			blocks.push_back(index * elementSize / blockSize);
+
+		std::sort(blocks.begin(), blocks.end());
+		return std::unique(blocks.begin(), blocks.end()) - blocks.begin();
+	}
+
+	//Node count, depth histogram and cache lines per ray of the depth-first and the van Emde Boas layout
+	void ReportMemoryLayout(const std::string& meshName, TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles)\n";
+
+		for (const BVHLayout layout : { BVHLayout::DepthFirst, BVHLayout::VanEmdeBoas })
+		{
+			mesh.bvh.layout = layout;
+			mesh.bvh.Clear();
+			mesh.UpdateBVH();
+
+			//Every tested node and every triangle whose indices were read, per ray
+			size_t nodeLines{}, nodePages{}, triangleLines{};
+			std::vector<uint32_t> testedNodes{}, testedTriangles{};
+			std::vector<size_t> blocks{};
+			for (const Ray& ray : rays)
+			{
+				testedNodes.clear();
+				testedTriangles.clear();
+
+				TraversalStats stats{};
+				stats.pTestedNodes = &testedNodes;
+				Ray closestRay{ ray };
+				HitRecord hitRecord{};
+				GeometryUtils::TraverseBVH(mesh.bvh, closestRay, [&](uint32_t triangleIndex)
+					{
+						testedTriangles.push_back(triangleIndex);
+
+						const size_t index{ triangleIndex * size_t(3) };
+						Triangle triangle{ mesh.transformedPositions[mesh.indices[index]], mesh.transformedPositions[mesh.indices[index + 1]],
+							mesh.transformedPositions[mesh.indices[index + 2]], mesh.transformedNormals[triangleIndex] };
+						triangle.cullMode = mesh.cullMode;
+
+						if (GeometryUtils::HitTest_Triangle(triangle, closestRay, hitRecord)) closestRay.max = hitRecord.t;
+						return false;
+					}, &stats);
+
+				nodeLines += CountBlocks(testedNodes, sizeof(BVHNode), CacheLineSize, blocks);
+				nodePages += CountBlocks(testedNodes, sizeof(BVHNode), PageSize, blocks);
+				triangleLines += CountBlocks(testedTriangles, 3 * sizeof(int), CacheLineSize, blocks);
+			}
+
+			const double rayCount{ static_cast<double>(rays.size()) };
+			std::cout << "  " << std::left << std::setw(14) << (layout == BVHLayout::DepthFirst ? "depth-first" : "van Emde Boas")
+				<< std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << nodeLines / rayCount << " node lines/ray"
+				<< std::setw(10) << nodePages / rayCount << " node pages/ray"
+				<< std::setw(10) << triangleLines / rayCount << " index lines/ray"
+				<< std::setw(10) << rays.size() / (TraceRays(mesh, rays).closestHitMs * 1000.0) << " Mrays/s closest\n";
+		}
+
+		//Depth of every node, the topology is the same for both layouts
+		std::vector<uint32_t> nodeCounts{}, leafCounts{};
+		std::vector<std::pair<uint32_t, uint32_t>> stack{ { 0u, 0u } };
+		while (!stack.empty())
+		{
+			const auto [nodeIndex, depth] = stack.back();
+			stack.pop_back();
+
+			if (nodeCounts.size() <= depth)
+			{
+				nodeCounts.resize(depth + 1);
+				leafCounts.resize(depth + 1);
+			}
+
+			const BVHNode& node = mesh.bvh.nodes[nodeIndex];
+			++nodeCounts[depth];
+			if (node.IsLeaf())
+			{
+				++leafCounts[depth];
+				continue;
+			}
+			stack.push_back({ node.leftFirst, depth + 1 });
+			stack.push_back({ node.leftFirst + 1, depth + 1 });
+		}
+
+		std::cout << "  " << mesh.bvh.nodes.size() << " nodes, depth histogram (nodes/leaves):";
+		for (size_t depth{ 0 }; depth < nodeCounts.size(); ++depth)
+			std::cout << (depth % 8 == 0 ? "\n   " : "") << std::setw(4) << depth << ": " << nodeCounts[depth] << "/" << leafCounts[depth];
+		std::cout << "\n";
+	}
+
+	//Plain SAH build against spatial splits with a growing reference budget
+	void BenchmarkSpatialSplits(const std::string& meshName, TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles)\n";
+
+		for (const float budget : { 0.f, .5f, 2.f, 8.f })
+		{
+			mesh.bvh.builder = budget > 0.f ? BVHBuilder::SpatialSplitSAH : BVHBuilder::BinnedSAH;
+			mesh.bvh.spatialSplitBudget = budget;
+			mesh.bvh.Clear();
+
+			const auto start = Clock::now();
+			mesh.UpdateBVH();
+			const double buildMs{ ElapsedMilliseconds(start) };
+
+			const TraversalStats stats{ CountTraversalSteps(mesh, rays) };
+			const double rayCount{ static_cast<double>(rays.size()) };
+			const std::string name{ budget > 0.f ? "SBVH +" + std::to_string(static_cast<int>(budget * 100)) + "%" : "SAH" };
+
+			std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << stats.nodeTests / rayCount << " nodes/ray"
+				<< std::setw(10) << stats.primitiveTests / rayCount << " tris/ray"
+				<< std::setw(10) << mesh.bvh.primitiveIndices.size() / double(mesh.bvh.primitiveCount) << " refs/tri"
+				<< std::setw(10) << buildMs << " ms build"
+				<< std::setw(10) << rays.size() / (TraceRays(mesh, rays).closestHitMs * 1000.0) << " Mrays/s closest\n";
+		}
+	}
+
+	//Field of equally sized spheres in front of the camera, the kind of scene a grid is meant for
+	std::vector<Sphere> CreateSphereField(int spheresPerSide)
+	{
+		std::vector<Sphere> spheres{};
+		for (int z{ 0 }; z < spheresPerSide; ++z)
+		{
+			for (int x{ 0 }; x < spheresPerSide; ++x)
+			{
+				Sphere sphere{};
+				sphere.origin = { -6.f + 12.f * x / spheresPerSide, .2f + .1f * ((x * 7 + z * 13) % 5), 12.f * z / spheresPerSide };
+				sphere.radius = .1f;
+				spheres.push_back(sphere);
+			}
+		}
+		return spheres;
+	}
+
+	/**
+	 * \brief Builds a binned SAH BVH and a two-level grid over the same primitives and traces every ray through both,
+	 * then picks the structure with the lowest frame cost (a full build plus tracing the rays once)
+	 * \param hitTest callable bool(uint32_t primitiveIndex, const Ray& ray, HitRecord& hitRecord)
+	 */
+	template<typename HitTest>
+	void BenchmarkAccelerationStructures(const std::string& sceneName, const std::vector<AABB>& primitiveBounds, const std::vector<Ray>& rays, HitTest&& hitTest)
+	{
+		std::cout << sceneName << " (" << primitiveBounds.size() << " primitives)\n";
+
+		BVH bvh{};
+		TwoLevelGrid grid{};
+
+		const auto traceRays = [&](auto&& traverse, size_t& hitCount)
+			{
+				const auto start = Clock::now();
+				for (const Ray& ray : rays)
+				{
+					Ray closestRay{ ray };
+					HitRecord closestHit{};
+					traverse(closestRay, [&](uint32_t primitiveIndex)
+						{
+							HitRecord hitRecord{};
+							if (hitTest(primitiveIndex, closestRay, hitRecord) && hitRecord.t < closestHit.t)
+							{
+								closestHit = hitRecord;
+								closestRay.max = hitRecord.t;
+							}
+							return false;
+						});
+					if (closestHit.didHit) ++hitCount;
+				}
+				return ElapsedMilliseconds(start);
+			};
+
+		struct Result
+		{
+			std::string name{};
+			double buildMs{};
+			double traceMs{};
+			size_t hitCount{};
+		};
+		Result results[2]{ { "BVH" }, { "two-level grid" } };
+
+		auto start = Clock::now();
+		bvh.Build(primitiveBounds);
+		results[0].buildMs = ElapsedMilliseconds(start);
+		results[0].traceMs = traceRays([&](const Ray& ray, auto&& test) { GeometryUtils::TraverseBVH(bvh, ray, test); }, results[0].hitCount);
+
+		start = Clock::now();
+		grid.Build(primitiveBounds);
+		results[1].buildMs = ElapsedMilliseconds(start);
+		results[1].traceMs = traceRays([&](const Ray& ray, auto&& test) { GeometryUtils::TraverseGrid(grid, ray, test); }, results[1].hitCount);
+
+		for (const Result& result : results)
+		{
+			std::cout << "  " << std::left << std::setw(14) << result.name << std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << result.buildMs << " ms build"
+				<< std::setw(10) << rays.size() / (result.traceMs * 1000.0) << " Mrays/s closest"
+				<< std::setw(10) << result.hitCount << " hits\n";
+		}
+
+		const bool isGridBetter{ results[1].buildMs + results[1].traceMs < results[0].buildMs + results[0].traceMs };
+		std::cout << "  -> " << (isGridBetter ? results[1].name : results[0].name) << "\n";
+	}
+
+	//Closest hit against the triangles of a mesh, for the structures built over mesh.triangleBounds
+	bool HitTest_MeshTriangle(const TriangleMesh& mesh, uint32_t triangleIndex, const Ray& ray, HitRecord& hitRecord)
+	{
+		const size_t index{ triangleIndex * size_t(3) };
+		Triangle triangle{ mesh.transformedPositions[mesh.indices[index]], mesh.transformedPositions[mesh.indices[index + 1]],
+			mesh.transformedPositions[mesh.indices[index + 2]], mesh.transformedNormals[triangleIndex] };
+		triangle.cullMode = mesh.cullMode;
+		return GeometryUtils::HitTest_Triangle(triangle, ray, hitRecord);
+	}
+
+	//Closest hits of square pixel blocks traced as ray packets, against the same rays traced one by one (packet size 1)
+	void BenchmarkRayPackets(const std::string& meshName, const TriangleMesh& mesh, int width, int height)
+	{
+		const std::vector<Ray> rays{ CreateCameraRays(width, height) };
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles, " << width << "x" << height << ")\n";
+
+		for (int packetSize : { 1, 2, 4, 8 })
+		{
+			size_t hitCount{ 0 };
+			const auto start = Clock::now();
+			for (int blockY{ 0 }; blockY < height; blockY += packetSize)
+			{
+				for (int blockX{ 0 }; blockX < width; blockX += packetSize)
+				{
+					if (packetSize == 1)
+					{
+						HitRecord hitRecord{};
+						if (GeometryUtils::HitTest_TriangleMesh(mesh, rays[blockY * width + blockX], hitRecord)) ++hitCount;
+						continue;
+					}
+
+					RayPacket packet{};
+					for (int py{ blockY }; py < std::min(blockY + packetSize, height); ++py)
+					{
+						for (int px{ blockX }; px < std::min(blockX + packetSize, width); ++px)
+						{
+							packet.SetRay(packet.size++, rays[py * width + px]);
+						}
+					}
+
+					HitRecord hitRecords[RayPacket::MaxSize]{};
+					GeometryUtils::HitTest_TriangleMesh(mesh, packet, packet.GetFullMask(), hitRecords);
+					for (uint32_t i{ 0 }; i < packet.size; ++i)
+					{
+						if (hitRecords[i].didHit) ++hitCount;
+					}
+				}
+			}
+			const double elapsedMs{ ElapsedMilliseconds(start) };
+
+			const std::string name{ packetSize == 1 ? "single rays" : std::to_string(packetSize) + "x" + std::to_string(packetSize) + " packets" };
+			std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+				<< std::setw(10) << rays.size() / (elapsedMs * 1000.0) << " Mrays/s closest"
+				<< std::setw(10) << hitCount << " hits\n";
+		}
+	}
+
+	//Shadow rays towards the lights of the reference scenes, from where the camera rays hit the mesh or a ground plane below it
+	std::vector<Ray> CreateShadowRays(const TriangleMesh& mesh, const std::vector<Ray>& cameraRays)
+	{
+		const Vector3 lights[]{ { 0.f, 5.5f, 5.f }, { -2.5f, 5.f, -5.f }, { 2.5f, 2.5f, -5.f } };
+		const Plane ground{ { 0.f, mesh.transformedMinAABB.y, 0.f }, { 0.f, 1.f, 0.f } };
+
+		std::vector<Ray> shadowRays{};
+		for (const Ray& ray : cameraRays)
+		{
+			HitRecord hitRecord{};
+			GeometryUtils::HitTest_Plane(ground, ray, hitRecord);
+			Ray closestRay{ ray };
+			closestRay.max = hitRecord.t;
+			GeometryUtils::HitTest_TriangleMesh(mesh, closestRay, hitRecord);
+			if (!hitRecord.didHit) continue;
+
+			for (const Vector3& light : lights)
+			{
+				const Vector3 toLight{ light - hitRecord.origin };
+				shadowRays.push_back({ hitRecord.origin, toLight.Normalized(), 0.0001f, toLight.Magnitude() });
+			}
+		}
+		return shadowRays;
+	}
+
+	//Shadow rays through the closest hit path that stops at the first hit, against the occlusion queries in both child orders
+	void BenchmarkOcclusion(const std::string& meshName, TriangleMesh& mesh, const std::vector<Ray>& cameraRays)
+	{
+		const std::vector<Ray> shadowRays{ CreateShadowRays(mesh, cameraRays) };
+		std::cout << meshName << " (" << mesh.indices.size() / 3 << " triangles, " << shadowRays.size() << " shadow rays)\n";
+
+		const auto measure = [&](const std::string& name, auto&& isOccluded)
+			{
+				size_t occludedCount{ 0 };
+				const auto start = Clock::now();
+				for (const Ray& ray : shadowRays)
+				{
+					if (isOccluded(ray)) ++occludedCount;
+				}
+				const double elapsedMs{ ElapsedMilliseconds(start) };
+
+				std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(2)
+					<< std::setw(10) << shadowRays.size() / (elapsedMs * 1000.0) << " Mrays/s"
+					<< std::setw(10) << occludedCount << " occluded\n";
+			};
+
+		const auto triangleTest = [&](const Ray& ray)
+			{
+				return [&](const uint32_t* pTriangleIndices, uint32_t triangleCount)
+					{
+						for (uint32_t first{ 0 }; first < triangleCount; first += GeometryUtils::TriangleLanes::Width)
+						{
+							if (GeometryUtils::HitTest_Triangles<GeometryUtils::TriangleLanes>(mesh.precomputedTriangles, pTriangleIndices + first,
+								std::min(GeometryUtils::TriangleLanes::Width, triangleCount - first), mesh.cullMode, ray) >= 0)
+								return true;
+						}
+						return false;
+					};
+			};
+
+		measure("closest hit path", [&](const Ray& ray) { HitRecord hitRecord{}; return GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord, true); });
+		measure("binary near first", [&](const Ray& ray) { return GeometryUtils::TraverseBVH(mesh.bvh, ray, triangleTest(ray)); });
+		measure("4-wide near first", [&](const Ray& ray) { return GeometryUtils::TraverseWideBVH(mesh.wideBvh, mesh.bvh, ray, triangleTest(ray)); });
+		measure("4-wide longest first", [&](const Ray& ray) { return GeometryUtils::TraverseWideBVH(mesh.wideBvh, mesh.bvh, ray, triangleTest(ray), true); });
+		measure("occlusion query", [&](const Ray& ray) { return GeometryUtils::HitTest_TriangleMesh(mesh, ray); });
+	}
+
+	void BenchmarkMeshTransform(const std::string& meshName, TriangleMesh& mesh)
+	{
+		constexpr int iterationCount{ 10 };
+		std::cout << meshName << " (" << mesh.positions.size() << " positions, " << mesh.normals.size() << " normals)\n";
+
+		//The mesh keeps its own transform, so the vertices end up where its BVH expects them
+		const Matrix finalTransform{ mesh.scaleTransform * mesh.rotationTransform * mesh.translationTransform };
+
+		const auto measure = [&](const std::string& name, auto&& transformVertices)
+			{
+				const auto start = Clock::now();
+				for (int i{ 0 }; i < iterationCount; ++i)
+				{
+					transformVertices();
+				}
+				const double elapsedMs{ ElapsedMilliseconds(start) / iterationCount };
+
+				std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(2)
+					<< std::setw(10) << elapsedMs << " ms\n";
+			};
+
+		//The loop UpdateTransforms used to run
+		measure("per vertex", [&]()
+			{
+				mesh.transformedPositions.clear();
+				mesh.transformedNormals.clear();
+				for (const Vector3& n : mesh.normals)
+					mesh.transformedNormals.emplace_back((mesh.rotationTransform * mesh.scaleTransform).TransformVector(n).Normalized());
+				for (const Vector3& p : mesh.positions)
+					mesh.transformedPositions.emplace_back(finalTransform.TransformPoint(p));
+			});
+
+		const uint32_t parallelThreshold{ mesh.parallelTransformThreshold };
+		mesh.parallelTransformThreshold = UINT32_MAX;
+		measure("batched", [&]() { mesh.TransformVertices(AffineMatrix{ finalTransform }, AffineMatrix{ mesh.rotationTransform * mesh.scaleTransform }); });
+		mesh.parallelTransformThreshold = 0;
+		measure("batched parallel", [&]() { mesh.TransformVertices(AffineMatrix{ finalTransform }, AffineMatrix{ mesh.rotationTransform * mesh.scaleTransform }); });
+
+		//A whole animation frame: vertices, triangle data and a BVH refit, turning the mesh a little every time so nothing is skipped
+		const Matrix rotationTransform{ mesh.rotationTransform };
+		float yaw{ 0.f };
+		const auto updateTransforms = [&]()
+			{
+				yaw += .01f;
+				mesh.RotateY(yaw);
+				mesh.UpdateTransforms();
+			};
+		mesh.parallelTransformThreshold = UINT32_MAX;
+		measure("update transforms", updateTransforms);
+		mesh.parallelTransformThreshold = 0;
+		measure("update parallel", updateTransforms);
+
+		mesh.parallelTransformThreshold = parallelThreshold;
+		mesh.rotationTransform = rotationTransform;
+		mesh.UpdateTransforms();
+	}
+
+	void BenchmarkAccelerationStructures(const std::string& meshName, const TriangleMesh& mesh, const std::vector<Ray>& rays)
+	{
+		BenchmarkAccelerationStructures(meshName, mesh.triangleBounds, rays, [&](uint32_t triangleIndex, const Ray& ray, HitRecord& hitRecord)
+			{
+				return HitTest_MeshTriangle(mesh, triangleIndex, ray, hitRecord);
+			});
+	}
+}
+
+int main()
+{
+	const std::vector<Ray> rays{ CreateCameraRays() };
+
+	TriangleMesh bunny{ LoadBunny() };
+	TriangleMesh synthetic{ CreateSyntheticMesh(512, 1024) };
+
+	//The parallel configurations run on the same kind of pool the renderer hands its scenes
+	ThreadPool threadPool{ ThreadPool::GetDefaultThreadCount() };
+	bunny.pThreadPool = synthetic.pThreadPool = &threadPool;
+
+	std::cout << "--- BVH node layouts ---\n";
+	BenchmarkNodeLayouts("Bunny", bunny, rays);
+	BenchmarkNodeLayouts("Synthetic", synthetic, rays);
+
+	std::cout << "\n--- Memory layout ---\n";
+	ReportMemoryLayout("Bunny", bunny, rays);
+	ReportMemoryLayout("Synthetic", synthetic, rays);
+
+	std::cout << "\n--- BVH build ---\n";
+	BenchmarkBuild("Synthetic", synthetic, rays);
+
+	std::cout << "\n--- Spatial splits ---\n";
+	TriangleMesh slivers{ CreateSliverMesh(5000) };
+	BenchmarkSpatialSplits("Slivers", slivers, rays);
+
+	std::cout << "\n--- Ray packets ---\n";
+	bunny.useWideBVH = false;
+	bunny.UpdateBVH();
+	BenchmarkRayPackets("Bunny", bunny, 640, 480);
+	BenchmarkRayPackets("Bunny", bunny, 1280, 960);
+	synthetic.useWideBVH = false;
+	synthetic.UpdateBVH();
+	BenchmarkRayPackets("Synthetic", synthetic, 640, 480);
+	bunny.useWideBVH = synthetic.useWideBVH = true;
+	bunny.UpdateBVH();
+	synthetic.UpdateBVH();
+
+	std::cout << "\n--- Occlusion ---\n";
+	BenchmarkOcclusion("Bunny", bunny, rays);
+	BenchmarkOcclusion("Synthetic", synthetic, rays);
+
+	std::cout << "\n--- Mesh transform ---\n";
+	BenchmarkMeshTransform("Synthetic", synthetic);
+
+	std::cout << "\n--- Acceleration structure ---\n";
+	const std::vector<Sphere> spheres{ CreateSphereField(100) };
+	std::vector<AABB> sphereBounds{};
+	for (const Sphere& sphere : spheres)
+	{
+		const Vector3 radius{ sphere.radius, sphere.radius, sphere.radius };
+		sphereBounds.push_back({ sphere.origin - radius, sphere.origin + radius });
+	}
+	BenchmarkAccelerationStructures("Sphere field", sphereBounds, rays, [&](uint32_t sphereIndex, const Ray& ray, HitRecord& hitRecord)
+		{
+			return GeometryUtils::HitTest_Sphere(spheres[sphereIndex], ray, hitRecord);
+		});
+	BenchmarkAccelerationStructures("Bunny", bunny, rays);
+	BenchmarkAccelerationStructures("Synthetic", synthetic, rays);
+	BenchmarkAccelerationStructures("Slivers", slivers, rays);
+
+	return 0;
+}
@@ -0,0 +1,1395 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numeric>
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+namespace dae {
+	namespace
+	{
+		//Calls function(taskIndex) for every task below taskCount, on the worker threads when there is a pool
+		template<typename Function>
+		void ForEachTask(ThreadPool* pThreadPool, uint32_t taskCount, Function&& function)
+		{
+			if (!pThreadPool || taskCount <= 1)
+			{
+				for (uint32_t taskIndex{ 0 }; taskIndex < taskCount; ++taskIndex)
+				{
+					function(taskIndex);
+				}
+				return;
+			}
+
+			pThreadPool->Run(taskCount, [&](uint32_t taskIndex, uint32_t)
+				{
+					function(taskIndex);
+				});
+		}
+
+		struct Bin
+		{
+			AABB bounds{};
+			AABB centroidBounds{};
+			uint32_t count{};
+		};
+
+		//Bins for all three axes of one primitive range
+		struct SplitBins
+		{
+			Bin bins[3][BVH::BinCount]{};
+
+			void Merge(const SplitBins& other)
+			{
+				for (int axis{ 0 }; axis < 3; ++axis)
+				{
+					for (int i{ 0 }; i < BVH::BinCount; ++i)
+					{
+						bins[axis][i].bounds.Grow(other.bins[axis][i].bounds);
+						bins[axis][i].centroidBounds.Grow(other.bins[axis][i].centroidBounds);
+						bins[axis][i].count += other.bins[axis][i].count;
+					}
+				}
+			}
+		};
+
+		inline float GetComponent(const Vector3& v, int axis)
+		{
+			return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+		}
+
+		inline void SetComponent(Vector3& v, int axis, float value)
+		{
+			(axis == 0 ? v.x : axis == 1 ? v.y : v.z) = value;
+		}
+
+		AABB Intersect(const AABB& a, const AABB& b)
+		{
+			AABB result{};
+			result.min = Vector3::Max(a.min, b.min);
+			result.max = Vector3::Min(a.max, b.max);
+			return result;
+		}
+
+		bool IsEmpty(const AABB& bounds)
+		{
+			return bounds.min.x > bounds.max.x || bounds.min.y > bounds.max.y || bounds.min.z > bounds.max.z;
+		}
+
+		struct BinMapping
+		{
+			float boundsMin[3]{};
+			float scale[3]{};
+
+			BinMapping(const AABB& centroidBounds)
+			{
+				for (int axis{ 0 }; axis < 3; ++axis)
+				{
+					const float extent{ GetComponent(centroidBounds.max, axis) - GetComponent(centroidBounds.min, axis) };
+					boundsMin[axis] = GetComponent(centroidBounds.min, axis);
+					scale[axis] = extent > 0.f ? BVH::BinCount / extent : 0.f;
+				}
+			}
+
+			int GetBin(float value, int axis) const
+			{
+				return std::min(BVH::BinCount - 1, static_cast<int>((value - boundsMin[axis]) * scale[axis]));
+			}
+		};
+
+		void BinPrimitives(SplitBins& splitBins, const uint32_t* pPrimitiveIndices, uint32_t count, const BinMapping& mapping,
+			const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids)
+		{
+			for (uint32_t i{ 0 }; i < count; ++i)
+			{
+				const uint32_t primitiveIndex{ pPrimitiveIndices[i] };
+				const Vector3& centroid = centroids[primitiveIndex];
+				const AABB& bounds = primitiveBounds[primitiveIndex];
+
+				const int bins[3]{ mapping.GetBin(centroid.x, 0), mapping.GetBin(centroid.y, 1), mapping.GetBin(centroid.z, 2) };
+				for (int axis{ 0 }; axis < 3; ++axis)
+				{
+					Bin& bin = splitBins.bins[axis][bins[axis]];
+					bin.bounds.Grow(bounds);
+					bin.centroidBounds.Grow(centroid);
+					++bin.count;
+				}
+			}
+		}
+
+		//Large ranges are binned in chunks on the worker threads and merged afterwards
+		void BinPrimitivesParallel(ThreadPool* pThreadPool, SplitBins& splitBins, const uint32_t* pPrimitiveIndices, uint32_t count, const BinMapping& mapping,
+			const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids)
+		{
+			constexpr uint32_t chunkSize{ 1 << 14 };
+			const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+
+			std::vector<SplitBins> chunkBins(chunkCount);
+			ForEachTask(pThreadPool, chunkCount, [&](uint32_t chunk)
+				{
+					const uint32_t first{ chunk * chunkSize };
+					BinPrimitives(chunkBins[chunk], pPrimitiveIndices + first, std::min(chunkSize, count - first), mapping, primitiveBounds, centroids);
+				});
+
+			for (const SplitBins& bins : chunkBins)
+			{
+				splitBins.Merge(bins);
+			}
+		}
+
+		//Node with the children bounds quantized against their union, counts and children are left for the caller
+		CompressedWideBVHNode QuantizeChildren(const AABB* pChildBounds, int childCount)
+		{
+			CompressedWideBVHNode node{};
+			node.childCount = static_cast<uint8_t>(childCount);
+
+			AABB parentBounds{};
+			for (int i{ 0 }; i < childCount; ++i)
+			{
+				parentBounds.Grow(pChildBounds[i]);
+			}
+
+			uint8_t* quantizedMin[3]{ node.minX, node.minY, node.minZ };
+			uint8_t* quantizedMax[3]{ node.maxX, node.maxY, node.maxZ };
+
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				const float origin{ GetComponent(parentBounds.min, axis) };
+				const float extent{ GetComponent(parentBounds.max, axis) - origin };
+
+				//Smallest power of two cell that fits the extent in 255 steps
+				int exponent{ extent > 0.f ? static_cast<int>(std::ceil(std::log2(extent / 255.f))) : -126 };
+				exponent = std::clamp(exponent, -126, 127);
+				const float cellSize{ std::ldexp(1.f, exponent) };
+
+				node.origin[axis] = origin;
+				node.exponents[axis] = static_cast<int8_t>(exponent);
+
+				for (int i{ 0 }; i < childCount; ++i)
+				{
+					const float childMin{ GetComponent(pChildBounds[i].min, axis) };
+					const float childMax{ GetComponent(pChildBounds[i].max, axis) };
+
+					//Round outwards, then correct for float rounding so the dequantized box never shrinks
+					int minCell{ std::clamp(static_cast<int>(std::floor((childMin - origin) / cellSize)), 0, 255) };
+					int maxCell{ std::clamp(static_cast<int>(std::ceil((childMax - origin) / cellSize)), 0, 255) };
+					while (minCell > 0 && origin + minCell * cellSize > childMin) --minCell;
+					while (maxCell < 255 && origin + maxCell * cellSize < childMax) ++maxCell;
+
+					quantizedMin[axis][i] = static_cast<uint8_t>(minCell);
+					quantizedMax[axis][i] = static_cast<uint8_t>(maxCell);
+				}
+			}
+
+			return node;
+		}
+
+		//Calls function(chunkBegin, chunkEnd) for consecutive chunks of [0, count) on the worker threads
+		template<typename Function>
+		void ForEachChunkParallel(ThreadPool* pThreadPool, uint32_t count, uint32_t chunkSize, Function&& function)
+		{
+			ForEachTask(pThreadPool, (count + chunkSize - 1) / chunkSize, [&](uint32_t chunk)
+				{
+					function(chunk, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+				});
+		}
+
+		//Stable partition of a large range: every chunk counts its left values, then copies both sides behind those of the chunks before it
+		template<typename Predicate>
+		void PartitionParallel(ThreadPool* pThreadPool, uint32_t* pValues, uint32_t count, Predicate&& isLeft)
+		{
+			constexpr uint32_t chunkSize{ 1 << 14 };
+			const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+
+			std::vector<uint32_t> leftOffsets(chunkCount), rightOffsets(chunkCount);
+			ForEachChunkParallel(pThreadPool, count, chunkSize, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+				{
+					leftOffsets[chunk] = static_cast<uint32_t>(std::count_if(pValues + begin, pValues + end, isLeft));
+				});
+
+			uint32_t leftCount{ 0 };
+			for (uint32_t chunkLeftCount : leftOffsets) leftCount += chunkLeftCount;
+
+			//Exclusive prefix sums, the right side starts behind all left values
+			uint32_t left{ 0 }, right{ leftCount };
+			for (uint32_t chunk{ 0 }; chunk < chunkCount; ++chunk)
+			{
+				const uint32_t chunkLeftCount{ leftOffsets[chunk] };
+				const uint32_t chunkCountTotal{ std::min(count, (chunk + 1) * chunkSize) - chunk * chunkSize };
+				leftOffsets[chunk] = left;
+				rightOffsets[chunk] = right;
+				left += chunkLeftCount;
+				right += chunkCountTotal - chunkLeftCount;
+			}
+
+			std::vector<uint32_t> partitioned(count);
+			ForEachChunkParallel(pThreadPool, count, chunkSize, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+				{
+					uint32_t leftIndex{ leftOffsets[chunk] }, rightIndex{ rightOffsets[chunk] };
+					for (uint32_t i{ begin }; i < end; ++i)
+					{
+						partitioned[isLeft(pValues[i]) ? leftIndex++ : rightIndex++] = pValues[i];
+					}
+				});
+			ForEachChunkParallel(pThreadPool, count, chunkSize, [&](uint32_t, uint32_t begin, uint32_t end)
+				{
+					std::copy(partitioned.begin() + begin, partitioned.begin() + end, pValues + begin);
+				});
+		}
+
+		//Spreads the lower 10 bits of value so there are two zero bits between each of them
+		uint32_t ExpandBits(uint32_t value)
+		{
+			value = (value * 0x00010001u) & 0xFF0000FFu;
+			value = (value * 0x00000101u) & 0x0F00F00Fu;
+			value = (value * 0x00000011u) & 0xC30C30C3u;
+			value = (value * 0x00000005u) & 0x49249249u;
+			return value;
+		}
+
+		uint32_t MortonCode(float x, float y, float z)
+		{
+			constexpr float cellCount{ 1 << BVH::MortonBits };
+			const auto quantize = [=](float value)
+				{
+					return static_cast<uint32_t>(std::clamp(value * cellCount, 0.f, cellCount - 1.f));
+				};
+			return (ExpandBits(quantize(x)) << 2) | (ExpandBits(quantize(y)) << 1) | ExpandBits(quantize(z));
+		}
+
+		/**
+		 * \brief Stable LSD radix sort on the upper 32 bits of the keys, the lower 32 bits just travel along.
+		 * Every pass counts digits per chunk in parallel, then each chunk scatters into its own slice of the output.
+		 */
+		void RadixSortParallel(ThreadPool* pThreadPool, std::vector<uint64_t>& keys, int keyBits)
+		{
+			constexpr int digitBits{ 10 };
+			constexpr uint32_t digitCount{ 1 << digitBits };
+			constexpr uint32_t chunkSize{ 1 << 16 };
+
+			const uint32_t count{ static_cast<uint32_t>(keys.size()) };
+			const uint32_t chunkCount{ (count + chunkSize - 1) / chunkSize };
+
+			std::vector<uint64_t> sortedKeys(count);
+			std::vector<uint32_t> offsets(chunkCount * digitCount);
+
+			for (int shift{ 32 }; shift < 32 + keyBits; shift += digitBits)
+			{
+				const auto getDigit = [shift](uint64_t key) { return static_cast<uint32_t>(key >> shift) & (digitCount - 1); };
+
+				std::fill(offsets.begin(), offsets.end(), 0);
+				ForEachChunkParallel(pThreadPool, count, chunkSize, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+					{
+						uint32_t* pChunkOffsets{ offsets.data() + chunk * digitCount };
+						for (uint32_t i{ begin }; i < end; ++i) ++pChunkOffsets[getDigit(keys[i])];
+					});
+
+				//Digit-major exclusive prefix sum, so each chunk writes right behind the same digit of the previous chunk
+				uint32_t sum{ 0 };
+				for (uint32_t digit{ 0 }; digit < digitCount; ++digit)
+				{
+					for (uint32_t chunk{ 0 }; chunk < chunkCount; ++chunk)
+					{
+						uint32_t& offset = offsets[chunk * digitCount + digit];
+						const uint32_t digitTotal{ offset };
+						offset = sum;
+						sum += digitTotal;
+					}
+				}
+
+				ForEachChunkParallel(pThreadPool, count, chunkSize, [&](uint32_t chunk, uint32_t begin, uint32_t end)
+					{
+						uint32_t* pChunkOffsets{ offsets.data() + chunk * digitCount };
+						for (uint32_t i{ begin }; i < end; ++i) sortedKeys[pChunkOffsets[getDigit(keys[i])]++] = keys[i];
+					});
+
+				keys.swap(sortedKeys);
+			}
+		}
+
+		//A layout unit is the root on its own or a pair of siblings, identified by the index of its first node
+		uint32_t GetUnitSize(uint32_t unit)
+		{
+			return unit == 0 ? 1 : 2;
+		}
+
+		/**
+		 * \brief Appends the units of the top height levels under unit to order in van Emde Boas order
+		 * \param pCut receives the units right below those levels, nullptr when nothing hangs below them
+		 * \param scratch one list per recursion depth, reused so the layout does not allocate per call.
+		 * Sized up front, the recursion halves the height so it never goes deeper than bit_width(height)
+		 */
+		void LayoutVanEmdeBoas(const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& unitHeights, uint32_t unit, uint32_t height,
+			std::vector<uint32_t>& order, std::vector<uint32_t>* pCut, std::vector<std::vector<uint32_t>>& scratch, size_t depth)
+		{
+			if (height == 1)
+			{
+				order.push_back(unit);
+				if (!pCut) return;
+
+				for (uint32_t nodeIndex{ unit }; nodeIndex < unit + GetUnitSize(unit); ++nodeIndex)
+				{
+					if (!nodes[nodeIndex].IsLeaf()) pCut->push_back(nodes[nodeIndex].leftFirst);
+				}
+				return;
+			}
+
+			scratch[depth].clear();
+
+			//Top half of the subtree first, then every subtree hanging below it
+			const uint32_t topHeight{ height / 2 };
+			LayoutVanEmdeBoas(nodes, unitHeights, unit, topHeight, order, &scratch[depth], scratch, depth + 1);
+
+			for (size_t i{ 0 }; i < scratch[depth].size(); ++i)
+			{
+				const uint32_t bottomUnit{ scratch[depth][i] };
+				const uint32_t bottomHeight{ std::min(height - topHeight, unitHeights[bottomUnit]) };
+				LayoutVanEmdeBoas(nodes, unitHeights, bottomUnit, bottomHeight, order, pCut, scratch, depth + 1);
+			}
+		}
+	}
+
+	void BVH::Build(const std::vector<AABB>& primitiveBounds, const PrimitiveClipper& clipPrimitive)
+	{
+		Clear();
+		if (primitiveBounds.empty()) return;
+
+		primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+
+		switch (builder)
+		{
+		case BVHBuilder::BinnedSAH:
+			BuildBinnedSAH(primitiveBounds);
+			break;
+		case BVHBuilder::Linear:
+			BuildLinear(primitiveBounds);
+			break;
+		case BVHBuilder::SpatialSplitSAH:
+			BuildSpatialSplits(primitiveBounds, clipPrimitive);
+			break;
+		}
+
+		if (layout == BVHLayout::VanEmdeBoas)
+			ReorderNodes();
+
+		nodes.shrink_to_fit();
+		buildCost = CalculateSAHCost();
+	}
+
+	void BVH::BuildBinnedSAH(const std::vector<AABB>& primitiveBounds)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		std::vector<Vector3> centroids(primitiveCount);
+		primitiveIndices.resize(primitiveCount);
+		std::iota(primitiveIndices.begin(), primitiveIndices.end(), 0);
+
+		AABB rootBounds{}, centroidBounds{};
+		for (uint32_t i{ 0 }; i < primitiveCount; ++i)
+		{
+			centroids[i] = primitiveBounds[i].Centroid();
+			rootBounds.Grow(primitiveBounds[i]);
+			centroidBounds.Grow(centroids[i]);
+		}
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes
+		nodes.reserve(2 * primitiveCount - 1);
+
+		BVHNode root{};
+		root.minAABB = rootBounds.min;
+		root.maxAABB = rootBounds.max;
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		nodes.emplace_back(root);
+
+		if (primitiveCount < parallelBuildThreshold)
+		{
+			Subdivide(nodes, 0, centroidBounds, primitiveBounds, centroids, nullptr);
+		}
+		else
+		{
+			//Split the top of the tree until there are a few partitions per thread, then build those side by side
+			const uint32_t threadCount{ pThreadPool ? pThreadPool->GetThreadCount() : 1 };
+
+			BuildTasks buildTasks{};
+			buildTasks.taskSize = std::max(primitiveCount / (4 * threadCount), 1024u);
+
+			Subdivide(nodes, 0, centroidBounds, primitiveBounds, centroids, &buildTasks);
+			BuildSubtreesInParallel(buildTasks, [&](std::vector<BVHNode>& subtree, const BuildTask& task)
+				{
+					Subdivide(subtree, 0, task.centroidBounds, primitiveBounds, centroids, nullptr);
+				});
+		}
+	}
+
+	void BVH::BuildLinear(const std::vector<AABB>& primitiveBounds)
+	{
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveBounds.size()) };
+
+		AABB centroidBounds{};
+		for (const AABB& bounds : primitiveBounds)
+		{
+			centroidBounds.Grow(Vector3{ (bounds.min.x + bounds.max.x) * .5f, (bounds.min.y + bounds.max.y) * .5f, (bounds.min.z + bounds.max.z) * .5f });
+		}
+
+		//Morton code in the upper half of every key, primitive index in the lower half
+		const Vector3 centroidMin{ centroidBounds.min };
+		const Vector3 centroidScale{
+			centroidBounds.max.x > centroidMin.x ? 1.f / (centroidBounds.max.x - centroidMin.x) : 0.f,
+			centroidBounds.max.y > centroidMin.y ? 1.f / (centroidBounds.max.y - centroidMin.y) : 0.f,
+			centroidBounds.max.z > centroidMin.z ? 1.f / (centroidBounds.max.z - centroidMin.z) : 0.f };
+
+		constexpr uint32_t chunkSize{ 1 << 14 };
+		std::vector<uint64_t> keys(primitiveCount);
+		ForEachChunkParallel(pThreadPool, primitiveCount, chunkSize, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					const AABB& bounds = primitiveBounds[i];
+					const uint32_t code{ MortonCode(
+						((bounds.min.x + bounds.max.x) * .5f - centroidMin.x) * centroidScale.x,
+						((bounds.min.y + bounds.max.y) * .5f - centroidMin.y) * centroidScale.y,
+						((bounds.min.z + bounds.max.z) * .5f - centroidMin.z) * centroidScale.z) };
+					keys[i] = (static_cast<uint64_t>(code) << 32) | i;
+				}
+			});
+
+		RadixSortParallel(pThreadPool, keys, 3 * MortonBits);
+
+		std::vector<uint32_t> mortonCodes(primitiveCount);
+		primitiveIndices.resize(primitiveCount);
+		ForEachChunkParallel(pThreadPool, primitiveCount, chunkSize, [&](uint32_t, uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i{ begin }; i < end; ++i)
+				{
+					mortonCodes[i] = static_cast<uint32_t>(keys[i] >> 32);
+					primitiveIndices[i] = static_cast<uint32_t>(keys[i]);
+				}
+			});
+
+		nodes.reserve(2 * primitiveCount - 1);
+
+		BVHNode root{};
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		nodes.emplace_back(root);
+
+		//The hierarchy is emitted top-down without bounds, a refit afterwards fills them in
+		if (primitiveCount < parallelBuildThreshold)
+		{
+			SubdivideLinear(nodes, 0, mortonCodes, nullptr);
+			RefitNodes(nodes, nodes.size(), primitiveBounds);
+		}
+		else
+		{
+			const uint32_t threadCount{ pThreadPool ? pThreadPool->GetThreadCount() : 1 };
+
+			BuildTasks buildTasks{};
+			buildTasks.taskSize = std::max(primitiveCount / (4 * threadCount), 1024u);
+
+			SubdivideLinear(nodes, 0, mortonCodes, &buildTasks);
+			const size_t topNodeCount{ nodes.size() };
+
+			BuildSubtreesInParallel(buildTasks, [&](std::vector<BVHNode>& subtree, const BuildTask&)
+				{
+					SubdivideLinear(subtree, 0, mortonCodes, nullptr);
+					RefitNodes(subtree, subtree.size(), primitiveBounds);
+				});
+
+			//Only the nodes above the partitions are still missing their bounds
+			RefitNodes(nodes, topNodeCount, primitiveBounds);
+		}
+	}
+
+	void BVH::BuildSubtreesInParallel(const BuildTasks& buildTasks, const std::function<void(std::vector<BVHNode>& subtree, const BuildTask& task)>& buildSubtree)
+	{
+		const std::vector<BuildTask>& tasks = buildTasks.tasks;
+
+		//Every subtree gets its own node list, the primitive ranges are disjoint so they can be partitioned concurrently
+		std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+		ForEachTask(pThreadPool, static_cast<uint32_t>(tasks.size()), [&](uint32_t taskIndex)
+			{
+				std::vector<BVHNode>& subtree = subtrees[taskIndex];
+				subtree.reserve(2 * nodes[tasks[taskIndex].nodeIndex].primitiveCount);
+				subtree.emplace_back(nodes[tasks[taskIndex].nodeIndex]);
+
+				buildSubtree(subtree, tasks[taskIndex]);
+			});
+
+		//Stitch the subtrees behind the top-level nodes, children keep being stored after their parent
+		for (size_t taskIndex{ 0 }; taskIndex < tasks.size(); ++taskIndex)
+		{
+			const std::vector<BVHNode>& subtree = subtrees[taskIndex];
+			const uint32_t offset{ static_cast<uint32_t>(nodes.size()) - 1 };
+
+			for (size_t i{ 1 }; i < subtree.size(); ++i)
+			{
+				BVHNode node{ subtree[i] };
+				if (!node.IsLeaf()) node.leftFirst += offset;
+				nodes.emplace_back(node);
+			}
+
+			BVHNode root{ subtree[0] };
+			if (!root.IsLeaf()) root.leftFirst += offset;
+			nodes[tasks[taskIndex].nodeIndex] = root;
+		}
+	}
+
+	void BVH::ReorderNodes()
+	{
+		//Levels of units in every subtree, children are always stored after their parent so one backwards sweep does it
+		std::vector<uint32_t> nodeHeights(nodes.size(), 0);
+		std::vector<uint32_t> unitHeights(nodes.size(), 0);
+		for (size_t i{ nodes.size() }; i-- > 0;)
+		{
+			const BVHNode& node = nodes[i];
+			if (node.IsLeaf()) continue;
+
+			const uint32_t childHeight{ 1 + std::max(nodeHeights[node.leftFirst], nodeHeights[node.leftFirst + 1]) };
+			nodeHeights[i] = childHeight;
+			unitHeights[node.leftFirst] = childHeight;
+		}
+		unitHeights[0] = 1 + nodeHeights[0];
+
+		std::vector<uint32_t> order{};
+		order.reserve(nodes.size() / 2 + 1);
+		std::vector<std::vector<uint32_t>> scratch(std::bit_width(unitHeights[0]) + 1);
+		LayoutVanEmdeBoas(nodes, unitHeights, 0, unitHeights[0], order, nullptr, scratch, 0);
+
+		std::vector<uint32_t> newIndices(nodes.size());
+		uint32_t nextIndex{ 0 };
+		for (const uint32_t unit : order)
+		{
+			for (uint32_t nodeIndex{ unit }; nodeIndex < unit + GetUnitSize(unit); ++nodeIndex)
+				newIndices[nodeIndex] = nextIndex++;
+		}
+
+		//Leaves are visited in their new order, so their primitives end up in leaf order as well
+		std::vector<BVHNode> reorderedNodes{};
+		std::vector<uint32_t> reorderedPrimitives{};
+		reorderedNodes.reserve(nodes.size());
+		reorderedPrimitives.reserve(primitiveIndices.size());
+
+		for (const uint32_t unit : order)
+		{
+			for (uint32_t nodeIndex{ unit }; nodeIndex < unit + GetUnitSize(unit); ++nodeIndex)
+			{
+				BVHNode node{ nodes[nodeIndex] };
+				if (node.IsLeaf())
+				{
+					const auto first = primitiveIndices.begin() + node.leftFirst;
+					node.leftFirst = static_cast<uint32_t>(reorderedPrimitives.size());
+					reorderedPrimitives.insert(reorderedPrimitives.end(), first, first + node.primitiveCount);
+				}
+				else
+				{
+					node.leftFirst = newIndices[node.leftFirst];
+				}
+				reorderedNodes.emplace_back(node);
+			}
+		}
+
+		nodes.swap(reorderedNodes);
+		primitiveIndices.swap(reorderedPrimitives);
+	}
+
+	void BVH::Clear()
+	{
+		nodes.clear();
+		primitiveIndices.clear();
+		primitiveCount = 0;
+		buildCost = 0.f;
+	}
+
+	float BVH::Refit(const std::vector<AABB>& primitiveBounds)
+	{
+		if (nodes.empty()) return 0.f;
+
+		const float cost{ RefitNodes(nodes, nodes.size(), primitiveBounds) };
+		const float rootArea{ AABB{ nodes[0].minAABB, nodes[0].maxAABB }.Area() };
+		return rootArea > 0.f ? cost / rootArea : cost;
+	}
+
+	bool BVH::Update(const std::vector<AABB>& primitiveBounds, float rebuildThreshold, const PrimitiveClipper& clipPrimitive)
+	{
+		if (builder == BVHBuilder::Linear || primitiveBounds.size() != primitiveCount || nodes.empty())
+		{
+			Build(primitiveBounds, clipPrimitive);
+			return true;
+		}
+
+		//Split references get refitted to their whole primitive, which is conservative but gives up the split
+		if (Refit(primitiveBounds) > buildCost * rebuildThreshold)
+		{
+			Build(primitiveBounds, clipPrimitive);
+			return true;
+		}
+		return false;
+	}
+
+	float BVH::CalculateSAHCost() const
+	{
+		if (nodes.empty()) return 0.f;
+
+		float cost{ 0.f };
+		for (const BVHNode& node : nodes)
+		{
+			const float area{ AABB{ node.minAABB, node.maxAABB }.Area() };
+			cost += node.IsLeaf() ? IntersectionCost * node.primitiveCount * area : TraversalCost * area;
+		}
+
+		const float rootArea{ AABB{ nodes[0].minAABB, nodes[0].maxAABB }.Area() };
+		return rootArea > 0.f ? cost / rootArea : cost;
+	}
+
+	float BVH::RefitNodes(std::vector<BVHNode>& nodeList, size_t nodeCount, const std::vector<AABB>& primitiveBounds) const
+	{
+		float cost{ 0.f };
+
+		//Children are always stored after their parent, so a reverse sweep visits them first
+		for (int64_t nodeIndex{ static_cast<int64_t>(nodeCount) - 1 }; nodeIndex >= 0; --nodeIndex)
+		{
+			BVHNode& node = nodeList[nodeIndex];
+
+			if (node.IsLeaf())
+			{
+				AABB bounds{};
+				for (uint32_t i{ 0 }; i < node.primitiveCount; ++i)
+				{
+					bounds.Grow(primitiveBounds[primitiveIndices[node.leftFirst + i]]);
+				}
+
+				node.minAABB = bounds.min;
+				node.maxAABB = bounds.max;
+				cost += IntersectionCost * node.primitiveCount * bounds.Area();
+				continue;
+			}
+
+			const BVHNode& leftChild = nodeList[node.leftFirst];
+			const BVHNode& rightChild = nodeList[node.leftFirst + 1];
+			node.minAABB = Vector3::Min(leftChild.minAABB, rightChild.minAABB);
+			node.maxAABB = Vector3::Max(leftChild.maxAABB, rightChild.maxAABB);
+			cost += TraversalCost * AABB{ node.minAABB, node.maxAABB }.Area();
+		}
+
+		return cost;
+	}
+
+	void BVH::Subdivide(std::vector<BVHNode>& nodeList, uint32_t nodeIndex, const AABB& centroidBounds,
+		const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, BuildTasks* pTasks)
+	{
+		const uint32_t first{ nodeList[nodeIndex].leftFirst };
+		const uint32_t count{ nodeList[nodeIndex].primitiveCount };
+		if (count <= 2) return;
+
+		//Small enough to become one of the partitions of the parallel build
+		if (pTasks && count <= pTasks->taskSize)
+		{
+			pTasks->tasks.push_back({ nodeIndex, centroidBounds });
+			return;
+		}
+
+		//Binned SAH: find the cheapest split plane over all three axes
+		const BinMapping mapping{ centroidBounds };
+		const bool isParallel{ pTasks != nullptr && count >= ParallelBinningThreshold };
+
+		SplitBins splitBins{};
+		if (isParallel)
+			BinPrimitivesParallel(pThreadPool, splitBins, primitiveIndices.data() + first, count, mapping, primitiveBounds, centroids);
+		else
+			BinPrimitives(splitBins, primitiveIndices.data() + first, count, mapping, primitiveBounds, centroids);
+
+		int bestAxis{ -1 };
+		int bestSplit{ 0 };
+		float bestCost{ FLT_MAX };
+
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			if (mapping.scale[axis] == 0.f) continue;
+
+			const Bin* bins = splitBins.bins[axis];
+
+			//Sweep from the right to get the area and count right of every plane, then evaluate the planes from the left
+			float rightArea[BinCount - 1]{};
+			uint32_t rightCount[BinCount - 1]{};
+			AABB box{};
+			uint32_t sum{ 0 };
+
+			for (int i{ BinCount - 1 }; i > 0; --i)
+			{
+				box.Grow(bins[i].bounds);
+				sum += bins[i].count;
+				rightArea[i - 1] = box.Area();
+				rightCount[i - 1] = sum;
+			}
+
+			box = AABB{};
+			sum = 0;
+
+			for (int i{ 0 }; i < BinCount - 1; ++i)
+			{
+				box.Grow(bins[i].bounds);
+				sum += bins[i].count;
+				if (sum == 0 || rightCount[i] == 0) continue;
+
+				const float cost{ sum * box.Area() + rightCount[i] * rightArea[i] };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+
+		//All centroids coincide, nothing left to split on
+		if (bestAxis == -1) return;
+
+		const float nodeArea{ AABB{ nodeList[nodeIndex].minAABB, nodeList[nodeIndex].maxAABB }.Area() };
+		const float splitCost{ TraversalCost + IntersectionCost * bestCost / nodeArea };
+		const float leafCost{ IntersectionCost * count };
+		if (splitCost >= leafCost && count <= MaxLeafSize) return;
+
+		//Partition the primitive range around the chosen plane
+		const auto isLeftOfSplit = [&](uint32_t primitiveIndex)
+			{
+				return mapping.GetBin(GetComponent(centroids[primitiveIndex], bestAxis), bestAxis) <= bestSplit;
+			};
+
+		if (isParallel)
+			PartitionParallel(pThreadPool, primitiveIndices.data() + first, count, isLeftOfSplit);
+		else
+			std::partition(primitiveIndices.begin() + first, primitiveIndices.begin() + first + count, isLeftOfSplit);
+
+		//The bins already hold the exact bounds of both halves
+		Bin bestLeft{}, bestRight{};
+		for (int i{ 0 }; i < BinCount; ++i)
+		{
+			Bin& side = i <= bestSplit ? bestLeft : bestRight;
+			const Bin& bin = splitBins.bins[bestAxis][i];
+			side.bounds.Grow(bin.bounds);
+			side.centroidBounds.Grow(bin.centroidBounds);
+			side.count += bin.count;
+		}
+
+		const uint32_t leftCount{ bestLeft.count };
+		const uint32_t leftChildIndex{ static_cast<uint32_t>(nodeList.size()) };
+
+		BVHNode leftChild{};
+		leftChild.minAABB = bestLeft.bounds.min;
+		leftChild.maxAABB = bestLeft.bounds.max;
+		leftChild.leftFirst = first;
+		leftChild.primitiveCount = leftCount;
+
+		BVHNode rightChild{};
+		rightChild.minAABB = bestRight.bounds.min;
+		rightChild.maxAABB = bestRight.bounds.max;
+		rightChild.leftFirst = first + leftCount;
+		rightChild.primitiveCount = count - leftCount;
+
+		nodeList.emplace_back(leftChild);
+		nodeList.emplace_back(rightChild);
+
+		nodeList[nodeIndex].leftFirst = leftChildIndex;
+		nodeList[nodeIndex].primitiveCount = 0;
+
+		Subdivide(nodeList, leftChildIndex, bestLeft.centroidBounds, primitiveBounds, centroids, pTasks);
+		Subdivide(nodeList, leftChildIndex + 1, bestRight.centroidBounds, primitiveBounds, centroids, pTasks);
+	}
+
+	void BVH::SubdivideLinear(std::vector<BVHNode>& nodeList, uint32_t nodeIndex, const std::vector<uint32_t>& mortonCodes, BuildTasks* pTasks)
+	{
+		const uint32_t first{ nodeList[nodeIndex].leftFirst };
+		const uint32_t count{ nodeList[nodeIndex].primitiveCount };
+		if (count <= LinearLeafSize) return;
+
+		if (pTasks && count <= pTasks->taskSize)
+		{
+			pTasks->tasks.push_back({ nodeIndex, AABB{} });
+			return;
+		}
+
+		//Split where the highest differing bit of the sorted codes flips, runs of identical codes are halved
+		const uint32_t firstCode{ mortonCodes[first] };
+		const uint32_t lastCode{ mortonCodes[first + count - 1] };
+
+		uint32_t leftCount{ count / 2 };
+		if (firstCode != lastCode)
+		{
+			const uint32_t splitBit{ 1u << (31 - std::countl_zero(firstCode ^ lastCode)) };
+			const auto rangeBegin = mortonCodes.begin() + first;
+			leftCount = static_cast<uint32_t>(std::partition_point(rangeBegin, rangeBegin + count,
+				[splitBit](uint32_t code) { return (code & splitBit) == 0; }) - rangeBegin);
+		}
+
+		const uint32_t leftChildIndex{ static_cast<uint32_t>(nodeList.size()) };
+
+		BVHNode leftChild{};
+		leftChild.leftFirst = first;
+		leftChild.primitiveCount = leftCount;
+
+		BVHNode rightChild{};
+		rightChild.leftFirst = first + leftCount;
+		rightChild.primitiveCount = count - leftCount;
+
+		nodeList.emplace_back(leftChild);
+		nodeList.emplace_back(rightChild);
+
+		nodeList[nodeIndex].leftFirst = leftChildIndex;
+		nodeList[nodeIndex].primitiveCount = 0;
+
+		SubdivideLinear(nodeList, leftChildIndex, mortonCodes, pTasks);
+		SubdivideLinear(nodeList, leftChildIndex + 1, mortonCodes, pTasks);
+	}
+
+	struct BVH::SpatialSplitState
+	{
+		PrimitiveClipper clipPrimitive;
+		float minOverlapArea;
+	};
+
+	void BVH::BuildSpatialSplits(const std::vector<AABB>& primitiveBounds, const PrimitiveClipper& clipPrimitive)
+	{
+		std::vector<SpatialReference> references(primitiveCount);
+		AABB rootBounds{};
+		for (uint32_t i{ 0 }; i < primitiveCount; ++i)
+		{
+			references[i] = { primitiveBounds[i], i };
+			rootBounds.Grow(primitiveBounds[i]);
+		}
+
+		SpatialSplitState state{};
+		state.minOverlapArea = SpatialSplitOverlap * rootBounds.Area();
+		if (clipPrimitive)
+			state.clipPrimitive = clipPrimitive;
+		else
+			state.clipPrimitive = [&primitiveBounds](uint32_t primitiveIndex, int, float, float) { return primitiveBounds[primitiveIndex]; };
+
+		const uint32_t referenceBudget{ static_cast<uint32_t>(spatialSplitBudget * primitiveCount) };
+		primitiveIndices.reserve(primitiveCount + referenceBudget);
+		nodes.reserve(2 * (primitiveCount + referenceBudget) - 1);
+
+		BVHNode root{};
+		root.minAABB = rootBounds.min;
+		root.maxAABB = rootBounds.max;
+		nodes.emplace_back(root);
+
+		SubdivideSpatial(0, references, state, referenceBudget);
+	}
+
+	/**
+	 * \brief referenceBudget is the number of duplicate references this subtree may still create.
+	 * What a split leaves of it is handed to the children in proportion to their size, so splits near
+	 * the root cannot use up the whole budget of the tree.
+	 */
+	void BVH::SubdivideSpatial(uint32_t nodeIndex, std::vector<SpatialReference>& references, const SpatialSplitState& state, uint32_t referenceBudget)
+	{
+		const uint32_t count{ static_cast<uint32_t>(references.size()) };
+		const AABB nodeBounds{ nodes[nodeIndex].minAABB, nodes[nodeIndex].maxAABB };
+
+		const auto makeLeaf = [&]()
+			{
+				nodes[nodeIndex].leftFirst = static_cast<uint32_t>(primitiveIndices.size());
+				nodes[nodeIndex].primitiveCount = count;
+				for (const SpatialReference& reference : references)
+				{
+					primitiveIndices.emplace_back(reference.primitiveIndex);
+				}
+			};
+
+		if (count <= 2)
+		{
+			makeLeaf();
+			return;
+		}
+
+		//Object split: binned SAH over the reference centroids, same as the regular build
+		AABB centroidBounds{};
+		for (const SpatialReference& reference : references)
+		{
+			centroidBounds.Grow(reference.bounds.Centroid());
+		}
+		const BinMapping mapping{ centroidBounds };
+
+		int objectAxis{ -1 };
+		int objectSplit{ 0 };
+		float objectCost{ FLT_MAX };
+		AABB objectLeftBounds{}, objectRightBounds{};
+
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			if (mapping.scale[axis] == 0.f) continue;
+
+			AABB binBounds[BinCount]{};
+			uint32_t binCounts[BinCount]{};
+			for (const SpatialReference& reference : references)
+			{
+				const int bin{ mapping.GetBin(GetComponent(reference.bounds.Centroid(), axis), axis) };
+				binBounds[bin].Grow(reference.bounds);
+				++binCounts[bin];
+			}
+
+			for (int split{ 0 }; split < BinCount - 1; ++split)
+			{
+				AABB leftBounds{}, rightBounds{};
+				uint32_t leftCount{ 0 }, rightCount{ 0 };
+				for (int i{ 0 }; i < BinCount; ++i)
+				{
+					(i <= split ? leftBounds : rightBounds).Grow(binBounds[i]);
+					(i <= split ? leftCount : rightCount) += binCounts[i];
+				}
+				if (leftCount == 0 || rightCount == 0) continue;
+
+				const float cost{ leftCount * leftBounds.Area() + rightCount * rightBounds.Area() };
+				if (cost < objectCost)
+				{
+					objectCost = cost;
+					objectAxis = axis;
+					objectSplit = split;
+					objectLeftBounds = leftBounds;
+					objectRightBounds = rightBounds;
+				}
+			}
+		}
+
+		//Spatial split: bin the clipped references between planes, only worth it when the object split children overlap a lot
+		int spatialAxis{ -1 };
+		float spatialPlane{ 0.f };
+		float spatialCost{ FLT_MAX };
+
+		const bool hasOverlap{ objectAxis == -1 || Intersect(objectLeftBounds, objectRightBounds).Area() > state.minOverlapArea };
+		if (hasOverlap && referenceBudget > 0)
+		{
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				const float nodeMin{ GetComponent(nodeBounds.min, axis) };
+				const float binWidth{ (GetComponent(nodeBounds.max, axis) - nodeMin) / BinCount };
+				if (binWidth <= 0.f) continue;
+
+				const auto getBin = [&](float value)
+					{
+						return std::clamp(static_cast<int>((value - nodeMin) / binWidth), 0, BinCount - 1);
+					};
+
+				AABB binBounds[BinCount]{};
+				uint32_t entries[BinCount]{};
+				uint32_t exits[BinCount]{};
+
+				for (const SpatialReference& reference : references)
+				{
+					const int firstBin{ getBin(GetComponent(reference.bounds.min, axis)) };
+					const int lastBin{ getBin(GetComponent(reference.bounds.max, axis)) };
+					++entries[firstBin];
+					++exits[lastBin];
+
+					if (firstBin == lastBin)
+					{
+						binBounds[firstBin].Grow(reference.bounds);
+						continue;
+					}
+
+					for (int bin{ firstBin }; bin <= lastBin; ++bin)
+					{
+						AABB slab{ reference.bounds };
+						SetComponent(slab.min, axis, std::max(GetComponent(slab.min, axis), nodeMin + bin * binWidth));
+						SetComponent(slab.max, axis, std::min(GetComponent(slab.max, axis), nodeMin + (bin + 1) * binWidth));
+
+						const AABB clipped{ Intersect(state.clipPrimitive(reference.primitiveIndex, axis, GetComponent(slab.min, axis), GetComponent(slab.max, axis)), slab) };
+						if (!IsEmpty(clipped)) binBounds[bin].Grow(clipped);
+					}
+				}
+
+				for (int split{ 0 }; split < BinCount - 1; ++split)
+				{
+					AABB leftBounds{}, rightBounds{};
+					uint32_t leftCount{ 0 }, rightCount{ 0 };
+					for (int i{ 0 }; i < BinCount; ++i)
+					{
+						if (i <= split)
+						{
+							leftBounds.Grow(binBounds[i]);
+							leftCount += entries[i];
+						}
+						else
+						{
+							rightBounds.Grow(binBounds[i]);
+							rightCount += exits[i];
+						}
+					}
+					if (leftCount == 0 || rightCount == 0) continue;
+					if (leftCount + rightCount - count > referenceBudget) continue;
+
+					const float cost{ leftCount * leftBounds.Area() + rightCount * rightBounds.Area() };
+					if (cost < spatialCost)
+					{
+						spatialCost = cost;
+						spatialAxis = axis;
+						spatialPlane = nodeMin + (split + 1) * binWidth;
+					}
+				}
+			}
+		}
+
+		const float bestCost{ std::min(objectCost, spatialCost) };
+		const float nodeArea{ nodeBounds.Area() };
+		const float splitCost{ TraversalCost + IntersectionCost * bestCost / nodeArea };
+		const float leafCost{ IntersectionCost * count };
+		if (bestCost == FLT_MAX || (splitCost >= leafCost && count <= MaxLeafSize))
+		{
+			makeLeaf();
+			return;
+		}
+
+		std::vector<SpatialReference> leftReferences{}, rightReferences{};
+		if (spatialCost < objectCost)
+		{
+			for (const SpatialReference& reference : references)
+			{
+				if (GetComponent(reference.bounds.max, spatialAxis) <= spatialPlane)
+				{
+					leftReferences.emplace_back(reference);
+				}
+				else if (GetComponent(reference.bounds.min, spatialAxis) >= spatialPlane)
+				{
+					rightReferences.emplace_back(reference);
+				}
+				else
+				{
+					//Straddles the plane, both halves get a reference clipped to their side
+					AABB leftSlab{ reference.bounds }, rightSlab{ reference.bounds };
+					SetComponent(leftSlab.max, spatialAxis, spatialPlane);
+					SetComponent(rightSlab.min, spatialAxis, spatialPlane);
+
+					const AABB leftPart{ Intersect(state.clipPrimitive(reference.primitiveIndex, spatialAxis, GetComponent(leftSlab.min, spatialAxis), spatialPlane), leftSlab) };
+					const AABB rightPart{ Intersect(state.clipPrimitive(reference.primitiveIndex, spatialAxis, spatialPlane, GetComponent(rightSlab.max, spatialAxis)), rightSlab) };
+
+					if (!IsEmpty(leftPart)) leftReferences.push_back({ leftPart, reference.primitiveIndex });
+					if (!IsEmpty(rightPart)) rightReferences.push_back({ rightPart, reference.primitiveIndex });
+				}
+			}
+		}
+		else
+		{
+			for (const SpatialReference& reference : references)
+			{
+				const bool isLeft{ mapping.GetBin(GetComponent(reference.bounds.Centroid(), objectAxis), objectAxis) <= objectSplit };
+				(isLeft ? leftReferences : rightReferences).emplace_back(reference);
+			}
+		}
+
+		if (leftReferences.empty() || rightReferences.empty())
+		{
+			makeLeaf();
+			return;
+		}
+
+		const uint32_t childReferenceCount{ static_cast<uint32_t>(leftReferences.size() + rightReferences.size()) };
+		const uint32_t remainingBudget{ referenceBudget - std::min(referenceBudget, childReferenceCount - count) };
+		const uint32_t leftBudget{ static_cast<uint32_t>(static_cast<uint64_t>(remainingBudget) * leftReferences.size() / childReferenceCount) };
+
+		//The parent's references are not needed anymore, free them before going deeper
+		std::vector<SpatialReference>().swap(references);
+
+		AABB leftBounds{}, rightBounds{};
+		for (const SpatialReference& reference : leftReferences) leftBounds.Grow(reference.bounds);
+		for (const SpatialReference& reference : rightReferences) rightBounds.Grow(reference.bounds);
+
+		const uint32_t leftChildIndex{ static_cast<uint32_t>(nodes.size()) };
+
+		BVHNode leftChild{};
+		leftChild.minAABB = leftBounds.min;
+		leftChild.maxAABB = leftBounds.max;
+
+		BVHNode rightChild{};
+		rightChild.minAABB = rightBounds.min;
+		rightChild.maxAABB = rightBounds.max;
+
+		nodes.emplace_back(leftChild);
+		nodes.emplace_back(rightChild);
+
+		nodes[nodeIndex].leftFirst = leftChildIndex;
+		nodes[nodeIndex].primitiveCount = 0;
+
+		SubdivideSpatial(leftChildIndex, leftReferences, state, leftBudget);
+		SubdivideSpatial(leftChildIndex + 1, rightReferences, state, remainingBudget - leftBudget);
+	}
+
+	void WideBVH::Collapse(const BVH& bvh)
+	{
+		Clear();
+		if (bvh.nodes.empty()) return;
+
+		nodes.reserve(bvh.nodes.size() / 2 + 1);
+		nodes.emplace_back();
+		CollapseNode(bvh, 0, 0);
+	}
+
+	void WideBVH::Refit(const BVH& bvh)
+	{
+		for (size_t nodeIndex{ 0 }; nodeIndex < nodes.size(); ++nodeIndex)
+		{
+			WideBVHNode& node = nodes[nodeIndex];
+			for (int i{ 0 }; i < WideBVHNode::Width && node.minX[i] != INFINITY; ++i)
+			{
+				const BVHNode& source = bvh.nodes[sourceNodes[nodeIndex * WideBVHNode::Width + i]];
+				node.minX[i] = source.minAABB.x;
+				node.minY[i] = source.minAABB.y;
+				node.minZ[i] = source.minAABB.z;
+				node.maxX[i] = source.maxAABB.x;
+				node.maxY[i] = source.maxAABB.y;
+				node.maxZ[i] = source.maxAABB.z;
+			}
+		}
+	}
+
+	void WideBVH::Clear()
+	{
+		nodes.clear();
+		sourceNodes.clear();
+	}
+
+	void WideBVH::CollapseNode(const BVH& bvh, uint32_t binaryNodeIndex, uint32_t wideNodeIndex)
+	{
+		//Pull grandchildren up until the node is full, always opening the child with the largest surface area
+		uint32_t children[WideBVHNode::Width]{};
+		int childCount{ 0 };
+
+		const BVHNode& binaryNode = bvh.nodes[binaryNodeIndex];
+		if (binaryNode.IsLeaf())
+		{
+			children[childCount++] = binaryNodeIndex;
+		}
+		else
+		{
+			children[childCount++] = binaryNode.leftFirst;
+			children[childCount++] = binaryNode.leftFirst + 1;
+		}
+
+		while (childCount < WideBVHNode::Width)
+		{
+			int largestChild{ -1 };
+			float largestArea{ -1.f };
+
+			for (int i{ 0 }; i < childCount; ++i)
+			{
+				const BVHNode& child = bvh.nodes[children[i]];
+				if (child.IsLeaf()) continue;
+
+				const float area{ AABB{ child.minAABB, child.maxAABB }.Area() };
+				if (area > largestArea)
+				{
+					largestArea = area;
+					largestChild = i;
+				}
+			}
+
+			if (largestChild == -1) break;
+
+			const uint32_t openedNodeIndex{ children[largestChild] };
+			children[largestChild] = bvh.nodes[openedNodeIndex].leftFirst;
+			children[childCount++] = bvh.nodes[openedNodeIndex].leftFirst + 1;
+		}
+
+		WideBVHNode node{};
+		uint32_t interiorChildren[WideBVHNode::Width][2]{};
+		int interiorCount{ 0 };
+
+		for (int i{ 0 }; i < WideBVHNode::Width; ++i)
+		{
+			if (i >= childCount)
+			{
+				node.minX[i] = node.minY[i] = node.minZ[i] = INFINITY;
+				node.maxX[i] = node.maxY[i] = node.maxZ[i] = INFINITY;
+				node.children[i] = 0;
+				node.primitiveCounts[i] = 0;
+				continue;
+			}
+
+			const BVHNode& child = bvh.nodes[children[i]];
+			node.minX[i] = child.minAABB.x;
+			node.minY[i] = child.minAABB.y;
+			node.minZ[i] = child.minAABB.z;
+			node.maxX[i] = child.maxAABB.x;
+			node.maxY[i] = child.maxAABB.y;
+			node.maxZ[i] = child.maxAABB.z;
+
+			if (child.IsLeaf())
+			{
+				node.children[i] = child.leftFirst;
+				node.primitiveCounts[i] = child.primitiveCount;
+			}
+			else
+			{
+				node.children[i] = static_cast<uint32_t>(nodes.size());
+				node.primitiveCounts[i] = 0;
+				nodes.emplace_back();
+
+				interiorChildren[interiorCount][0] = children[i];
+				interiorChildren[interiorCount][1] = node.children[i];
+				++interiorCount;
+			}
+		}
+
+		nodes[wideNodeIndex] = node;
+		sourceNodes.resize(nodes.size() * WideBVHNode::Width);
+		std::copy(children, children + childCount, sourceNodes.begin() + wideNodeIndex * WideBVHNode::Width);
+
+		for (int i{ 0 }; i < interiorCount; ++i)
+		{
+			CollapseNode(bvh, interiorChildren[i][0], interiorChildren[i][1]);
+		}
+	}
+
+	void CompressedWideBVH::Compress(const WideBVH& wideBvh)
+	{
+		Clear();
+		if (wideBvh.nodes.empty()) return;
+
+		nodes.reserve(wideBvh.nodes.size());
+		nodes.emplace_back();
+		CompressNode(wideBvh, 0, 0);
+	}
+
+	void CompressedWideBVH::Refit(const BVH& bvh)
+	{
+		for (size_t nodeIndex{ 0 }; nodeIndex < nodes.size(); ++nodeIndex)
+		{
+			CompressedWideBVHNode& node = nodes[nodeIndex];
+
+			AABB childBounds[CompressedWideBVHNode::Width]{};
+			for (int i{ 0 }; i < node.childCount; ++i)
+			{
+				const BVHNode& source = bvh.nodes[sourceNodes[nodeIndex * CompressedWideBVHNode::Width + i]];
+				childBounds[i] = AABB{ source.minAABB, source.maxAABB };
+			}
+
+			//Only the quantized bounds change, children and counts stay
+			const CompressedWideBVHNode quantized{ QuantizeChildren(childBounds, node.childCount) };
+			std::copy(std::begin(quantized.origin), std::end(quantized.origin), node.origin);
+			std::copy(std::begin(quantized.exponents), std::end(quantized.exponents), node.exponents);
+			std::copy(std::begin(quantized.minX), std::end(quantized.minX), node.minX);
+			std::copy(std::begin(quantized.minY), std::end(quantized.minY), node.minY);
+			std::copy(std::begin(quantized.minZ), std::end(quantized.minZ), node.minZ);
+			std::copy(std::begin(quantized.maxX), std::end(quantized.maxX), node.maxX);
+			std::copy(std::begin(quantized.maxY), std::end(quantized.maxY), node.maxY);
+			std::copy(std::begin(quantized.maxZ), std::end(quantized.maxZ), node.maxZ);
+		}
+	}
+
+	void CompressedWideBVH::Clear()
+	{
+		nodes.clear();
+		sourceNodes.clear();
+	}
+
+	void CompressedWideBVH::CompressNode(const WideBVH& wideBvh, uint32_t wideNodeIndex, uint32_t compressedNodeIndex)
+	{
+		const WideBVHNode& wideNode = wideBvh.nodes[wideNodeIndex];
+
+		AABB childBounds[WideBVHNode::Width]{};
+		int childCount{ 0 };
+		while (childCount < WideBVHNode::Width && wideNode.minX[childCount] != INFINITY)
+		{
+			childBounds[childCount].min = { wideNode.minX[childCount], wideNode.minY[childCount], wideNode.minZ[childCount] };
+			childBounds[childCount].max = { wideNode.maxX[childCount], wideNode.maxY[childCount], wideNode.maxZ[childCount] };
+			++childCount;
+		}
+
+		CompressedWideBVHNode node{ QuantizeChildren(childBounds, childCount) };
+
+		uint32_t interiorChildren[WideBVHNode::Width][2]{};
+		int interiorCount{ 0 };
+		uint32_t largeLeaves[WideBVHNode::Width][2]{};
+		int largeLeafCount{ 0 };
+
+		for (int i{ 0 }; i < childCount; ++i)
+		{
+			const uint32_t primitiveCount{ wideNode.primitiveCounts[i] };
+			if (primitiveCount > 0 && primitiveCount <= UINT8_MAX)
+			{
+				node.children[i] = wideNode.children[i];
+				node.primitiveCounts[i] = static_cast<uint8_t>(primitiveCount);
+				continue;
+			}
+
+			node.children[i] = static_cast<uint32_t>(nodes.size());
+			node.primitiveCounts[i] = 0;
+			nodes.emplace_back();
+
+			if (primitiveCount == 0)
+			{
+				interiorChildren[interiorCount][0] = wideNode.children[i];
+				interiorChildren[interiorCount][1] = node.children[i];
+				++interiorCount;
+			}
+			else
+			{
+				largeLeaves[largeLeafCount][0] = static_cast<uint32_t>(i);
+				largeLeaves[largeLeafCount][1] = node.children[i];
+				++largeLeafCount;
+			}
+		}
+
+		nodes[compressedNodeIndex] = node;
+		const auto pSources = wideBvh.sourceNodes.begin() + wideNodeIndex * WideBVHNode::Width;
+		sourceNodes.resize(nodes.size() * CompressedWideBVHNode::Width);
+		std::copy(pSources, pSources + childCount, sourceNodes.begin() + compressedNodeIndex * CompressedWideBVHNode::Width);
+
+		for (int i{ 0 }; i < interiorCount; ++i)
+		{
+			CompressNode(wideBvh, interiorChildren[i][0], interiorChildren[i][1]);
+		}
+
+		for (int i{ 0 }; i < largeLeafCount; ++i)
+		{
+			const uint32_t child{ largeLeaves[i][0] };
+			CompressLeaf(childBounds[child], pSources[child], wideNode.children[child], wideNode.primitiveCounts[child], largeLeaves[i][1]);
+		}
+	}
+
+	void CompressedWideBVH::CompressLeaf(const AABB& bounds, uint32_t sourceNode, uint32_t firstPrimitive, uint32_t primitiveCount, uint32_t compressedNodeIndex)
+	{
+		//Every slice keeps the bounds of the whole leaf, which is conservative but only happens for degenerate leaves
+		const uint32_t sliceSize{ (primitiveCount + WideBVHNode::Width - 1) / WideBVHNode::Width };
+		const int childCount{ static_cast<int>((primitiveCount + sliceSize - 1) / sliceSize) };
+
+		AABB childBounds[WideBVHNode::Width]{};
+		std::fill(childBounds, childBounds + childCount, bounds);
+
+		CompressedWideBVHNode node{ QuantizeChildren(childBounds, childCount) };
+		uint32_t largeSlices[WideBVHNode::Width][3]{};
+		int largeSliceCount{ 0 };
+
+		for (int i{ 0 }; i < childCount; ++i)
+		{
+			const uint32_t first{ firstPrimitive + i * sliceSize };
+			const uint32_t count{ std::min(sliceSize, firstPrimitive + primitiveCount - first) };
+
+			if (count <= UINT8_MAX)
+			{
+				node.children[i] = first;
+				node.primitiveCounts[i] = static_cast<uint8_t>(count);
+				continue;
+			}
+
+			node.children[i] = static_cast<uint32_t>(nodes.size());
+			node.primitiveCounts[i] = 0;
+			nodes.emplace_back();
+
+			largeSlices[largeSliceCount][0] = first;
+			largeSlices[largeSliceCount][1] = count;
+			largeSlices[largeSliceCount][2] = node.children[i];
+			++largeSliceCount;
+		}
+
+		nodes[compressedNodeIndex] = node;
+		sourceNodes.resize(nodes.size() * CompressedWideBVHNode::Width);
+		std::fill_n(sourceNodes.begin() + compressedNodeIndex * CompressedWideBVHNode::Width, childCount, sourceNode);
+
+		for (int i{ 0 }; i < largeSliceCount; ++i)
+		{
+			CompressLeaf(bounds, sourceNode, largeSlices[i][0], largeSlices[i][1], largeSlices[i][2]);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Maths.h"
+
+namespace dae
+{
+	class ThreadPool;
+
+#pragma region AABB
+	struct AABB
+	{
+		Vector3 min{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		//Component-wise on purpose, these run millions of times per build
+		void Grow(const Vector3& p)
+		{
+			min.x = std::min(min.x, p.x);
+			min.y = std::min(min.y, p.y);
+			min.z = std::min(min.z, p.z);
+			max.x = std::max(max.x, p.x);
+			max.y = std::max(max.y, p.y);
+			max.z = std::max(max.z, p.z);
+		}
+
+		void Grow(const AABB& other)
+		{
+			min.x = std::min(min.x, other.min.x);
+			min.y = std::min(min.y, other.min.y);
+			min.z = std::min(min.z, other.min.z);
+			max.x = std::max(max.x, other.max.x);
+			max.y = std::max(max.y, other.max.y);
+			max.z = std::max(max.z, other.max.z);
+		}
+
+		Vector3 Centroid() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		//Half of the surface area, the factor 2 cancels out in every SAH ratio
+		float Area() const
+		{
+			const float extentX{ max.x - min.x };
+			const float extentY{ max.y - min.y };
+			const float extentZ{ max.z - min.z };
+			if (extentX < 0.f) return 0.f;
+			return extentX * extentY + extentY * extentZ + extentZ * extentX;
+		}
+	};
+#pragma endregion
+
+#pragma region BVH
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		Vector3 maxAABB{};
+
+		//Interior node: index of the left child, the right child is stored right after it
+		//Leaf node: index of the first primitive in BVH::primitiveIndices
+		uint32_t leftFirst{};
+		uint32_t primitiveCount{};
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	enum class BVHBuilder
+	{
+		BinnedSAH, //Best trees, for static geometry and meshes that mostly refit
+		Linear, //Morton code LBVH, fast enough to rebuild deforming geometry every update
+		SpatialSplitSAH //SBVH, binned SAH that may also split primitive references across nodes, for long thin primitives
+	};
+
+	enum class BVHLayout
+	{
+		DepthFirst, //Nodes stay in the order the builder created them
+		VanEmdeBoas //Cache-oblivious, every subtree of half the height is stored contiguously, recursively
+	};
+
+	//Counters filled in by the traversal when requested
+	struct TraversalStats
+	{
+		uint64_t nodeTests{};
+		uint64_t primitiveTests{};
+
+		//Optional, receives the index of every node whose bounds were tested
+		std::vector<uint32_t>* pTestedNodes{ nullptr };
+	};
+
+	/**
+	 * \brief Binary bounding volume hierarchy built with the surface area heuristic (SAH).
+	 * The BVH only knows about primitive bounds, the owner maps primitiveIndices back to its own geometry.
+	 */
+	struct BVH
+	{
+		//Bounds of the part of a primitive that lies in the slab [slabMin, slabMax] along axis
+		using PrimitiveClipper = std::function<AABB(uint32_t primitiveIndex, int axis, float slabMin, float slabMax)>;
+
+		std::vector<BVHNode> nodes{};
+		//Spatial splits can reference the same primitive from several leaves, so this may be longer than primitiveCount
+		std::vector<uint32_t> primitiveIndices{};
+		uint32_t primitiveCount{};
+
+		//SAH cost right after the last full build, reference for the refit quality
+		float buildCost{};
+
+		//Builds with at least this many primitives spread binning and subtree builds over the worker threads
+		uint32_t parallelBuildThreshold{ 1 << 14 };
+		//Worker threads of those builds, they run on the calling thread without one. Never called from inside a task of this pool
+		ThreadPool* pThreadPool{ nullptr };
+
+		BVHBuilder builder{ BVHBuilder::BinnedSAH };
+
+		//Node order after a build, primitiveIndices always follow the leaf order
+		BVHLayout layout{ BVHLayout::VanEmdeBoas };
+
+		//Extra references the spatial split builder may create, as a fraction of primitiveCount
+		float spatialSplitBudget{ .5f };
+
+		/**
+		 * \brief Builds the tree from scratch with the selected builder
+		 * \param clipPrimitive exact primitive clipping for spatial splits, without it the primitive bounds are clipped instead
+		 */
+		void Build(const std::vector<AABB>& primitiveBounds, const PrimitiveClipper& clipPrimitive = nullptr);
+		void Clear();
+
+		/**
+		 * \brief Recomputes all node bounds bottom-up, keeping the current topology
+		 * \param primitiveBounds new bounds, same primitive count and order as the last Build
+		 * \return SAH cost of the refitted tree, computed in the same sweep (see CalculateSAHCost)
+		 */
+		float Refit(const std::vector<AABB>& primitiveBounds);
+
+		/**
+		 * \brief Refits the tree, falls back to a full build when the primitive count changed
+		 * or when the refitted SAH cost exceeds buildCost * rebuildThreshold.
+		 * Linear builds skip the refit and always rebuild.
+		 * \return true when the tree was rebuilt
+		 */
+		bool Update(const std::vector<AABB>& primitiveBounds, float rebuildThreshold, const PrimitiveClipper& clipPrimitive = nullptr);
+
+		/**
+		 * \brief SAH cost of the whole tree, relative to the surface area of the root node
+		 * \return expected cost of a random ray hitting the root (lower is better)
+		 */
+		float CalculateSAHCost() const;
+
+		static constexpr float TraversalCost{ 1.f };
+		static constexpr float IntersectionCost{ 1.f };
+		static constexpr uint32_t MaxLeafSize{ 8 };
+		static constexpr int BinCount{ 16 };
+
+		//Morton code bits per axis of the linear builder
+		static constexpr int MortonBits{ 10 };
+		static constexpr uint32_t LinearLeafSize{ 4 };
+
+		//Spatial splits are only tried when the children of the best object split overlap by more than this fraction of the root area
+		static constexpr float SpatialSplitOverlap{ 1e-5f };
+
+		//Nodes with at least this many primitives bin in parallel chunks during a parallel build
+		static constexpr uint32_t ParallelBinningThreshold{ 1 << 16 };
+
+	private:
+		struct BuildTask
+		{
+			uint32_t nodeIndex;
+			AABB centroidBounds;
+		};
+
+		//Top-level partitions collected for the parallel build, nullptr during a serial build
+		struct BuildTasks
+		{
+			uint32_t taskSize;
+			std::vector<BuildTask> tasks;
+		};
+
+		void BuildBinnedSAH(const std::vector<AABB>& primitiveBounds);
+		void BuildLinear(const std::vector<AABB>& primitiveBounds);
+		void BuildSpatialSplits(const std::vector<AABB>& primitiveBounds, const PrimitiveClipper& clipPrimitive);
+
+		void Subdivide(std::vector<BVHNode>& nodeList, uint32_t nodeIndex, const AABB& centroidBounds,
+			const std::vector<AABB>& primitiveBounds, const std::vector<Vector3>& centroids, BuildTasks* pTasks);
+		void SubdivideLinear(std::vector<BVHNode>& nodeList, uint32_t nodeIndex, const std::vector<uint32_t>& mortonCodes, BuildTasks* pTasks);
+
+		//Piece of a primitive owned by one node of the spatial split build
+		struct SpatialReference
+		{
+			AABB bounds;
+			uint32_t primitiveIndex;
+		};
+
+		struct SpatialSplitState;
+		void SubdivideSpatial(uint32_t nodeIndex, std::vector<SpatialReference>& references, const SpatialSplitState& state, uint32_t referenceBudget);
+
+		//Rewrites nodes in van Emde Boas order and primitiveIndices in the new leaf order, siblings stay next to each other
+		void ReorderNodes();
+
+		//Builds every task into its own node list on the worker threads and appends them to nodes
+		void BuildSubtreesInParallel(const BuildTasks& buildTasks, const std::function<void(std::vector<BVHNode>& subtree, const BuildTask& task)>& buildSubtree);
+
+		//Recomputes the bounds of the first nodeCount nodes of nodeList, back to front, and returns the summed SAH cost of those nodes
+		float RefitNodes(std::vector<BVHNode>& nodeList, size_t nodeCount, const std::vector<AABB>& primitiveBounds) const;
+	};
+#pragma endregion
+
+#pragma region WIDE BVH
+	//Four children per node with their bounds stored SoA, so one SSE slab test checks all of them
+	struct alignas(16) WideBVHNode
+	{
+		static constexpr int Width{ 4 };
+
+		float minX[Width];
+		float minY[Width];
+		float minZ[Width];
+		float maxX[Width];
+		float maxY[Width];
+		float maxZ[Width];
+
+		//Interior child: index of the child node, leaf child: first primitive in BVH::primitiveIndices
+		uint32_t children[Width];
+		//0 for interior children
+		uint32_t primitiveCounts[Width];
+	};
+
+	/**
+	 * \brief 4-wide BVH collapsed from a binary BVH, it shares the primitiveIndices of that BVH.
+	 * Unused child slots have infinite bounds so the slab test always rejects them.
+	 */
+	struct WideBVH
+	{
+		std::vector<WideBVHNode> nodes{};
+		//Binary node behind every used child slot, Width per node, so a refit copies the new bounds without collapsing again
+		std::vector<uint32_t> sourceNodes{};
+
+		void Collapse(const BVH& bvh);
+		//Takes the child bounds over from the binary BVH it was collapsed from, after that BVH was refitted
+		void Refit(const BVH& bvh);
+		void Clear();
+
+	private:
+		void CollapseNode(const BVH& bvh, uint32_t binaryNodeIndex, uint32_t wideNodeIndex);
+	};
+#pragma endregion
+
+#pragma region COMPRESSED WIDE BVH
+	/**
+	 * \brief 4-wide node that fits in one cache line. Child bounds are 8-bit offsets on a per-axis grid anchored at origin,
+	 * with a power of two cell size, rounded outwards so the quantized boxes always contain the real ones.
+	 */
+	struct alignas(64) CompressedWideBVHNode
+	{
+		static constexpr int Width{ WideBVHNode::Width };
+
+		float origin[3];
+		//Cell size along each axis is 2^exponent
+		int8_t exponents[3];
+		//Used children come first, the remaining slots are ignored
+		uint8_t childCount;
+		//0 for interior children
+		uint8_t primitiveCounts[Width];
+
+		uint8_t minX[Width];
+		uint8_t minY[Width];
+		uint8_t minZ[Width];
+		uint8_t maxX[Width];
+		uint8_t maxY[Width];
+		uint8_t maxZ[Width];
+
+		//Interior child: index of the child node, leaf child: first primitive in BVH::primitiveIndices
+		uint32_t children[Width];
+	};
+	static_assert(sizeof(CompressedWideBVHNode) == 64, "Compressed nodes are meant to fill exactly one cache line");
+
+	//Quantized copy of a WideBVH at half its size, it shares the primitiveIndices of the binary BVH as well
+	struct CompressedWideBVH
+	{
+		std::vector<CompressedWideBVHNode> nodes{};
+		//Binary node behind every used child slot, Width per node, the wide BVH is usually not kept around
+		std::vector<uint32_t> sourceNodes{};
+
+		void Compress(const WideBVH& wideBvh);
+		//Quantizes the child bounds again from the binary BVH the wide BVH was collapsed from, after that BVH was refitted
+		void Refit(const BVH& bvh);
+		void Clear();
+
+	private:
+		void CompressNode(const WideBVH& wideBvh, uint32_t wideNodeIndex, uint32_t compressedNodeIndex);
+		//Leaves with more primitives than a count byte holds are spread over extra nodes
+		void CompressLeaf(const AABB& bounds, uint32_t sourceNode, uint32_t firstPrimitive, uint32_t primitiveCount, uint32_t compressedNodeIndex);
+	};
+#pragma endregion
+}
@@ -73,7 +73,7 @@ namespace dae
 			return *this;
 		}
 
-		const ColorRGB& operator/(const ColorRGB& c) const
+		ColorRGB operator/(const ColorRGB& c) const
 		{
 			return { r / c.r, g / c.g, b / c.b };
 		}
@@ -101,7 +101,7 @@ namespace dae
 			return *this;
 		}
 
-		const ColorRGB& operator/(float s) const
+		ColorRGB operator/(float s) const
 		{
 			return { r / s, g / s, b / s };
 		}
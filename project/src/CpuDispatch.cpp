@@ -0,0 +1,154 @@
+#include "CpuDispatch.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace dae
+{
+	//Tables of the kernel variants, one translation unit each
+	namespace SSE42 { extern const Kernels kernels; }
+	namespace AVX2 { extern const Kernels kernels; }
+	namespace AVX512 { extern const Kernels kernels; }
+}
+
+namespace
+{
+	struct CpuidRegisters
+	{
+		uint32_t eax, ebx, ecx, edx;
+	};
+
+	CpuidRegisters Cpuid(uint32_t leaf, uint32_t subleaf)
+	{
+#if defined(_MSC_VER)
+		int registers[4];
+		__cpuidex(registers, static_cast<int>(leaf), static_cast<int>(subleaf));
+		return CpuidRegisters{ uint32_t(registers[0]), uint32_t(registers[1]), uint32_t(registers[2]), uint32_t(registers[3]) };
+#else
+		CpuidRegisters registers{};
+		__cpuid_count(leaf, subleaf, registers.eax, registers.ebx, registers.ecx, registers.edx);
+		return registers;
+#endif
+	}
+
+	//Register state the operating system saves on a context switch, wider registers are useless without it
+	uint64_t GetEnabledRegisterState()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return (uint64_t(edx) << 32) | eax;
+#endif
+	}
+
+	bool HasBits(uint32_t value, uint32_t bits)
+	{
+		return (value & bits) == bits;
+	}
+
+	dae::InstructionSet DetectBest()
+	{
+		using dae::InstructionSet;
+
+		const uint32_t maxLeaf{ Cpuid(0, 0).eax };
+		const CpuidRegisters features{ Cpuid(1, 0) };
+
+		//FMA, OSXSAVE and AVX
+		if (maxLeaf < 7 || !HasBits(features.ecx, (1u << 12) | (1u << 27) | (1u << 28))) return InstructionSet::SSE42;
+
+		const uint64_t registerState{ GetEnabledRegisterState() };
+		const CpuidRegisters extendedFeatures{ Cpuid(7, 0) };
+
+		//XMM and YMM state, AVX2
+		if (!HasBits(uint32_t(registerState), 0x6) || !HasBits(extendedFeatures.ebx, 1u << 5)) return InstructionSet::SSE42;
+
+		//Opmask and ZMM state, AVX-512 F, DQ, BW and VL
+		if (!HasBits(uint32_t(registerState), 0xE0) || !HasBits(extendedFeatures.ebx, (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31)))
+			return InstructionSet::AVX2;
+
+		return InstructionSet::AVX512;
+	}
+
+	const dae::Kernels& GetVariant(dae::InstructionSet instructionSet)
+	{
+		switch (instructionSet)
+		{
+		case dae::InstructionSet::AVX512:
+			return dae::AVX512::kernels;
+		case dae::InstructionSet::AVX2:
+			return dae::AVX2::kernels;
+		case dae::InstructionSet::SSE42:
+		default:
+			return dae::SSE42::kernels;
+		}
+	}
+
+	const dae::InstructionSet g_BestInstructionSet{ DetectBest() };
+	const dae::Kernels* g_pKernels{ &GetVariant(g_BestInstructionSet) };
+}
+
+namespace dae
+{
+	namespace CpuDispatch
+	{
+		InstructionSet DetectInstructionSet()
+		{
+			return g_BestInstructionSet;
+		}
+
+		bool IsSupported(InstructionSet instructionSet)
+		{
+			return instructionSet <= g_BestInstructionSet;
+		}
+
+		bool SelectInstructionSet(InstructionSet instructionSet)
+		{
+			if (!IsSupported(instructionSet)) return false;
+
+			g_pKernels = &GetVariant(instructionSet);
+			return true;
+		}
+
+		InstructionSet GetInstructionSet()
+		{
+			return g_pKernels->instructionSet;
+		}
+
+		const Kernels& GetKernels()
+		{
+			return *g_pKernels;
+		}
+
+		const char* GetName(InstructionSet instructionSet)
+		{
+			switch (instructionSet)
+			{
+			case InstructionSet::AVX512:
+				return "avx512";
+			case InstructionSet::AVX2:
+				return "avx2";
+			case InstructionSet::SSE42:
+			default:
+				return "sse4.2";
+			}
+		}
+
+		bool ParseInstructionSet(const std::string& name, InstructionSet& instructionSet)
+		{
+			for (const InstructionSet candidate : { InstructionSet::SSE42, InstructionSet::AVX2, InstructionSet::AVX512 })
+			{
+				if (name == GetName(candidate))
+				{
+					instructionSet = candidate;
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	//Forward Declarations
+	struct Ray;
+	struct HitRecord;
+	struct RayPacket;
+	struct TriangleMesh;
+	struct TriangleMeshInstance;
+	struct ColorRGB;
+
+	//Instruction sets the hot kernels are built for, SSE4.2 is the oldest hardware supported
+	enum class InstructionSet
+	{
+		SSE42,
+		AVX2,
+		AVX512
+	};
+
+	//Bit positions of the 8 bit channels of a 32 bit framebuffer, alphaMask is or'ed into every pixel as is
+	struct PixelFormat
+	{
+		uint32_t redShift{ 16 };
+		uint32_t greenShift{ 8 };
+		uint32_t blueShift{ 0 };
+		uint32_t alphaMask{ 0 };
+	};
+
+	//Hot kernels of one instruction set, see KernelVariant.h
+	struct Kernels
+	{
+		InstructionSet instructionSet{};
+
+		bool (*hitTestTriangleMesh)(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord){};
+		bool (*hitTestTriangleMeshInstance)(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord){};
+		void (*hitTestTriangleMeshPacket)(const TriangleMesh& mesh, RayPacket& packet, uint64_t rayMask, HitRecord* pHitRecords){};
+
+		//Occlusion queries, pOccludingTriangle is optional
+		bool (*occlusionTestTriangleMesh)(const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle){};
+		bool (*occlusionTestTriangleMeshInstance)(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle){};
+
+		//Scales colors brighter than white down to it and packs them into consecutive framebuffer pixels
+		void (*packPixels)(const ColorRGB* pColors, uint32_t count, const PixelFormat& format, uint32_t* pPixels){};
+	};
+
+	namespace CpuDispatch
+	{
+		//Best instruction set the CPU and operating system support, through cpuid
+		InstructionSet DetectInstructionSet();
+		bool IsSupported(InstructionSet instructionSet);
+
+		/**
+		 * \brief Switches every kernel call over to the variant of instructionSet, call before rendering starts.
+		 * The best supported variant is selected at startup.
+		 * \return false when the CPU does not support it, the selection is left as is then
+		 */
+		bool SelectInstructionSet(InstructionSet instructionSet);
+		InstructionSet GetInstructionSet();
+
+		const Kernels& GetKernels();
+
+		const char* GetName(InstructionSet instructionSet);
+		//Accepts the names of GetName: "sse4.2", "avx2" or "avx512"
+		bool ParseInstructionSet(const std::string& name, InstructionSet& instructionSet);
+	}
+}
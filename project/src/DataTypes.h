@@ -1,8 +1,11 @@
 #pragma once
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 
 #include "Maths.h"
+#include "BVH.h"
+#include "ThreadPool.h"
 
 
 namespace dae
@@ -55,6 +58,30 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Intersection data of every triangle of a mesh in structure-of-arrays form, one array per component
+	struct PrecomputedTriangles
+	{
+		std::vector<float> v0[3]{};
+		//v1 - v0 and v2 - v0
+		std::vector<float> edge1[3]{};
+		std::vector<float> edge2[3]{};
+		std::vector<float> normal[3]{};
+
+		//Wide kernels load whole vectors from the first triangle of a leaf on, so up to 7 triangles past the last one are read
+		static constexpr size_t Padding{ 7 };
+
+		void Resize(size_t triangleCount)
+		{
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				v0[axis].resize(triangleCount + Padding);
+				edge1[axis].resize(triangleCount + Padding);
+				edge2[axis].resize(triangleCount + Padding);
+				normal[axis].resize(triangleCount + Padding);
+			}
+		}
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -91,6 +118,29 @@ namespace dae
 		std::vector<Vector3> transformedPositions{};
 		std::vector<Vector3> transformedNormals{};
 
+		//Meshes with at least this many positions and normals transform their blocks on the worker threads
+		uint32_t parallelTransformThreshold{ 1 << 16 };
+		//Worker threads of the transforms and BVH builds, everything runs on the calling thread without one
+		ThreadPool* pThreadPool{ nullptr };
+
+		//Acceleration structure over the triangles in transformedPositions, primitive i is triangle indices[3i..3i+2]
+		BVH bvh{};
+		std::vector<AABB> triangleBounds{};
+
+		//Animated meshes only refit their BVH, a full rebuild happens once the SAH cost grows past this factor
+		float bvhRebuildThreshold{ 1.5f };
+
+		//What the intersection kernel reads instead of the positions and normals, in the same triangle order
+		PrecomputedTriangles precomputedTriangles{};
+
+		//Traverse the 4-wide version of the BVH, collapsed from bvh after every update
+		WideBVH wideBvh{};
+		bool useWideBVH{ true };
+
+		//Traverse a quantized copy of the 4-wide BVH instead, half the node memory for a little dequantization work
+		CompressedWideBVH compressedBvh{};
+		bool useCompressedBVH{ false };
+
 		void Translate(const Vector3& translation)
 		{
 			translationTransform = Matrix::CreateTranslation(translation);
@@ -155,29 +205,231 @@ namespace dae
 
 		void UpdateTransforms()
 		{
-			Matrix finalTransform = scaleTransform * rotationTransform * translationTransform;
+			const Matrix finalTransform = scaleTransform * rotationTransform * translationTransform;
+
+			//Normals take the inverse transpose, like TriangleMeshInstance, so they stay perpendicular under a non-uniform scale
+			TransformVertices(AffineMatrix{ finalTransform }, AffineMatrix{ Matrix::Transpose(Matrix::Inverse(finalTransform)) });
+
+			UpdateTransformedAABB(finalTransform);
+			RefitOrRebuildBVH();
+		}
+
+		/**
+		 * \brief Fills transformedPositions, then transforms the normals and fills triangleBounds and precomputedTriangles triangle block by triangle block.
+		 * Both passes run in blocks of SIMD batches, spread over the worker threads for large meshes, the triangles need every position so those go first.
+		 * Does not allocate once the arrays have grown to the size of the mesh
+		 * \param normalTransform is applied to the normals before they are normalized again
+		 */
+		void TransformVertices(const AffineMatrix& transform, const AffineMatrix& normalTransform)
+		{
+			const uint32_t positionCount{ static_cast<uint32_t>(positions.size()) };
+			transformedPositions.resize(positionCount);
+			transformedNormals.resize(normals.size());
+
+			ForEachBlock(positionCount, [&](uint32_t first, uint32_t count)
+				{
+					transform.TransformPoints(positions.data() + first, transformedPositions.data() + first, count);
+				});
+
+			UpdateTriangles(&normalTransform);
+		}
+
+		//For when the BVH settings changed: recomputes the triangle data from the transformed positions, then refits or rebuilds the BVH
+		void UpdateBVH()
+		{
+			UpdateTriangles(nullptr);
+			RefitOrRebuildBVH();
+		}
+
+		//Expects triangleBounds and precomputedTriangles to match the transformed positions
+		void RefitOrRebuildBVH()
+		{
+			bvh.pThreadPool = pThreadPool;
+			const bool isRebuilt{ bvh.Update(triangleBounds, bvhRebuildThreshold, [this](uint32_t triangleIndex, int axis, float slabMin, float slabMax)
+				{
+					return ClipTriangleBounds(triangleIndex, axis, slabMin, slabMax);
+				}) };
+
+			if (isRebuilt)
+			{
+				SortTrianglesByLeafOrder();
+				//The triangles were renumbered
+				UpdateTriangles(nullptr);
+			}
+
+			//A refit keeps the topology, so the wide and compressed nodes only need their bounds updated
+			if (useCompressedBVH)
+			{
+				if (isRebuilt || compressedBvh.nodes.empty())
+				{
+					//Only the compressed nodes are kept around when they are used
+					wideBvh.Collapse(bvh);
+					compressedBvh.Compress(wideBvh);
+				}
+				else
+				{
+					compressedBvh.Refit(bvh);
+				}
+				wideBvh.Clear();
+				return;
+			}
+
+			compressedBvh.Clear();
+			if (!useWideBVH)
+				wideBvh.Clear();
+			else if (isRebuilt || wideBvh.nodes.empty())
+				wideBvh.Collapse(bvh);
+			else
+				wideBvh.Refit(bvh);
+		}
+
+		/**
+		 * \brief Fills triangleBounds and precomputedTriangles from the transformed positions, in the same blocks as TransformVertices
+		 * \param pNormalTransform when set, the normals of every block are transformed first
+		 */
+		void UpdateTriangles(const AffineMatrix* pNormalTransform)
+		{
+			const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+			triangleBounds.resize(triangleCount);
+			precomputedTriangles.Resize(triangleCount);
 
+			ForEachBlock(triangleCount, [&](uint32_t first, uint32_t count)
+				{
+					if (pNormalTransform)
+						pNormalTransform->TransformNormals(normals.data() + first, transformedNormals.data() + first, count);
+
+					for (uint32_t i{ first }; i < first + count; ++i)
+					{
+						const Vector3& v0 = transformedPositions[indices[3 * i]];
+						const Vector3& v1 = transformedPositions[indices[3 * i + 1]];
+						const Vector3& v2 = transformedPositions[indices[3 * i + 2]];
+						const Vector3& normal = transformedNormals[i];
+
+						AABB& bounds = triangleBounds[i];
+						bounds = AABB{};
+						bounds.Grow(v0);
+						bounds.Grow(v1);
+						bounds.Grow(v2);
+
+						precomputedTriangles.v0[0][i] = v0.x;
+						precomputedTriangles.v0[1][i] = v0.y;
+						precomputedTriangles.v0[2][i] = v0.z;
+						precomputedTriangles.edge1[0][i] = v1.x - v0.x;
+						precomputedTriangles.edge1[1][i] = v1.y - v0.y;
+						precomputedTriangles.edge1[2][i] = v1.z - v0.z;
+						precomputedTriangles.edge2[0][i] = v2.x - v0.x;
+						precomputedTriangles.edge2[1][i] = v2.y - v0.y;
+						precomputedTriangles.edge2[2][i] = v2.z - v0.z;
+						precomputedTriangles.normal[0][i] = normal.x;
+						precomputedTriangles.normal[1][i] = normal.y;
+						precomputedTriangles.normal[2][i] = normal.z;
+					}
+				});
+		}
 
-			transformedPositions.clear();
-			transformedNormals.clear();
+		//Calls function(first, count) for consecutive blocks of [0, count), on pThreadPool once the mesh reaches parallelTransformThreshold
+		template<typename Function>
+		void ForEachBlock(uint32_t count, Function&& function)
+		{
+			constexpr uint32_t blockSize{ 1 << 12 };
+			const uint32_t blockCount{ (count + blockSize - 1) / blockSize };
 
-			transformedPositions.reserve(positions.size());
-			transformedNormals.reserve(normals.size());
+			const auto runBlock = [&](uint32_t block)
+				{
+					const uint32_t first{ block * blockSize };
+					function(first, std::min(blockSize, count - first));
+				};
 
-			for (auto& n : normals)
+			if (!pThreadPool || positions.size() + normals.size() < parallelTransformThreshold)
 			{
-				transformedNormals.emplace_back(
-					(rotationTransform * scaleTransform).TransformVector(n).Normalized());
+				for (uint32_t block{ 0 }; block < blockCount; ++block)
+				{
+					runBlock(block);
+				}
+				return;
+			}
 
+			pThreadPool->Run(blockCount, [&](uint32_t block, uint32_t)
+				{
+					runBlock(block);
+				});
+		}
+
+		//Renumbers the triangles in the order the BVH leaves reference them, so a leaf reads neighbouring triangles
+		void SortTrianglesByLeafOrder()
+		{
+			const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+			constexpr uint32_t unassigned{ UINT32_MAX };
+			std::vector<uint32_t> newTriangleIndices(triangleCount, unassigned);
+
+			std::vector<int> sortedIndices{};
+			std::vector<Vector3> sortedNormals{};
+			std::vector<Vector3> sortedTransformedNormals{};
+			std::vector<AABB> sortedBounds{};
+			sortedIndices.reserve(indices.size());
+			sortedNormals.reserve(triangleCount);
+			sortedTransformedNormals.reserve(triangleCount);
+			sortedBounds.reserve(triangleCount);
+
+			//Split references point at a triangle more than once, it goes where it is referenced first
+			for (uint32_t& primitiveIndex : bvh.primitiveIndices)
+			{
+				uint32_t& newIndex = newTriangleIndices[primitiveIndex];
+				if (newIndex == unassigned)
+				{
+					newIndex = static_cast<uint32_t>(sortedNormals.size());
+					sortedIndices.insert(sortedIndices.end(), indices.begin() + 3 * primitiveIndex, indices.begin() + 3 * primitiveIndex + 3);
+					sortedNormals.emplace_back(normals[primitiveIndex]);
+					sortedTransformedNormals.emplace_back(transformedNormals[primitiveIndex]);
+					sortedBounds.emplace_back(triangleBounds[primitiveIndex]);
+				}
+				primitiveIndex = newIndex;
 			}
 
-			for (auto& p : positions)
+			//Triangles no leaf references keep their relative order at the end
+			for (uint32_t triangleIndex{ 0 }; triangleIndex < triangleCount; ++triangleIndex)
 			{
-				transformedPositions.emplace_back(
-					finalTransform.TransformPoint(p));
+				if (newTriangleIndices[triangleIndex] != unassigned) continue;
+
+				sortedIndices.insert(sortedIndices.end(), indices.begin() + 3 * triangleIndex, indices.begin() + 3 * triangleIndex + 3);
+				sortedNormals.emplace_back(normals[triangleIndex]);
+				sortedTransformedNormals.emplace_back(transformedNormals[triangleIndex]);
+				sortedBounds.emplace_back(triangleBounds[triangleIndex]);
 			}
 
-			UpdateTransformedAABB(finalTransform);
+			indices.swap(sortedIndices);
+			normals.swap(sortedNormals);
+			transformedNormals.swap(sortedTransformedNormals);
+			triangleBounds.swap(sortedBounds);
+		}
+
+		//Bounds of the part of a transformed triangle between slabMin and slabMax along axis, used for spatial BVH splits
+		AABB ClipTriangleBounds(uint32_t triangleIndex, int axis, float slabMin, float slabMax) const
+		{
+			const Vector3 vertices[3]{
+				transformedPositions[indices[3 * triangleIndex]],
+				transformedPositions[indices[3 * triangleIndex + 1]],
+				transformedPositions[indices[3 * triangleIndex + 2]] };
+
+			AABB bounds{};
+			for (int i{ 0 }; i < 3; ++i)
+			{
+				const Vector3& start = vertices[i];
+				const Vector3& end = vertices[(i + 1) % 3];
+
+				if (start[axis] >= slabMin && start[axis] <= slabMax) bounds.Grow(start);
+
+				//Points where the edge crosses the slab planes
+				for (const float plane : { slabMin, slabMax })
+				{
+					if ((start[axis] - plane) * (end[axis] - plane) < 0.f)
+					{
+						const float t{ (plane - start[axis]) / (end[axis] - start[axis]) };
+						bounds.Grow(start + (end - start) * t);
+					}
+				}
+			}
+			return bounds;
 		}
 
 		void UpdateAABB()
@@ -199,7 +451,7 @@ namespace dae
 			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB);
 			Vector3 tMaxAABB = tMinAABB;
 
-			const std::vector<Vector3> corners = {
+			const Vector3 corners[8] = {
 				{minAABB.x, minAABB.y, minAABB.z}, {maxAABB.x, minAABB.y, minAABB.z},
 				{maxAABB.x, minAABB.y, maxAABB.z}, {minAABB.x, minAABB.y, maxAABB.z},
 				{minAABB.x, maxAABB.y, minAABB.z}, {maxAABB.x, maxAABB.y, minAABB.z},
@@ -208,15 +460,67 @@ namespace dae
 
 			for (const auto& corner : corners)
 			{
-				const Vector3 tAABB = finalTransform.TransformPoint(corner);
-				tMinAABB = Vector3::Min(tAABB, tMinAABB);
-				tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+				const Vector3 transformedCorner{ finalTransform.TransformPoint(corner) };
+				tMinAABB = Vector3::Min(transformedCorner, tMinAABB);
+				tMaxAABB = Vector3::Max(transformedCorner, tMaxAABB);
 			}
 
 			transformedMinAABB = tMinAABB;
 			transformedMaxAABB = tMaxAABB;
 		}
 	};
+
+	//Places a shared, untransformed TriangleMesh in the scene. Rays are intersected in object space,
+	//so moving an instance costs the same no matter how many triangles the mesh has.
+	struct TriangleMeshInstance
+	{
+		uint32_t meshIndex{};
+		unsigned char materialIndex{};
+
+		Matrix rotationTransform{};
+		Matrix translationTransform{};
+		Matrix scaleTransform{};
+
+		Matrix transform{};
+		Matrix inverseTransform{};
+		Matrix normalTransform{};
+
+		void Translate(const Vector3& translation)
+		{
+			translationTransform = Matrix::CreateTranslation(translation);
+		}
+
+		void RotateY(float yaw)
+		{
+			rotationTransform = Matrix::CreateRotationY(yaw);
+		}
+
+		void Scale(const Vector3& scale)
+		{
+			scaleTransform = Matrix::CreateScale(scale);
+		}
+
+		void UpdateTransforms()
+		{
+			transform = scaleTransform * rotationTransform * translationTransform;
+			inverseTransform = Matrix::Inverse(transform);
+			normalTransform = Matrix::Transpose(inverseTransform);
+		}
+
+		//World space bounds of the instanced mesh
+		AABB GetTransformedAABB(const TriangleMesh& mesh) const
+		{
+			AABB bounds{};
+			for (int corner{ 0 }; corner < 8; ++corner)
+			{
+				bounds.Grow(transform.TransformPoint(
+					(corner & 1) ? mesh.maxAABB.x : mesh.minAABB.x,
+					(corner & 2) ? mesh.maxAABB.y : mesh.minAABB.y,
+					(corner & 4) ? mesh.maxAABB.z : mesh.minAABB.z));
+			}
+			return bounds;
+		}
+	};
 #pragma endregion
 #pragma region LIGHT
 	enum class LightType
@@ -245,6 +549,90 @@ namespace dae
 		float max{ FLT_MAX };
 	};
 
+	//Up to 64 rays traced together, stored per component so 4 rays fit one SSE register, bit i of a ray mask stands for ray i
+	struct RayPacket
+	{
+		static constexpr uint32_t MaxSize{ 64 };
+
+		uint32_t size{};
+
+		alignas(16) float origin[3][MaxSize]{};
+		alignas(16) float direction[3][MaxSize]{};
+		alignas(16) float invDirection[3][MaxSize]{};
+		//Traversals shorten max as closer hits are found, like they do with a single ray
+		alignas(16) float min[MaxSize]{};
+		alignas(16) float max[MaxSize]{};
+
+		void SetRay(uint32_t index, const Ray& ray)
+		{
+			const float rayOrigin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+			const float rayDirection[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				origin[axis][index] = rayOrigin[axis];
+				direction[axis][index] = rayDirection[axis];
+				invDirection[axis][index] = 1.f / rayDirection[axis];
+			}
+			min[index] = ray.min;
+			max[index] = ray.max;
+		}
+
+		Ray GetRay(uint32_t index) const
+		{
+			return Ray{
+				{ origin[0][index], origin[1][index], origin[2][index] },
+				{ direction[0][index], direction[1][index], direction[2][index] },
+				min[index], max[index] };
+		}
+
+		uint64_t GetFullMask() const
+		{
+			return size == MaxSize ? ~uint64_t{ 0 } : (uint64_t{ 1 } << size) - 1;
+		}
+	};
+
+	//Rays of a whole render stage, stored per component like a RayPacket but without a size limit
+	struct RayStream
+	{
+		std::vector<float> origin[3]{};
+		std::vector<float> direction[3]{};
+		std::vector<float> min{};
+		std::vector<float> max{};
+
+		void Resize(size_t rayCount)
+		{
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				origin[axis].resize(rayCount);
+				direction[axis].resize(rayCount);
+			}
+			min.resize(rayCount);
+			max.resize(rayCount);
+		}
+
+		size_t Size() const { return min.size(); }
+
+		void SetRay(size_t index, const Ray& ray)
+		{
+			origin[0][index] = ray.origin.x;
+			origin[1][index] = ray.origin.y;
+			origin[2][index] = ray.origin.z;
+			direction[0][index] = ray.direction.x;
+			direction[1][index] = ray.direction.y;
+			direction[2][index] = ray.direction.z;
+			min[index] = ray.min;
+			max[index] = ray.max;
+		}
+
+		Ray GetRay(size_t index) const
+		{
+			return Ray{
+				{ origin[0][index], origin[1][index], origin[2][index] },
+				{ direction[0][index], direction[1][index], direction[2][index] },
+				min[index], max[index] };
+		}
+	};
+
 	struct HitRecord
 	{
 		Vector3 origin{};
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Grid.h"
+
+namespace dae {
+	namespace
+	{
+		//Cells along each axis so that the extent holds about cellCount cells of a roughly cubic shape
+		void CalculateResolution(const float (&extent)[3], float cellCount, int maxResolution, int (&resolution)[3])
+		{
+			const float cellsPerUnit{ std::cbrt(cellCount / (extent[0] * extent[1] * extent[2])) };
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				resolution[axis] = std::clamp(static_cast<int>(extent[axis] * cellsPerUnit), 1, maxResolution);
+			}
+		}
+
+		//Calls function(cellIndex) for every cell of a grid the bounds overlap, cells are indexed x-major
+		//The range is widened a little so primitives touching a cell border are found from both sides
+		template<typename Function>
+		void ForEachOverlappedCell(const AABB& bounds, const float (&gridMin)[3], const float (&inverseCellSize)[3], const int (&resolution)[3], Function&& function)
+		{
+			constexpr float margin{ 1e-4f };
+			const float boundsMin[3]{ bounds.min.x, bounds.min.y, bounds.min.z };
+			const float boundsMax[3]{ bounds.max.x, bounds.max.y, bounds.max.z };
+
+			int first[3], last[3];
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				const float localMin{ (boundsMin[axis] - gridMin[axis]) * inverseCellSize[axis] - margin };
+				const float localMax{ (boundsMax[axis] - gridMin[axis]) * inverseCellSize[axis] + margin };
+				first[axis] = std::clamp(static_cast<int>(std::floor(localMin)), 0, resolution[axis] - 1);
+				last[axis] = std::clamp(static_cast<int>(std::floor(localMax)), 0, resolution[axis] - 1);
+			}
+
+			for (int z{ first[2] }; z <= last[2]; ++z)
+			{
+				for (int y{ first[1] }; y <= last[1]; ++y)
+				{
+					for (int x{ first[0] }; x <= last[0]; ++x)
+					{
+						function(static_cast<uint32_t>((z * resolution[1] + y) * resolution[0] + x));
+					}
+				}
+			}
+		}
+	}
+
+	void TwoLevelGrid::Build(const std::vector<AABB>& primitiveBounds)
+	{
+		Clear();
+		if (primitiveBounds.empty()) return;
+
+		primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+		for (const AABB& primitive : primitiveBounds)
+		{
+			bounds.Grow(primitive);
+		}
+
+		//Flat scenes still get a little thickness, so every cell has a volume
+		float gridMin[3]{ bounds.min.x, bounds.min.y, bounds.min.z };
+		float extent[3]{ bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+		const float minExtent{ std::max(std::max({ extent[0], extent[1], extent[2] }) * 1e-3f, 1e-6f) };
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			if (extent[axis] >= minExtent) continue;
+			gridMin[axis] -= (minExtent - extent[axis]) * .5f;
+			extent[axis] = minExtent;
+		}
+		bounds.min = { gridMin[0], gridMin[1], gridMin[2] };
+		bounds.max = { gridMin[0] + extent[0], gridMin[1] + extent[1], gridMin[2] + extent[2] };
+
+		CalculateResolution(extent, topLevelDensity * primitiveCount, MaxResolution, resolution);
+
+		float cellExtent[3], inverseCellSize[3];
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			cellExtent[axis] = extent[axis] / resolution[axis];
+			inverseCellSize[axis] = resolution[axis] / extent[axis];
+		}
+		cellSize = { cellExtent[0], cellExtent[1], cellExtent[2] };
+
+		const uint32_t cellCount{ static_cast<uint32_t>(resolution[0] * resolution[1] * resolution[2]) };
+		cells.resize(cellCount);
+
+		//Top-level references are counted first, so they can be written grouped by cell without reallocating
+		std::vector<uint32_t> cellStarts(cellCount + 1, 0);
+		for (const AABB& primitive : primitiveBounds)
+		{
+			ForEachOverlappedCell(primitive, gridMin, inverseCellSize, resolution, [&](uint32_t cellIndex) { ++cellStarts[cellIndex + 1]; });
+		}
+		for (uint32_t i{ 0 }; i < cellCount; ++i)
+		{
+			cellStarts[i + 1] += cellStarts[i];
+		}
+
+		std::vector<uint32_t> cellReferences(cellStarts[cellCount]);
+		std::vector<uint32_t> cellCursors(cellStarts.begin(), cellStarts.end() - 1);
+		for (uint32_t primitiveIndex{ 0 }; primitiveIndex < primitiveCount; ++primitiveIndex)
+		{
+			ForEachOverlappedCell(primitiveBounds[primitiveIndex], gridMin, inverseCellSize, resolution,
+				[&](uint32_t cellIndex) { cellReferences[cellCursors[cellIndex]++] = primitiveIndex; });
+		}
+
+		//Leaf grid resolution per occupied cell, all cells have the same shape so only the reference count differs
+		uint32_t leafCellCount{ 0 };
+		for (uint32_t cellIndex{ 0 }; cellIndex < cellCount; ++cellIndex)
+		{
+			const uint32_t referenceCount{ cellStarts[cellIndex + 1] - cellStarts[cellIndex] };
+			if (referenceCount == 0) continue;
+
+			int leafResolution[3];
+			CalculateResolution(cellExtent, leafDensity * referenceCount, MaxLeafResolution, leafResolution);
+
+			GridCell& cell = cells[cellIndex];
+			cell.firstLeafCell = leafCellCount;
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				cell.resolution[axis] = static_cast<uint8_t>(leafResolution[axis]);
+			}
+			leafCellCount += leafResolution[0] * leafResolution[1] * leafResolution[2];
+		}
+		leafCells.resize(leafCellCount);
+
+		//Same two passes inside every cell, the first one counts, the second one writes
+		const auto forEachLeafReference = [&](auto&& function)
+			{
+				for (int z{ 0 }; z < resolution[2]; ++z)
+				{
+					for (int y{ 0 }; y < resolution[1]; ++y)
+					{
+						for (int x{ 0 }; x < resolution[0]; ++x)
+						{
+							const uint32_t cellIndex{ static_cast<uint32_t>((z * resolution[1] + y) * resolution[0] + x) };
+							const GridCell& cell = cells[cellIndex];
+							if (cell.resolution[0] == 0) continue;
+
+							const float cellMin[3]{ gridMin[0] + x * cellExtent[0], gridMin[1] + y * cellExtent[1], gridMin[2] + z * cellExtent[2] };
+							const int leafResolution[3]{ cell.resolution[0], cell.resolution[1], cell.resolution[2] };
+							const float inverseLeafSize[3]{
+								leafResolution[0] * inverseCellSize[0], leafResolution[1] * inverseCellSize[1], leafResolution[2] * inverseCellSize[2] };
+
+							for (uint32_t i{ cellStarts[cellIndex] }; i < cellStarts[cellIndex + 1]; ++i)
+							{
+								const uint32_t primitiveIndex{ cellReferences[i] };
+								ForEachOverlappedCell(primitiveBounds[primitiveIndex], cellMin, inverseLeafSize, leafResolution,
+									[&](uint32_t leafIndex) { function(leafCells[cell.firstLeafCell + leafIndex], primitiveIndex); });
+							}
+						}
+					}
+				}
+			};
+
+		forEachLeafReference([](GridLeafCell& leafCell, uint32_t) { ++leafCell.count; });
+
+		uint32_t referenceCount{ 0 };
+		for (GridLeafCell& leafCell : leafCells)
+		{
+			leafCell.first = referenceCount;
+			referenceCount += leafCell.count;
+			leafCell.count = 0;
+		}
+
+		primitiveIndices.resize(referenceCount);
+		forEachLeafReference([&](GridLeafCell& leafCell, uint32_t primitiveIndex) { primitiveIndices[leafCell.first + leafCell.count++] = primitiveIndex; });
+	}
+
+	void TwoLevelGrid::Clear()
+	{
+		bounds = AABB{};
+		resolution[0] = resolution[1] = resolution[2] = 0;
+		cellSize = {};
+		cells.clear();
+		leafCells.clear();
+		primitiveIndices.clear();
+		primitiveCount = 0;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "BVH.h"
+
+namespace dae
+{
+#pragma region TWO LEVEL GRID
+	//Top-level cell, refined into its own small grid of leaf cells
+	struct GridCell
+	{
+		//Index of the first leaf cell of this cell in TwoLevelGrid::leafCells
+		uint32_t firstLeafCell{};
+		//Leaf cells along each axis, 0 when no primitive overlaps the cell
+		uint8_t resolution[3]{};
+	};
+
+	struct GridLeafCell
+	{
+		//Range in TwoLevelGrid::primitiveIndices
+		uint32_t first{};
+		uint32_t count{};
+	};
+
+	/**
+	 * \brief Two-level uniform grid, an alternative to the BVH for many primitives of similar size.
+	 * The top-level grid adapts its resolution to the primitive count, every occupied cell then gets a leaf grid
+	 * sized to the primitives overlapping it. Like the BVH it only knows about primitive bounds.
+	 */
+	struct TwoLevelGrid
+	{
+		AABB bounds{};
+		int resolution[3]{};
+		Vector3 cellSize{};
+
+		//Cells in x-major order, index = (z * resolution[1] + y) * resolution[0] + x, same for the leaf cells of one cell
+		std::vector<GridCell> cells{};
+		std::vector<GridLeafCell> leafCells{};
+		//Primitives overlapping several cells are referenced once per cell
+		std::vector<uint32_t> primitiveIndices{};
+		uint32_t primitiveCount{};
+
+		//Top-level cells per primitive, and leaf cells per primitive overlapping a top-level cell
+		float topLevelDensity{ 1.f / 16.f };
+		float leafDensity{ 2.f };
+
+		void Build(const std::vector<AABB>& primitiveBounds);
+		void Clear();
+
+		//Leaf grids index their cells with a byte per axis
+		static constexpr int MaxLeafResolution{ 255 };
+		static constexpr int MaxResolution{ 1024 };
+	};
+#pragma endregion
+}
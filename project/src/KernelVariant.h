@@ -0,0 +1,90 @@
+#pragma once
+//Body of the kernel variants: KernelsSSE42.cpp, KernelsAVX2.cpp and KernelsAVX512.cpp define KERNEL_ISA and include this,
+//CMakeLists.txt builds each of them with the compiler flags of its instruction set.
+//Everything these translation units emit must either live in the KERNEL_ISA namespace or be inlined,
+//so only header code that is already in the kernel namespace (GeometryUtils) is called from here.
+//Unoptimized code emits out of line copies of small std and Vector3 helpers that the linker may share with
+//other translation units, so CMakeLists.txt builds these files optimized in every configuration
+#ifndef KERNEL_ISA
+#error Define KERNEL_ISA before including KernelVariant.h
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#if !defined(__OPTIMIZE__)
+#error Kernel variants must be built with optimization, see set_kernel_variant_options in CMakeLists.txt
+#endif
+#elif defined(_MSC_VER)
+//MSVC has no macro for /O2, but it refuses /O2 together with /RTC, so runtime checks mean the file is not optimized
+#if defined(__MSVC_RUNTIME_CHECKS)
+#error Kernel variants must be built with /O2 and without /RTC, see set_kernel_variant_options in CMakeLists.txt
+#endif
+#endif
+
+#include <algorithm>
+#include "CpuDispatch.h"
+#include "Utils.h"
+
+namespace dae
+{
+	namespace KERNEL_ISA
+	{
+		namespace
+		{
+			bool HitTestTriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
+			{
+				return GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord, ignoreHitRecord);
+			}
+
+			bool HitTestTriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord)
+			{
+				return GeometryUtils::HitTest_TriangleMeshInstance(instance, mesh, ray, hitRecord, ignoreHitRecord);
+			}
+
+			void HitTestTriangleMeshPacket(const TriangleMesh& mesh, RayPacket& packet, uint64_t rayMask, HitRecord* pHitRecords)
+			{
+				GeometryUtils::HitTest_TriangleMesh(mesh, packet, rayMask, pHitRecords);
+			}
+
+			bool OcclusionTestTriangleMesh(const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle)
+			{
+				return GeometryUtils::HitTest_TriangleMesh(mesh, ray, pOccludingTriangle);
+			}
+
+			bool OcclusionTestTriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle)
+			{
+				return GeometryUtils::HitTest_TriangleMeshInstance(instance, mesh, ray, pOccludingTriangle);
+			}
+
+			//Same result as ColorRGB::MaxToOne followed by SDL_MapRGB, written on plain floats so the compiler vectorizes it for this instruction set
+			void PackPixels(const ColorRGB* pColors, uint32_t count, const PixelFormat& format, uint32_t* pPixels)
+			{
+				for (uint32_t i{ 0 }; i < count; ++i)
+				{
+					float r{ pColors[i].r }, g{ pColors[i].g }, b{ pColors[i].b };
+
+					const float maxValue{ std::max(r, std::max(g, b)) };
+					if (maxValue > 1.f)
+					{
+						r /= maxValue;
+						g /= maxValue;
+						b /= maxValue;
+					}
+
+					pPixels[i] = (uint32_t(static_cast<uint8_t>(r * 255)) << format.redShift)
+						| (uint32_t(static_cast<uint8_t>(g * 255)) << format.greenShift)
+						| (uint32_t(static_cast<uint8_t>(b * 255)) << format.blueShift)
+						| format.alphaMask;
+				}
+			}
+		}
+
+		extern const Kernels kernels{
+			InstructionSet::KERNEL_ISA,
+			HitTestTriangleMesh,
+			HitTestTriangleMeshInstance,
+			HitTestTriangleMeshPacket,
+			OcclusionTestTriangleMesh,
+			OcclusionTestTriangleMeshInstance,
+			PackPixels
+		};
+	}
+}
@@ -0,0 +1,3 @@
+//Hot kernels built with AVX2 and FMA enabled, see CMakeLists.txt
+#define KERNEL_ISA AVX2
+#include "KernelVariant.h"
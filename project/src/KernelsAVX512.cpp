@@ -0,0 +1,3 @@
+//Hot kernels built with AVX-512 (F, DQ, BW and VL) enabled, see CMakeLists.txt
+#define KERNEL_ISA AVX512
+#include "KernelVariant.h"
@@ -0,0 +1,3 @@
+//Hot kernels built with SSE4.2 enabled, see CMakeLists.txt
+#define KERNEL_ISA SSE42
+#include "KernelVariant.h"
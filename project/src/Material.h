@@ -1,136 +1,238 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 #include "Maths.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
 
 namespace dae
 {
-#pragma region Material BASE
-	class Material
+#pragma region Material DESCRIPTION
+	enum class MaterialType
 	{
-	public:
-		Material() = default;
-		virtual ~Material() = default;
-
-		Material(const Material&) = delete;
-		Material(Material&&) noexcept = delete;
-		Material& operator=(const Material&) = delete;
-		Material& operator=(Material&&) noexcept = delete;
-
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+		SolidColor,
+		Lambert,
+		LambertPhong,
+		CookTorrence
 	};
-#pragma endregion
 
-#pragma region Material SOLID COLOR
-	//SOLID COLOR
-	//===========
-	class Material_SolidColor final : public Material
+	//Everything needed to recreate a material, used to add materials to the table and to store them in scene snapshots
+	struct MaterialDesc
 	{
-	public:
-		Material_SolidColor(const ColorRGB& color) : m_Color(color)
+		MaterialType type{};
+		ColorRGB color{};
+		float parameters[3]{};
+
+		static MaterialDesc SolidColor(const ColorRGB& color)
 		{
+			return { MaterialType::SolidColor, color };
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
+		static MaterialDesc Lambert(const ColorRGB& diffuseColor, float kd)
 		{
-			return m_Color;
+			return { MaterialType::Lambert, diffuseColor, { kd } };
 		}
 
-	private:
-		ColorRGB m_Color{ colors::White };
-	};
-#pragma endregion
-
-#pragma region Material LAMBERT
-	//LAMBERT
-	//=======
-	class Material_Lambert final : public Material
-	{
-	public:
-		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance) {}
+		static MaterialDesc LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent)
+		{
+			return { MaterialType::LambertPhong, diffuseColor, { kd, ks, phongExponent } };
+		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		/**
+		 * \param roughness [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		 */
+		static MaterialDesc CookTorrence(const ColorRGB& albedo, float metalness, float roughness)
 		{
-			return dae::BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			return { MaterialType::CookTorrence, albedo, { metalness, roughness } };
 		}
+	};
 
-	private:
-		ColorRGB m_DiffuseColor{ colors::White };
-		float m_DiffuseReflectance{ 1.f }; //kd
+	//One hit lit by one light, what the BRDF of a material is evaluated for
+	struct MaterialSample
+	{
+		Vector3 normal{};
+		//Normalized light direction
+		Vector3 l{};
+		//Normalized view direction
+		Vector3 v{};
 	};
 #pragma endregion
 
-#pragma region Material LAMBERT PHONG
-	//LAMBERT-PHONG
-	//=============
-	class Material_LambertPhong final : public Material
+#pragma region Material TABLE
+	/**
+	 * \brief Parameters of every material, stored per material type with the terms that only depend on the material computed when it is added.
+	 * Shading dispatches on the material type once per batch of samples instead of once per hit and light
+	 */
+	class MaterialTable final
 	{
 	public:
-		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
-			m_PhongExponent(phongExponent)
+		//Materials are referenced by unsigned char indices
+		static constexpr uint32_t MaxSize{ 256 };
+
+		//Returns false when the table is full or the type is unknown, the material is not added then
+		bool Add(const MaterialDesc& desc)
 		{
+			if (m_Entries.size() >= MaxSize) return false;
+
+			uint32_t parameterIndex{};
+			switch (desc.type)
+			{
+			case MaterialType::SolidColor:
+				parameterIndex = static_cast<uint32_t>(m_SolidColors.size());
+				m_SolidColors.emplace_back(desc.color);
+				break;
+			case MaterialType::Lambert:
+				parameterIndex = static_cast<uint32_t>(m_Lambert.size());
+				m_Lambert.emplace_back(BRDF::Lambert(desc.parameters[0], desc.color));
+				break;
+			case MaterialType::LambertPhong:
+				parameterIndex = static_cast<uint32_t>(m_LambertPhong.size());
+				m_LambertPhong.emplace_back(LambertPhongParameters{ BRDF::Lambert(desc.parameters[0], desc.color), desc.parameters[1], desc.parameters[2] });
+				break;
+			case MaterialType::CookTorrence:
+			{
+				const float metalness{ desc.parameters[0] }, roughness{ desc.parameters[1] };
+				const bool isMetal{ metalness > 0.f };
+
+				CookTorrenceParameters parameters{};
+				parameters.f0 = isMetal ? desc.color : ColorRGB(0.04f, 0.04f, 0.04f);
+				parameters.oneMinusF0 = ColorRGB(1.0f, 1.0f, 1.0f) - parameters.f0;
+				parameters.diffuse = BRDF::Lambert(1.0f, desc.color);
+				parameters.roughnessSquared = roughness * roughness;
+				parameters.geometryK = roughness * 0.5f;
+				parameters.isMetal = isMetal;
+
+				parameterIndex = static_cast<uint32_t>(m_CookTorrence.size());
+				m_CookTorrence.emplace_back(parameters);
+				break;
+			}
+			default:
+				return false;
+			}
+
+			m_Entries.emplace_back(Entry{ desc.type, parameterIndex });
+			m_Descs.emplace_back(desc);
+			return true;
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		void Clear()
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor)
-				+ BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, -v, hitRecord.normal);
+			m_Entries.clear();
+			m_Descs.clear();
+			m_SolidColors.clear();
+			m_Lambert.clear();
+			m_LambertPhong.clear();
+			m_CookTorrence.clear();
 		}
 
-	private:
-		ColorRGB m_DiffuseColor{ colors::White };
-		float m_DiffuseReflectance{ 0.5f }; //kd
-		float m_SpecularReflectance{ 0.5f }; //ks
-		float m_PhongExponent{ 1.f }; //Phong Exponent
-	};
-#pragma endregion
+		size_t GetSize() const { return m_Entries.size(); }
+		MaterialType GetType(unsigned char materialIndex) const { return m_Entries[materialIndex].type; }
+		const MaterialDesc& GetDesc(unsigned char materialIndex) const { return m_Descs[materialIndex]; }
 
-#pragma region Material COOK TORRENCE
-	//COOK TORRENCE
-	class Material_CookTorrence final : public Material
-	{
-	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness) :
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+		/**
+		 * \brief Evaluates the BRDF of one material for a batch of samples
+		 * \param pBRDFs receives count colors, one per sample
+		 */
+		void Shade(unsigned char materialIndex, const MaterialSample* pSamples, uint32_t count, ColorRGB* pBRDFs) const
 		{
+			const Entry& entry = m_Entries[materialIndex];
+			switch (entry.type)
+			{
+			case MaterialType::SolidColor:
+				std::fill(pBRDFs, pBRDFs + count, m_SolidColors[entry.parameterIndex]);
+				break;
+			case MaterialType::Lambert:
+				std::fill(pBRDFs, pBRDFs + count, m_Lambert[entry.parameterIndex]);
+				break;
+			case MaterialType::LambertPhong:
+			{
+				const LambertPhongParameters& parameters = m_LambertPhong[entry.parameterIndex];
+				for (uint32_t i{ 0 }; i < count; ++i)
+				{
+					const MaterialSample& sample = pSamples[i];
+					pBRDFs[i] = parameters.diffuse + BRDF::Phong(parameters.ks, parameters.phongExponent, sample.l, -sample.v, sample.normal);
+				}
+				break;
+			}
+			case MaterialType::CookTorrence:
+			{
+				const CookTorrenceParameters& parameters = m_CookTorrence[entry.parameterIndex];
+				for (uint32_t i{ 0 }; i < count; ++i)
+				{
+					pBRDFs[i] = ShadeCookTorrence(parameters, pSamples[i]);
+				}
+				break;
+			}
+			}
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+	private:
+		struct Entry
+		{
+			MaterialType type{};
+			//Index into the parameters of the type
+			uint32_t parameterIndex{};
+		};
+
+		struct LambertPhongParameters
+		{
+			ColorRGB diffuse{};
+			float ks{};
+			float phongExponent{};
+		};
+
+		struct CookTorrenceParameters
 		{
-			ColorRGB F0 = (m_Metalness > 0.0f) ? m_Albedo : ColorRGB(0.04f, 0.04f, 0.04f);
-			Vector3 halfVector = (v + l).Normalized();
+			//Base reflectivity: the albedo for metals, 0.04 for dielectrics
+			ColorRGB f0{};
+			ColorRGB oneMinusF0{};
+			ColorRGB diffuse{};
+			float roughnessSquared{};
+			//Schlick-GGX k for direct lighting
+			float geometryK{};
+			bool isMetal{};
+		};
+
+		std::vector<Entry> m_Entries{};
+		std::vector<MaterialDesc> m_Descs{};
+
+		std::vector<ColorRGB> m_SolidColors{};
+		//Lambert BRDF, it does not depend on the directions
+		std::vector<ColorRGB> m_Lambert{};
+		std::vector<LambertPhongParameters> m_LambertPhong{};
+		std::vector<CookTorrenceParameters> m_CookTorrence{};
+
+		//Same terms as BRDF::FresnelFunction_Schlick, NormalDistribution_GGX and GeometryFunction_Smith, with the material constants precomputed
+		static ColorRGB ShadeCookTorrence(const CookTorrenceParameters& parameters, const MaterialSample& sample)
+		{
+			const Vector3& n = sample.normal;
+			const Vector3& l = sample.l;
+			const Vector3& v = sample.v;
+			const Vector3 halfVector = (v + l).Normalized();
+
+			const float dotNormalLight = std::max(0.0f, Vector3::Dot(n, l));
+			const float dotNormalView = std::max(0.0f, Vector3::Dot(n, v));
+			const float dotNormalHalf = std::max(0.0f, Vector3::Dot(n, halfVector));
+			const float dotViewHalf = std::max(0.0f, Vector3::Dot(v, halfVector));
+
+			const ColorRGB fresnel = parameters.f0 + parameters.oneMinusF0 * pow(1.0f - dotViewHalf, 5.0f);
 
-			float dotNormalLight = std::max(0.0f, Vector3::Dot(hitRecord.normal, l));
-			float dotNormalView = std::max(0.0f, Vector3::Dot(hitRecord.normal, v));
-			float dotNormalHalf = std::max(0.0f, Vector3::Dot(hitRecord.normal, halfVector));
-			float dotViewHalf = std::max(0.0f, Vector3::Dot(v, halfVector));
+			const float denominator = (dotNormalHalf * dotNormalHalf * (parameters.roughnessSquared - 1.0f) + 1.0f);
+			const float normalDistribution = parameters.roughnessSquared / (M_PI * denominator * denominator);
 
-			ColorRGB fresnel = BRDF::FresnelFunction_Schlick(halfVector, v, F0);
-			float normalDistribution = BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, m_Roughness);
-			float geometry = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness);
+			const float k = parameters.geometryK;
+			const float geometry = (dotNormalView / (dotNormalView * (1.0f - k) + k)) * (dotNormalLight / (dotNormalLight * (1.0f - k) + k));
 
-			ColorRGB specularReflection = (fresnel * normalDistribution * geometry) /
+			const ColorRGB specularReflection = (fresnel * normalDistribution * geometry) /
 				(4.0f * dotNormalLight * dotNormalView + FLT_EPSILON);
 
-			float diffuseWeight = (m_Metalness > 0.0f) ? 0.0f : 1.0f - fresnel.r;
-			ColorRGB diffuseReflection = diffuseWeight * dae::BRDF::Lambert(1.0f, m_Albedo);
+			const float diffuseWeight = parameters.isMetal ? 0.0f : 1.0f - fresnel.r;
+			const ColorRGB diffuseReflection = diffuseWeight * parameters.diffuse;
 
 			return dotNormalLight * (diffuseReflection + specularReflection);
 		}
-
-	private:
-		ColorRGB m_Albedo{ 0.955f, 0.637f, 0.538f }; //Copper
-		float m_Metalness{ 1.0f };
-		float m_Roughness{ 0.1f }; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
 	};
 #pragma endregion
 }
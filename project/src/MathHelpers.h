@@ -3,6 +3,12 @@
 #include <cfloat>
 #include <algorithm>
 
+//SSE paths of the math types, define MATH_NO_SIMD to build them on plain floats only
+#if !defined(MATH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define MATH_SIMD
+#include <xmmintrin.h>
+#endif
+
 namespace dae
 {
 	/* --- CONSTANTS --- */
@@ -1,52 +1,291 @@
 #pragma once
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
 #include "Vector3.h"
 #include "Vector4.h"
 
 namespace dae {
 	struct Matrix
 	{
-		Matrix() = default;
-		Matrix(
+		constexpr Matrix() = default;
+		constexpr Matrix(
 			const Vector3& xAxis,
 			const Vector3& yAxis,
 			const Vector3& zAxis,
-			const Vector3& t);
+			const Vector3& t) :
+			Matrix({ xAxis, 0 }, { yAxis, 0 }, { zAxis, 0 }, { t, 1 })
+		{
+		}
 
-		Matrix(
+		constexpr Matrix(
 			const Vector4& xAxis,
 			const Vector4& yAxis,
 			const Vector4& zAxis,
-			const Vector4& t);
-
-		Matrix(const Matrix& m);
-
-		Vector3 TransformVector(const Vector3& v) const;
-		Vector3 TransformVector(float x, float y, float z) const;
-		Vector3 TransformPoint(const Vector3& p) const;
-		Vector3 TransformPoint(float x, float y, float z) const;
-		const Matrix& Transpose();
-
-		Vector3 GetAxisX() const;
-		Vector3 GetAxisY() const;
-		Vector3 GetAxisZ() const;
-		Vector3 GetTranslation() const;
-
-		static Matrix CreateTranslation(float x, float y, float z);
-		static Matrix CreateTranslation(const Vector3& t);
-		static Matrix CreateRotationX(float pitch);
-		static Matrix CreateRotationY(float yaw);
-		static Matrix CreateRotationZ(float roll);
-		static Matrix CreateRotation(float pitch, float yaw, float roll);
-		static Matrix CreateRotation(const Vector3& r);
-		static Matrix CreateScale(float sx, float sy, float sz);
-		static Matrix CreateScale(const Vector3& s);
-		static Matrix Transpose(const Matrix& m);
-
-		Vector4& operator[](int index);
-		Vector4 operator[](int index) const;
-		Matrix operator*(const Matrix& m) const;
-		const Matrix& operator*=(const Matrix& m);
-		bool operator==(const Matrix& m) const;
+			const Vector4& t) :
+			data{ xAxis, yAxis, zAxis, t }
+		{
+		}
+
+		constexpr Matrix(const Matrix& m) = default;
+
+		Vector3 TransformVector(const Vector3& v) const
+		{
+			return TransformVector(v.x, v.y, v.z);
+		}
+
+		Vector3 TransformVector(float x, float y, float z) const
+		{
+#ifdef MATH_SIMD
+			const __m128 result{ _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(data[0].Load(), _mm_set1_ps(x)),
+				_mm_mul_ps(data[1].Load(), _mm_set1_ps(y))),
+				_mm_mul_ps(data[2].Load(), _mm_set1_ps(z))) };
+			return Vector4::Store(result);
+#else
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z,
+				data[0].y * x + data[1].y * y + data[2].y * z,
+				data[0].z * x + data[1].z * y + data[2].z * z
+			};
+#endif
+		}
+
+		Vector3 TransformPoint(const Vector3& p) const
+		{
+			return TransformPoint(p.x, p.y, p.z);
+		}
+
+		Vector3 TransformPoint(float x, float y, float z) const
+		{
+#ifdef MATH_SIMD
+			const __m128 result{ _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(data[0].Load(), _mm_set1_ps(x)),
+				_mm_mul_ps(data[1].Load(), _mm_set1_ps(y))),
+				_mm_mul_ps(data[2].Load(), _mm_set1_ps(z))),
+				data[3].Load()) };
+			return Vector4::Store(result);
+#else
+			return Vector3{
+				data[0].x * x + data[1].x * y + data[2].x * z + data[3].x,
+				data[0].y * x + data[1].y * y + data[2].y * z + data[3].y,
+				data[0].z * x + data[1].z * y + data[2].z * z + data[3].z,
+			};
+#endif
+		}
+
+		//count points at once, see AffineMatrix::TransformPoints
+		void TransformPoints(const Vector3* pPoints, Vector3* pTransformed, size_t count) const;
+		void TransformVectors(const Vector3* pVectors, Vector3* pTransformed, size_t count) const;
+
+		const Matrix& Transpose()
+		{
+#ifdef MATH_SIMD
+			__m128 row0{ data[0].Load() }, row1{ data[1].Load() }, row2{ data[2].Load() }, row3{ data[3].Load() };
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+			data[0] = Vector4::Store(row0);
+			data[1] = Vector4::Store(row1);
+			data[2] = Vector4::Store(row2);
+			data[3] = Vector4::Store(row3);
+#else
+			Matrix result{};
+			for (int r{ 0 }; r < 4; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					result[r][c] = data[c][r];
+				}
+			}
+
+			data[0] = result[0];
+			data[1] = result[1];
+			data[2] = result[2];
+			data[3] = result[3];
+#endif
+			return *this;
+		}
+
+		const Matrix& Inverse()
+		{
+			*this = Inverse(*this);
+			return *this;
+		}
+
+		constexpr Vector3 GetAxisX() const { return data[0]; }
+		constexpr Vector3 GetAxisY() const { return data[1]; }
+		constexpr Vector3 GetAxisZ() const { return data[2]; }
+		constexpr Vector3 GetTranslation() const { return data[3]; }
+
+		static constexpr Matrix CreateTranslation(float x, float y, float z)
+		{
+			const Matrix MATRIX_T
+			{
+				Vector3{1,0,x},	//xAxis
+				Vector3{0,1,y},	//yAxis
+				Vector3{0,0,z},	//zAxis
+				Vector3{0,0,0}	//t
+			};
+
+			return { MATRIX_T };
+		}
+
+		static constexpr Matrix CreateTranslation(const Vector3& t)
+		{
+			return { Vector3::UnitX, Vector3::UnitY, Vector3::UnitZ, t };
+		}
+
+		static Matrix CreateRotationX(float pitch)
+		{
+			const Matrix MATRIX_ROTATE_X
+			{
+				Vector3{1,	0,	0},	//xAxis
+				Vector3{0,	std::cos(pitch),	-std::sin(pitch)},	//yAxis
+				Vector3{0,	std::sin(pitch),	std::cos(pitch)},	//zAxis
+				Vector3{0,	0,	0}	//t
+			};
+
+			return { MATRIX_ROTATE_X };
+		}
+
+		static Matrix CreateRotationY(float yaw)
+		{
+			const Matrix MATRIX_ROTATE_Y
+			{
+				Vector3{std::cos(yaw),	0,	std::sin(yaw)},	//xAxis
+				Vector3{0,	1,	0},	//yAxis
+				Vector3{-std::sin(yaw),	0,	std::cos(yaw)},	//zAxis
+				Vector3{0,	0,	0}	//t
+			};
+
+			return { MATRIX_ROTATE_Y };
+		}
+
+		static Matrix CreateRotationZ(float roll)
+		{
+			const Matrix MATRIX_ROTATE_Z
+			{
+				Vector3{std::cos(roll),	-std::sin(roll),	0},	//xAxis
+				Vector3{std::sin(roll),	std::cos(roll),	0},	//yAxis
+				Vector3{0,	0,	1},	//zAxis
+				Vector3{0,	0,	0}	//t
+			};
+
+			return { MATRIX_ROTATE_Z };
+		}
+
+		static Matrix CreateRotation(float pitch, float yaw, float roll)
+		{
+			return CreateRotation({ pitch, yaw, roll });
+		}
+
+		static Matrix CreateRotation(const Vector3& r)
+		{
+			return CreateRotationX(r.x) * CreateRotationY(r.y) * CreateRotationZ(r.z);
+		}
+
+		static constexpr Matrix CreateScale(float sx, float sy, float sz)
+		{
+			const Matrix MATRIX_SCALE
+			{
+				Vector3{sx,	0,	0},	//xAxis
+				Vector3{0,	sy,	0},	//yAxis
+				Vector3{0,	0,	sz},	//zAxis
+				Vector3{0,	0,	1}	//t
+			};
+
+			return { MATRIX_SCALE };
+		}
+
+		static constexpr Matrix CreateScale(const Vector3& s)
+		{
+			return CreateScale(s.x, s.y, s.z);
+		}
+
+		static Matrix Transpose(const Matrix& m)
+		{
+			Matrix out{ m };
+			out.Transpose();
+
+			return out;
+		}
+
+		static Matrix Inverse(const Matrix& m)
+		{
+			//Affine inverse: invert the 3x3 part, the translation becomes -t * inverse(3x3)
+			const Vector3 xAxis = m.GetAxisX();
+			const Vector3 yAxis = m.GetAxisY();
+			const Vector3 zAxis = m.GetAxisZ();
+
+			const Vector3 c0 = Vector3::Cross(yAxis, zAxis);
+			const Vector3 c1 = Vector3::Cross(zAxis, xAxis);
+			const Vector3 c2 = Vector3::Cross(xAxis, yAxis);
+
+			const float invDeterminant = 1.f / Vector3::Dot(xAxis, c0);
+
+			Matrix out
+			{
+				Vector3{ c0.x, c1.x, c2.x } * invDeterminant,
+				Vector3{ c0.y, c1.y, c2.y } * invDeterminant,
+				Vector3{ c0.z, c1.z, c2.z } * invDeterminant,
+				Vector3::Zero
+			};
+			out[3] = { -out.TransformVector(m.GetTranslation()), 1.f };
+
+			return out;
+		}
+
+		Vector4& operator[](int index)
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		Vector4 operator[](int index) const
+		{
+			assert(index <= 3 && index >= 0);
+			return data[index];
+		}
+
+		Matrix operator*(const Matrix& m) const
+		{
+			Matrix result{ *this };
+			result *= m;
+			return result;
+		}
+
+		const Matrix& operator*=(const Matrix& m)
+		{
+			//Every row becomes a combination of the rows of m, summed in the order of Vector4::Dot
+			for (int r{ 0 }; r < 4; ++r)
+			{
+#ifdef MATH_SIMD
+				const Vector4 row{ data[r] };
+				const __m128 result{ _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(row.x), m.data[0].Load()),
+					_mm_mul_ps(_mm_set1_ps(row.y), m.data[1].Load())),
+					_mm_mul_ps(_mm_set1_ps(row.z), m.data[2].Load())),
+					_mm_mul_ps(_mm_set1_ps(row.w), m.data[3].Load())) };
+				data[r] = Vector4::Store(result);
+#else
+				const Vector4 row{ data[r] };
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					data[r][c] = row.x * m.data[0][c] + row.y * m.data[1][c] + row.z * m.data[2][c] + row.w * m.data[3][c];
+				}
+#endif
+			}
+
+			return *this;
+		}
+
+		bool operator==(const Matrix& m) const
+		{
+			return data[0] == m.data[0]
+				&& data[1] == m.data[1]
+				&& data[2] == m.data[2]
+				&& data[3] == m.data[3];
+		}
 
 	private:
 
@@ -64,4 +303,142 @@ namespace dae {
 		// v2x v2y v2z v2w
 		// v3x v3y v3z v3w
 	};
-}
\ No newline at end of file
+
+	/**
+	 * \brief 3x4 affine transform: the rotation, scale and translation of a Matrix without its constant last column,
+	 * laid out row per output coordinate so batches of points transform without shuffling the matrix
+	 */
+	struct AffineMatrix
+	{
+		//Row i: the i-th coordinate of the x, y and z axis and of the translation
+		float m[3][4]
+		{
+			{1,0,0,0},
+			{0,1,0,0},
+			{0,0,1,0}
+		};
+
+		constexpr AffineMatrix() = default;
+		constexpr AffineMatrix(const Vector3& xAxis, const Vector3& yAxis, const Vector3& zAxis, const Vector3& t) :
+			m{
+				{ xAxis.x, yAxis.x, zAxis.x, t.x },
+				{ xAxis.y, yAxis.y, zAxis.y, t.y },
+				{ xAxis.z, yAxis.z, zAxis.z, t.z } }
+		{
+		}
+
+		//Drops the w column, which is 0, 0, 0, 1 for affine transforms
+		constexpr explicit AffineMatrix(const Matrix& matrix) :
+			AffineMatrix(matrix.GetAxisX(), matrix.GetAxisY(), matrix.GetAxisZ(), matrix.GetTranslation())
+		{
+		}
+
+		constexpr Matrix ToMatrix() const
+		{
+			return Matrix{
+				Vector3{ m[0][0], m[1][0], m[2][0] },
+				Vector3{ m[0][1], m[1][1], m[2][1] },
+				Vector3{ m[0][2], m[1][2], m[2][2] },
+				Vector3{ m[0][3], m[1][3], m[2][3] } };
+		}
+
+		//Same operations in the same order as Matrix, so both give the same result
+		constexpr Vector3 TransformPoint(const Vector3& p) const
+		{
+			return Vector3{
+				m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+				m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+				m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3] };
+		}
+
+		constexpr Vector3 TransformVector(const Vector3& v) const
+		{
+			return Vector3{
+				m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+				m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+				m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z };
+		}
+
+		/**
+		 * \brief Transforms count points, four at a time with SSE
+		 * \param pTransformed may be pPoints to transform in place
+		 */
+		void TransformPoints(const Vector3* pPoints, Vector3* pTransformed, size_t count) const
+		{
+			TransformBatch<true>(pPoints, pTransformed, count);
+		}
+
+		void TransformVectors(const Vector3* pVectors, Vector3* pTransformed, size_t count) const
+		{
+			TransformBatch<false>(pVectors, pTransformed, count);
+		}
+
+		//TransformVectors followed by Vector3::Normalized, for normals that have their transform premultiplied
+		void TransformNormals(const Vector3* pNormals, Vector3* pTransformed, size_t count) const
+		{
+			TransformBatch<false, true>(pNormals, pTransformed, count);
+		}
+
+	private:
+		template<bool isPoint, bool normalize = false>
+		void TransformBatch(const Vector3* pInput, Vector3* pOutput, size_t count) const
+		{
+			size_t i{ 0 };
+#ifdef MATH_SIMD
+			__m128 row[3][4];
+			for (int r{ 0 }; r < 3; ++r)
+			{
+				for (int c{ 0 }; c < 4; ++c)
+				{
+					row[r][c] = _mm_set1_ps(m[r][c]);
+				}
+			}
+
+			//Four vectors are 12 consecutive floats: loaded as three registers, shuffled to x, y and z and back
+			for (; i + 4 <= count; i += 4)
+			{
+				const float* pIn{ reinterpret_cast<const float*>(pInput + i) };
+				const __m128 a{ _mm_loadu_ps(pIn) }, b{ _mm_loadu_ps(pIn + 4) }, c{ _mm_loadu_ps(pIn + 8) };
+
+				const __m128 x{ _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)) };
+				const __m128 y{ _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)) };
+				const __m128 z{ _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)) };
+
+				__m128 result[3];
+				for (int r{ 0 }; r < 3; ++r)
+				{
+					result[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[r][0], x), _mm_mul_ps(row[r][1], y)), _mm_mul_ps(row[r][2], z));
+					if constexpr (isPoint) result[r] = _mm_add_ps(result[r], row[r][3]);
+				}
+				if constexpr (normalize)
+				{
+					const __m128 magnitude{ _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(result[0], result[0]), _mm_mul_ps(result[1], result[1])), _mm_mul_ps(result[2], result[2]))) };
+					for (__m128& coordinate : result) coordinate = _mm_div_ps(coordinate, magnitude);
+				}
+				const __m128 rx{ result[0] }, ry{ result[1] }, rz{ result[2] };
+
+				float* pOut{ reinterpret_cast<float*>(pOutput + i) };
+				_mm_storeu_ps(pOut, _mm_shuffle_ps(_mm_shuffle_ps(rx, ry, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(rz, rx, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(pOut + 4, _mm_shuffle_ps(_mm_shuffle_ps(ry, rz, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(rx, ry, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(pOut + 8, _mm_shuffle_ps(_mm_shuffle_ps(rz, rx, _MM_SHUFFLE(3, 3, 2, 2)), _mm_shuffle_ps(ry, rz, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+			}
+#endif
+			for (; i < count; ++i)
+			{
+				if constexpr (isPoint) pOutput[i] = TransformPoint(pInput[i]);
+				else if constexpr (normalize) pOutput[i] = TransformVector(pInput[i]).Normalized();
+				else pOutput[i] = TransformVector(pInput[i]);
+			}
+		}
+	};
+
+	inline void Matrix::TransformPoints(const Vector3* pPoints, Vector3* pTransformed, size_t count) const
+	{
+		AffineMatrix{ *this }.TransformPoints(pPoints, pTransformed, count);
+	}
+
+	inline void Matrix::TransformVectors(const Vector3* pVectors, Vector3* pTransformed, size_t count) const
+	{
+		AffineMatrix{ *this }.TransformVectors(pVectors, pTransformed, count);
+	}
+}
@@ -8,111 +8,573 @@
 #include "Renderer.h"
 #include "Maths.h"
 #include "Material.h"
-#include "Scene.h"
+#include "SceneView.h"
+#include "ThreadPool.h"
+#include "TileOrder.h"
 #include "Utils.h"
-#include <execution>
+#include <chrono>
+#include <numeric>
 
 using namespace dae;
 
+namespace dae
+{
+	struct WavefrontBuffers
+	{
+		//Camera rays tile by tile, the pixel of every ray and its closest hit
+		RayStream cameraRays{};
+		std::vector<uint32_t> pixelIndices{};
+		std::vector<HitRecord> hits{};
+
+		//Camera rays that hit something
+		std::vector<uint32_t> hitRays{};
+
+		//One slot per hit and light, hit after hit: the light the hit gets when the shadow ray is not blocked
+		std::vector<ColorRGB> lightContributions{};
+		RayStream shadowRays{};
+		std::vector<uint8_t> isLit{};
+		std::vector<uint8_t> isOccluded{};
+		//Slots that need their shadow ray traced
+		std::vector<uint32_t> shadowSlots{};
+
+		//Final color of every pixel, in framebuffer order
+		std::vector<ColorRGB> colors{};
+	};
+
+	//Tiles of the megakernel, in the order the workers take them, and the state of the tile size autotuner
+	struct TileSchedule
+	{
+		//Tile sides the autotuner tries, multiples of every packet size
+		static constexpr uint32_t Candidates[]{ 8, 16, 32, 64 };
+		static constexpr uint32_t CandidateCount{ sizeof(Candidates) / sizeof(Candidates[0]) };
+		//Frames rendered per candidate, the fastest one counts so a hiccup does not rule a size out
+		static constexpr uint32_t FramesPerCandidate{ 3 };
+
+		uint32_t tileSize{ 16 };
+		TileOrder order{ TileOrder::Hilbert };
+		uint32_t tilesX{};
+		//Row by row index of the tile of every task
+		std::vector<uint32_t> tileIndices{};
+
+		bool isTuning{};
+		uint32_t candidateIndex{};
+		uint32_t frameIndex{};
+		double fastestMilliseconds[CandidateCount]{};
+	};
+}
+
+namespace
+{
+	//Side of the pixel tiles the camera rays are generated in, a full tile fills one ray packet
+	constexpr uint32_t WavefrontTileSize{ 8 };
+
+	//Calls function(first, end) for the consecutive batches of batchSize out of count items
+	template<typename Function>
+	void ForEachBatch(ThreadPool& threadPool, uint32_t count, uint32_t batchSize, Function&& function)
+	{
+		const uint32_t batchCount{ (count + batchSize - 1) / batchSize };
+		threadPool.Run(batchCount, [&](uint32_t batchIndex, uint32_t)
+			{
+				const uint32_t first{ batchIndex * batchSize };
+				function(first, std::min(first + batchSize, count));
+			});
+	}
+
+	//What reaches a hit from one light if nothing blocks it, and the shadow ray checking that
+	struct LightSample
+	{
+		ColorRGB radiance{};
+		float cosine{};
+		Ray shadowRay{};
+
+		//Light reflected towards the camera by a material with this BRDF
+		ColorRGB Reflect(const ColorRGB& brdf) const
+		{
+			return brdf * radiance * cosine;
+		}
+	};
+
+	//Returns false when the light is behind the surface
+	bool SampleLight(const HitRecord& hit, const Light& light, const Vector3& cameraOrigin, MaterialSample& materialSample, LightSample& lightSample)
+	{
+		const Vector3 LIGHT_DIRECTION = LightUtils::GetDirectionToLight(light, hit.origin);
+		const float ANGLE_BETWEEN = Vector3::Dot(hit.normal, LIGHT_DIRECTION.Normalized());
+
+		if (ANGLE_BETWEEN > 0.0f) {
+			Vector3 HIT_TO_CAMERA_DIRECTION = (hit.origin, cameraOrigin).Normalized();
+
+			materialSample = MaterialSample{ hit.normal, LIGHT_DIRECTION.Normalized(), HIT_TO_CAMERA_DIRECTION };
+			lightSample.radiance = LightUtils::GetRadiance(light, hit.origin);
+			lightSample.cosine = std::max(0.0f, ANGLE_BETWEEN);
+			lightSample.shadowRay = Ray{ hit.origin, LIGHT_DIRECTION.Normalized(), 0.0001f, LIGHT_DIRECTION.Magnitude() };
+			return true;
+		}
+		return false;
+	}
+
+	//Evaluates the BRDFs of count samples, with one material dispatch per run of consecutive samples sharing their material
+	void ShadeSamples(const MaterialTable& materials, const unsigned char* pMaterialIndices, const MaterialSample* pSamples, uint32_t count, ColorRGB* pBRDFs)
+	{
+		for (uint32_t runStart{ 0 }, runEnd{ 0 }; runStart < count; runStart = runEnd)
+		{
+			while (runEnd < count && pMaterialIndices[runEnd] == pMaterialIndices[runStart]) ++runEnd;
+			materials.Shade(pMaterialIndices[runStart], &pSamples[runStart], runEnd - runStart, &pBRDFs[runStart]);
+		}
+	}
+
+	/**
+	 * \brief Colors of count hits, at most MaxHits, shaded light after light: the hits a light reaches are shaded as one batch, then their shadow rays are traced
+	 * \param pOccluderCache optional, shadow rays skip the cache without it
+	 */
+	template<uint32_t MaxHits>
+	void ShadeHits(const SceneView& view, const HitRecord* pHits, uint32_t count, OccluderCache* pOccluderCache, ColorRGB* pColors)
+	{
+		const MaterialTable& materials = *view.pMaterials;
+		const std::span<const Light> lights = view.lights;
+
+		std::fill(pColors, pColors + count, ColorRGB{});
+
+		MaterialSample materialSamples[MaxHits];
+		LightSample lightSamples[MaxHits];
+		unsigned char materialIndices[MaxHits];
+		uint32_t sampleHits[MaxHits];
+		ColorRGB brdfs[MaxHits];
+
+		for (uint32_t lightIndex{ 0 }; lightIndex < lights.size(); ++lightIndex)
+		{
+			uint32_t sampleCount{ 0 };
+			for (uint32_t hitIndex{ 0 }; hitIndex < count; ++hitIndex)
+			{
+				const HitRecord& hit = pHits[hitIndex];
+				if (!hit.didHit || !SampleLight(hit, lights[lightIndex], view.cameraOrigin, materialSamples[sampleCount], lightSamples[sampleCount])) continue;
+
+				materialIndices[sampleCount] = hit.materialIndex;
+				sampleHits[sampleCount++] = hitIndex;
+			}
+
+			ShadeSamples(materials, materialIndices, materialSamples, sampleCount, brdfs);
+
+			for (uint32_t sample{ 0 }; sample < sampleCount; ++sample)
+			{
+				const Ray& shadowRay = lightSamples[sample].shadowRay;
+				const bool isOccluded{ pOccluderCache ? view.DoesHit(shadowRay, lightIndex, *pOccluderCache) : view.DoesHit(shadowRay) };
+				if (!isOccluded) pColors[sampleHits[sample]] += lightSamples[sample].Reflect(brdfs[sample]);
+			}
+		}
+	}
+}
+
 Renderer::Renderer(SDL_Window * pWindow) :
 	m_pWindow(pWindow),
-	m_pBuffer(SDL_GetWindowSurface(pWindow))
+	m_pBuffer(SDL_GetWindowSurface(pWindow)),
+	m_pWavefront(std::make_unique<WavefrontBuffers>()),
+	m_pTiles(std::make_unique<TileSchedule>())
 {
+#if defined(PARALLEL_EXECUTION)
+	m_pThreadPool = std::make_unique<ThreadPool>(ThreadPool::GetDefaultThreadCount());
+#else
+	m_pThreadPool = std::make_unique<ThreadPool>(1);
+#endif
+
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
+	m_AspectRatio = (float)m_Width / (float)m_Height;
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+
+	BuildTiles(m_pTiles->tileSize, m_pTiles->order);
+	AutotuneTileSize();
+
+	//The buffer is written as 32 bit pixels with 8 bit channels
+	const SDL_PixelFormat* pFormat = m_pBuffer->format;
+	m_PixelFormat = PixelFormat{ pFormat->Rshift, pFormat->Gshift, pFormat->Bshift, pFormat->Amask };
 }
 
-void Renderer::Render(Scene* pScene) const
-{
-	Camera& camera = pScene->GetCamera();
-	auto& materials = pScene->GetMaterials();
-	auto& lights = pScene->GetLights();
+Renderer::~Renderer() = default;
 
-	const float ASPECT_RATIO{ (float)m_Width / (float)m_Height };
+void Renderer::Render(const SceneView& view)
+{
+	if (m_RenderMode == RenderMode::Wavefront)
+	{
+		RenderWavefront(view);
 
-	const float FOV = tan(camera.fovAngle * (PI / 180.f) / 2.f);
-	const Matrix cameraToWorld = camera.CalculateCameraToWorld();
+		SDL_UpdateWindowSurface(m_pWindow);
+		return;
+	}
 
-#if defined(PARALLEL_EXECUTION)
-	uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
-	std::vector<uint32_t> pixelIndices{};
+	TileSchedule& tiles = *m_pTiles;
+	const uint32_t tileSize{ tiles.isTuning ? TileSchedule::Candidates[tiles.candidateIndex] : tiles.tileSize };
+	if (tileSize != tiles.tileSize) BuildTiles(tileSize, tiles.order);
 
-	pixelIndices.reserve(amountOfPixels);
-	for (uint32_t index{}; index < amountOfPixels; ++index) pixelIndices.emplace_back(index);
-	
-	std::for_each(std::execution::par, pixelIndices.begin(), pixelIndices.end(), [&](int i)
+	//Every thread starts on a stretch of the curve, so its tiles and the ones it steals lie close together
+	const auto start = std::chrono::steady_clock::now();
+	m_pThreadPool->Run(static_cast<uint32_t>(tiles.tileIndices.size()), [&](uint32_t taskIndex, uint32_t)
 		{
-			RenderPixel(pScene, i, FOV, ASPECT_RATIO, cameraToWorld, camera.origin);
-	});
-#else
-	uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
+			RenderTile(view, tiles.tileIndices[taskIndex]);
+		});
 
-	for (uint32_t pixelIndex{}; pixelIndex < amountOfPixels; ++pixelIndex)
+	if (tiles.isTuning)
 	{
-		RenderPixel(pScene, pixelIndex, FOV, ASPECT_RATIO, cameraToWorld, camera.origin);
+		const std::chrono::duration<double, std::milli> renderTime{ std::chrono::steady_clock::now() - start };
+		UpdateTileSizeTuning(renderTime.count());
 	}
-#endif
 
 	//@END
 	//Update SDL Surface
 	SDL_UpdateWindowSurface(m_pWindow);
 }
 
-void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const
+void Renderer::RenderPixel(const SceneView& view, uint32_t pixelIndex) const
 {
-	auto materials{ pScene->GetMaterials() };
 	const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
-	float rx{ px + 0.5f }, ry{ py + 0.5f };
-	float cx{ (2 * (rx / float(m_Width)) - 1) * aspectRatio * fov };
-	float cy{ (1 - (2 * (ry / float(m_Height)))) * fov };
 
-	const float rayDx{ (2.f * (px + 0.5f) / m_Width - 1.f) * aspectRatio * fov };
-	const float rayDy{ (1.f - 2.f * (py + 0.5f) / m_Height) * fov };
+	Ray viewRay{ view.cameraOrigin, CalculateRayDirection(px, py, view) };
+	HitRecord closestHit{};
+
+	view.GetClosestHit(viewRay, closestHit);
+
+	ColorRGB color{};
+	ShadeHits<1>(view, &closestHit, 1, nullptr, &color);
+	WritePixels(pixelIndex, &color, 1);
+}
+
+void Renderer::RenderTile(const SceneView& view, uint32_t tileIndex) const
+{
+	const uint32_t tileSize{ m_pTiles->tileSize };
+	const uint32_t firstX{ tileIndex % m_pTiles->tilesX * tileSize }, firstY{ tileIndex / m_pTiles->tilesX * tileSize };
+	const uint32_t endX{ std::min(firstX + tileSize, uint32_t(m_Width)) }, endY{ std::min(firstY + tileSize, uint32_t(m_Height)) };
+
+	if (m_PacketSize == 1)
+	{
+		for (uint32_t py{ firstY }; py < endY; ++py)
+		{
+			for (uint32_t px{ firstX }; px < endX; ++px)
+			{
+				RenderPixel(view, px + py * m_Width);
+			}
+		}
+		return;
+	}
+
+	for (uint32_t py{ firstY }; py < endY; py += m_PacketSize)
+	{
+		for (uint32_t px{ firstX }; px < endX; px += m_PacketSize)
+		{
+			RenderPacket(view, px, py);
+		}
+	}
+}
+
+void Renderer::RenderPacket(const SceneView& view, uint32_t firstX, uint32_t firstY) const
+{
+	const uint32_t endX{ std::min(firstX + m_PacketSize, uint32_t(m_Width)) }, endY{ std::min(firstY + m_PacketSize, uint32_t(m_Height)) };
+
+	//Blocks at the right and bottom edge are cut off, so they make smaller packets
+	RayPacket packet{};
+	for (uint32_t py{ firstY }; py < endY; ++py)
+	{
+		for (uint32_t px{ firstX }; px < endX; ++px)
+		{
+			packet.SetRay(packet.size++, Ray{ view.cameraOrigin, CalculateRayDirection(px, py, view) });
+		}
+	}
+
+	HitRecord closestHits[RayPacket::MaxSize]{};
+	view.GetClosestHits(packet, closestHits);
+
+	//The shadow rays of neighbouring pixels mostly share their occluders, a block runs on one worker so it gets its own cache
+	OccluderCache occluderCache{};
+	ColorRGB colors[RayPacket::MaxSize];
+	ShadeHits<RayPacket::MaxSize>(view, closestHits, packet.size, &occluderCache, colors);
+	AddOccluderCacheStats(occluderCache.stats);
+
+	const uint32_t rowLength{ endX - firstX };
+	for (uint32_t py{ firstY }; py < endY; ++py)
+	{
+		WritePixels(firstX + py * m_Width, &colors[(py - firstY) * rowLength], rowLength);
+	}
+}
+
+bool Renderer::SetPacketSize(uint32_t packetSize)
+{
+	if (packetSize != 1 && packetSize != 2 && packetSize != 4 && packetSize != 8) return false;
+
+	m_PacketSize = packetSize;
+	return true;
+}
+
+bool Renderer::SetThreadCount(uint32_t threadCount)
+{
+	if (threadCount == 0) return false;
+
+	if (threadCount != m_pThreadPool->GetThreadCount())
+	{
+		m_pThreadPool = std::make_unique<ThreadPool>(threadCount);
+		//The fastest tile size depends on how many threads share the tiles
+		if (m_pTiles->isTuning || m_IsTileSizeAutotuned) AutotuneTileSize();
+	}
+	return true;
+}
+
+uint32_t Renderer::GetThreadCount() const
+{
+	return m_pThreadPool->GetThreadCount();
+}
+
+void Renderer::ResetThreadStats()
+{
+	m_pThreadPool->ResetStats();
+}
+
+bool Renderer::SetTileSize(uint32_t tileSize)
+{
+	if (tileSize == 0 || tileSize % 8 != 0) return false;
+
+	m_pTiles->isTuning = false;
+	m_IsTileSizeAutotuned = false;
+	BuildTiles(tileSize, m_pTiles->order);
+	return true;
+}
+
+uint32_t Renderer::GetTileSize() const
+{
+	return m_pTiles->tileSize;
+}
+
+void Renderer::SetTileOrder(TileOrder tileOrder)
+{
+	BuildTiles(m_pTiles->tileSize, tileOrder);
+}
+
+TileOrder Renderer::GetTileOrder() const
+{
+	return m_pTiles->order;
+}
+
+void Renderer::AutotuneTileSize()
+{
+	TileSchedule& tiles = *m_pTiles;
+	tiles.isTuning = true;
+	tiles.candidateIndex = 0;
+	tiles.frameIndex = 0;
+	m_IsTileSizeAutotuned = true;
+}
+
+bool Renderer::IsTuningTileSize() const
+{
+	return m_pTiles->isTuning;
+}
+
+void Renderer::BuildTiles(uint32_t tileSize, TileOrder tileOrder)
+{
+	TileSchedule& tiles = *m_pTiles;
+	tiles.tileSize = tileSize;
+	tiles.order = tileOrder;
+	tiles.tilesX = (m_Width + tileSize - 1) / tileSize;
+
+	const uint32_t tilesY{ (m_Height + tileSize - 1) / tileSize };
+	TileOrdering::Build(tileOrder, tiles.tilesX, tilesY, tiles.tileIndices);
+}
+
+void Renderer::UpdateTileSizeTuning(double renderMilliseconds)
+{
+	TileSchedule& tiles = *m_pTiles;
+
+	double& fastestMilliseconds = tiles.fastestMilliseconds[tiles.candidateIndex];
+	if (tiles.frameIndex == 0 || renderMilliseconds < fastestMilliseconds) fastestMilliseconds = renderMilliseconds;
+
+	if (++tiles.frameIndex < TileSchedule::FramesPerCandidate) return;
+	tiles.frameIndex = 0;
+	if (++tiles.candidateIndex < TileSchedule::CandidateCount) return;
+
+	//Every candidate is measured, lock in the fastest one
+	const double* pFastest = std::min_element(tiles.fastestMilliseconds, tiles.fastestMilliseconds + TileSchedule::CandidateCount);
+	tiles.isTuning = false;
+	BuildTiles(TileSchedule::Candidates[pFastest - tiles.fastestMilliseconds], tiles.order);
+}
+
+Vector3 Renderer::CalculateRayDirection(uint32_t px, uint32_t py, const SceneView& view) const
+{
+	const float rayDx{ (2.f * (px + 0.5f) / m_Width - 1.f) * m_AspectRatio * view.fov };
+	const float rayDy{ (1.f - 2.f * (py + 0.5f) / m_Height) * view.fov };
 	Vector3 rayDirection{ rayDx, rayDy, 1.f };
 
 	rayDirection.Normalize();
-	rayDirection = cameraToWorld.TransformVector(rayDirection);
+	return view.cameraToWorld.TransformVector(rayDirection);
+}
 
-	Ray viewRay{ cameraOrigin, rayDirection };
-	ColorRGB finalColor{};
-	HitRecord closestHit{};
+void Renderer::AddOccluderCacheStats(const OccluderCacheStats& stats) const
+{
+	m_ShadowRays += stats.shadowRays;
+	m_OccluderLookups += stats.lookups;
+	m_OccluderHits += stats.hits;
+}
 
-	pScene->GetClosestHit(viewRay, closestHit);
+OccluderCacheStats Renderer::GetOccluderCacheStats() const
+{
+	return OccluderCacheStats{ m_ShadowRays, m_OccluderLookups, m_OccluderHits };
+}
 
-	const auto& LIGHTS{ pScene->GetLights() };
+void Renderer::ResetOccluderCacheStats()
+{
+	m_ShadowRays = 0;
+	m_OccluderLookups = 0;
+	m_OccluderHits = 0;
+}
 
-	if (closestHit.didHit)
+void Renderer::WritePixels(uint32_t firstPixelIndex, const ColorRGB* pColors, uint32_t count) const
+{
+	CpuDispatch::GetKernels().packPixels(pColors, count, m_PixelFormat, m_pBufferPixels + firstPixelIndex);
+}
+
+void Renderer::RenderWavefront(const SceneView& view)
+{
+	WavefrontBuffers& buffers = *m_pWavefront;
+	const MaterialTable& materials = *view.pMaterials;
+	const std::span<const Light> lights = view.lights;
+	const uint32_t lightCount{ static_cast<uint32_t>(lights.size()) };
+	const uint32_t pixelCount{ uint32_t(m_Width * m_Height) };
+
+	//Generate: camera rays tile by tile, so neighbouring rays of the stream are coherent
+	buffers.cameraRays.Resize(pixelCount);
+	buffers.pixelIndices.resize(pixelCount);
+	buffers.hits.resize(pixelCount);
+	buffers.colors.resize(pixelCount);
+
+	const uint32_t tilesX{ (m_Width + WavefrontTileSize - 1) / WavefrontTileSize };
+	const uint32_t tilesY{ (m_Height + WavefrontTileSize - 1) / WavefrontTileSize };
+	ForEachBatch(*m_pThreadPool, tilesX * tilesY, 1, [&](uint32_t tileIndex, uint32_t)
+		{
+			const uint32_t firstX{ tileIndex % tilesX * WavefrontTileSize }, firstY{ tileIndex / tilesX * WavefrontTileSize };
+			const uint32_t endX{ std::min(firstX + WavefrontTileSize, uint32_t(m_Width)) }, endY{ std::min(firstY + WavefrontTileSize, uint32_t(m_Height)) };
+
+			//All tiles of a row have the same height, only the last one can be narrower
+			uint32_t rayIndex{ firstY * m_Width + firstX * (endY - firstY) };
+			for (uint32_t py{ firstY }; py < endY; ++py)
+			{
+				for (uint32_t px{ firstX }; px < endX; ++px)
+				{
+					buffers.cameraRays.SetRay(rayIndex, Ray{ view.cameraOrigin, CalculateRayDirection(px, py, view) });
+					buffers.pixelIndices[rayIndex] = px + py * m_Width;
+					buffers.hits[rayIndex] = HitRecord{};
+					++rayIndex;
+				}
+			}
+		});
+
+	//Intersect: packet sized batches of the stream, a full tile each away from the right edge
+	ForEachBatch(*m_pThreadPool, pixelCount, RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
+		{
+			RayPacket packet{};
+			for (uint32_t i{ first }; i < end; ++i)
+			{
+				packet.SetRay(packet.size++, buffers.cameraRays.GetRay(i));
+			}
+			view.GetClosestHits(packet, &buffers.hits[first]);
+		});
+
+	//Compact: only the rays that hit something are shaded, sorted by material so a shading batch mostly evaluates one of them
+	uint32_t materialOffsets[MaterialTable::MaxSize + 1]{};
+	for (uint32_t i{ 0 }; i < pixelCount; ++i)
+	{
+		if (buffers.hits[i].didHit) ++materialOffsets[buffers.hits[i].materialIndex + 1];
+	}
+	std::partial_sum(std::begin(materialOffsets), std::end(materialOffsets), std::begin(materialOffsets));
+
+	const uint32_t hitCount{ materialOffsets[MaterialTable::MaxSize] };
+	buffers.hitRays.resize(hitCount);
+	for (uint32_t i{ 0 }; i < pixelCount; ++i)
 	{
-		for (int i{ 0 }; i < LIGHTS.size(); ++i)
+		if (buffers.hits[i].didHit) buffers.hitRays[materialOffsets[buffers.hits[i].materialIndex]++] = i;
+	}
+
+	//Shade: the light every hit gets from every light if nothing blocks it, and the shadow ray to check that
+	const uint32_t slotCount{ hitCount * lightCount };
+	buffers.lightContributions.resize(slotCount);
+	buffers.shadowRays.Resize(slotCount);
+	buffers.isLit.resize(slotCount);
+	buffers.isOccluded.resize(slotCount);
+
+	ForEachBatch(*m_pThreadPool, hitCount, RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
 		{
-			const Light CURRENT_LIGHT{ LIGHTS[i] };
-			const Vector3 LIGHT_DIRECTION = LightUtils::GetDirectionToLight(CURRENT_LIGHT, closestHit.origin);
-			float length = LIGHT_DIRECTION.Magnitude();
-			Ray shadowRay{ closestHit.origin, LIGHT_DIRECTION.Normalized(), 0.0001f, length };
+			MaterialSample materialSamples[RayPacket::MaxSize];
+			LightSample lightSamples[RayPacket::MaxSize];
+			unsigned char materialIndices[RayPacket::MaxSize];
+			uint32_t sampleHits[RayPacket::MaxSize];
+			ColorRGB brdfs[RayPacket::MaxSize];
+
+			for (uint32_t lightIndex{ 0 }; lightIndex < lightCount; ++lightIndex)
+			{
+				uint32_t sampleCount{ 0 };
+				for (uint32_t hitIndex{ first }; hitIndex < end; ++hitIndex)
+				{
+					const HitRecord& hit = buffers.hits[buffers.hitRays[hitIndex]];
+					const uint32_t slot{ hitIndex * lightCount + lightIndex };
 
-			if (!pScene->DoesHit(shadowRay)) {
-				const float ANGLE_BETWEEN = Vector3::Dot(closestHit.normal, LIGHT_DIRECTION.Normalized());
+					buffers.isLit[slot] = SampleLight(hit, lights[lightIndex], view.cameraOrigin, materialSamples[sampleCount], lightSamples[sampleCount]);
+					if (!buffers.isLit[slot]) continue;
 
-				if (ANGLE_BETWEEN > 0.0f) {
-					Vector3 HIT_TO_CAMERA_DIRECTION = (closestHit.origin, cameraOrigin).Normalized();
+					materialIndices[sampleCount] = hit.materialIndex;
+					sampleHits[sampleCount++] = hitIndex;
+				}
 
-					const ColorRGB LIGHT_RADIANCE = LightUtils::GetRadiance(CURRENT_LIGHT, closestHit.origin);
-					const ColorRGB BRDF = materials[closestHit.materialIndex]->Shade(closestHit, LIGHT_DIRECTION.Normalized(), HIT_TO_CAMERA_DIRECTION);
+				ShadeSamples(materials, materialIndices, materialSamples, sampleCount, brdfs);
 
-					finalColor += BRDF * LIGHT_RADIANCE * std::max(0.0f, ANGLE_BETWEEN);
+				for (uint32_t sample{ 0 }; sample < sampleCount; ++sample)
+				{
+					const uint32_t slot{ sampleHits[sample] * lightCount + lightIndex };
+					buffers.lightContributions[slot] = lightSamples[sample].Reflect(brdfs[sample]);
+					buffers.shadowRays.SetRay(slot, lightSamples[sample].shadowRay);
 				}
 			}
-		}
+		});
+
+	//Emit: lights behind their surface need no shadow ray
+	buffers.shadowSlots.clear();
+	for (uint32_t slot{ 0 }; slot < slotCount; ++slot)
+	{
+		if (buffers.isLit[slot]) buffers.shadowSlots.push_back(slot);
 	}
 
-	//Update Color in Buffer
-	finalColor.MaxToOne();
+	//Trace the shadow stream
+	ForEachBatch(*m_pThreadPool, static_cast<uint32_t>(buffers.shadowSlots.size()), RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
+		{
+			//Slots are ordered hit by hit, so consecutive shadow rays alternate between the lights
+			OccluderCache occluderCache{};
+			for (uint32_t i{ first }; i < end; ++i)
+			{
+				const uint32_t slot{ buffers.shadowSlots[i] };
+				buffers.isOccluded[slot] = view.DoesHit(buffers.shadowRays.GetRay(slot), slot % lightCount, occluderCache);
+			}
+			AddOccluderCacheStats(occluderCache.stats);
+		});
+
+	//Resolve: the unblocked light of every hit summed in light order, misses stay black
+	ForEachBatch(*m_pThreadPool, pixelCount, RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
+		{
+			for (uint32_t i{ first }; i < end; ++i)
+			{
+				if (!buffers.hits[i].didHit) buffers.colors[buffers.pixelIndices[i]] = ColorRGB{};
+			}
+		});
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));
+	ForEachBatch(*m_pThreadPool, hitCount, RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
+		{
+			for (uint32_t hitIndex{ first }; hitIndex < end; ++hitIndex)
+			{
+				ColorRGB finalColor{};
+				for (uint32_t slot{ hitIndex * lightCount }; slot < (hitIndex + 1) * lightCount; ++slot)
+				{
+					if (buffers.isLit[slot] && !buffers.isOccluded[slot]) finalColor += buffers.lightContributions[slot];
+				}
+				buffers.colors[buffers.pixelIndices[buffers.hitRays[hitIndex]]] = finalColor;
+			}
+		});
+
+	//Pack the framebuffer
+	ForEachBatch(*m_pThreadPool, pixelCount, RayPacket::MaxSize, [&](uint32_t first, uint32_t end)
+		{
+			WritePixels(first, &buffers.colors[first], end - first);
+		});
 }
 
 bool Renderer::SaveBufferToImage() const
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include "CpuDispatch.h"
 #include "Matrix.h"
+#include "TileOrder.h"
 #include "Vector3.h"
 
 struct SDL_Window;
@@ -9,32 +13,121 @@ struct SDL_Surface;
 
 namespace dae
 {
-	class Scene;
+	struct SceneView;
+	class ThreadPool;
+	struct ColorRGB;
+	struct HitRecord;
+	struct WavefrontBuffers;
+	struct TileSchedule;
+	struct OccluderCache;
+	struct OccluderCacheStats;
+
+	enum class RenderMode
+	{
+		//Every pixel, or block of pixels with ray packets, is traced and shaded start to finish in one go
+		Megakernel,
+		//Every stage runs over the rays of the whole frame before the next one starts
+		Wavefront
+	};
 
 	class Renderer final
 	{
 	public:
 		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
+		//The view is shared by const reference between the workers, build it with Scene::CreateView once the scene is updated
+		void Render(const SceneView& view);
+
+		void RenderPixel(const SceneView& view, uint32_t pixelIndex) const;
+		//Traces the primary rays of the square block of packet size x packet size pixels starting at firstX, firstY as one packet
+		void RenderPacket(const SceneView& view, uint32_t firstX, uint32_t firstY) const;
+		//Renders one of the square tiles the frame is split in for the workers, tiles are numbered row by row whatever order they are taken in
+		void RenderTile(const SceneView& view, uint32_t tileIndex) const;
+
+		//Side of the pixel blocks traced as one ray packet: 2, 4 or 8, or 1 to trace every pixel on its own
+		bool SetPacketSize(uint32_t packetSize);
+		uint32_t GetPacketSize() const { return m_PacketSize; }
+
+		//Threads rendering the frame, the one calling Render included
+		bool SetThreadCount(uint32_t threadCount);
+		uint32_t GetThreadCount() const;
+		//Per thread tasks, steals and busy time since the last reset, to see how evenly the tiles are spread
+		const ThreadPool& GetThreadPool() const { return *m_pThreadPool; }
+		//Also runs the scene updates between frames, SetThreadCount replaces it so scenes have to be given the new one
+		ThreadPool& GetThreadPool() { return *m_pThreadPool; }
+		void ResetThreadStats();
+
+		//Side of the megakernel tiles in pixels, a multiple of 8 so tiles hold whole packets. Setting it stops the autotuner
+		bool SetTileSize(uint32_t tileSize);
+		uint32_t GetTileSize() const;
+		void SetTileOrder(TileOrder tileOrder);
+		TileOrder GetTileOrder() const;
+
+		/**
+		 * \brief Renders the next frames with every candidate tile size and then locks in the fastest one.
+		 * Runs from the start and again when the thread count changes, call it when the scene changes
+		 */
+		void AutotuneTileSize();
+		bool IsTuningTileSize() const;
 
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float fov, float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const;
+		/**
+		 * \brief Renders the frame as a pipeline of data-parallel stages over SoA ray streams: generate the camera rays,
+		 * intersect them in packet sized batches, compact the hits, shade them and emit their shadow rays,
+		 * trace the shadow stream and resolve the pixels
+		 */
+		void RenderWavefront(const SceneView& view);
+
+		void SetRenderMode(RenderMode renderMode) { m_RenderMode = renderMode; }
+		RenderMode GetRenderMode() const { return m_RenderMode; }
+
+		//Shadow rays traced with an occluder cache since the last reset: per packet block, or per batch of the wavefront shadow stage
+		OccluderCacheStats GetOccluderCacheStats() const;
+		void ResetOccluderCacheStats();
 
 		bool SaveBufferToImage() const;
 
 	private:
+		Vector3 CalculateRayDirection(uint32_t px, uint32_t py, const SceneView& view) const;
+		//Packs count colors into the consecutive pixels from firstPixelIndex on
+		void WritePixels(uint32_t firstPixelIndex, const ColorRGB* pColors, uint32_t count) const;
+		void AddOccluderCacheStats(const OccluderCacheStats& stats) const;
+		void BuildTiles(uint32_t tileSize, TileOrder tileOrder);
+		//Records the render time of a frame with the candidate tile size being tuned and moves on to the next candidate
+		void UpdateTileSizeTuning(double renderMilliseconds);
+
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pBuffer{};
 		uint32_t* m_pBufferPixels{};
+		PixelFormat m_PixelFormat{};
 
 		int m_Width{};
 		int m_Height{};
+		float m_AspectRatio{};
+
+		uint32_t m_PacketSize{ 8 };
+
+		RenderMode m_RenderMode{ RenderMode::Megakernel };
+		//Streams of the wavefront stages, kept between frames so they only grow
+		std::unique_ptr<WavefrontBuffers> m_pWavefront;
+
+		//Workers stay alive between frames, the megakernel tiles and the wavefront batches are spread over them
+		std::unique_ptr<ThreadPool> m_pThreadPool;
+
+		//Tile order and size of the megakernel, changed by the autotuner while rendering
+		std::unique_ptr<TileSchedule> m_pTiles;
+		//The tile size was picked by the autotuner rather than set, so it is tuned again for a new thread count
+		bool m_IsTileSizeAutotuned{};
+
+		//Summed over the caches of all workers as they finish
+		mutable std::atomic<uint64_t> m_ShadowRays{};
+		mutable std::atomic<uint64_t> m_OccluderLookups{};
+		mutable std::atomic<uint64_t> m_OccluderHits{};
 	};
 }
@@ -1,87 +1,285 @@
 #include "Scene.h"
 #include "Utils.h"
-#include "Material.h"
+#include "Snapshot.h"
+#include "CpuDispatch.h"
 
 namespace dae {
 
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
-	Scene::Scene() :
-		m_Materials({ new Material_SolidColor({1,0,0}) })
+	Scene::Scene()
 	{
+		m_Materials.Add(MaterialDesc::SolidColor({ 1,0,0 }));
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
+		m_SharedTriangleMeshes.reserve(32);
+		m_TriangleMeshInstances.reserve(256);
 		m_Lights.reserve(32);
 	}
 
-	Scene::~Scene()
+	Scene::~Scene() = default;
+
+	void Scene::Clear()
+	{
+		m_Camera.Clear();
+
+		m_Materials.Clear();
+
+		m_SphereGeometries.clear();
+		m_PlaneGeometries.clear();
+		m_TriangleMeshGeometries.clear();
+		m_SharedTriangleMeshes.clear();
+		m_TriangleMeshInstances.clear();
+		m_Lights.clear();
+
+		m_TopLevelBVH.Clear();
+		m_TopLevelGrid.Clear();
+		m_TopLevelPrimitives.clear();
+		m_TopLevelBounds.clear();
+	}
+
+	void Scene::UpdateAccelerationStructure()
 	{
-		for (auto& pMaterial : m_Materials)
+		m_TopLevelPrimitives.clear();
+		m_TopLevelBounds.clear();
+
+		for (uint32_t i{ 0 }; i < m_SphereGeometries.size(); ++i)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			const Sphere& sphere = m_SphereGeometries[i];
+			const Vector3 radius{ sphere.radius, sphere.radius, sphere.radius };
+
+			m_TopLevelPrimitives.push_back({ PrimitiveType::Sphere, i });
+			m_TopLevelBounds.push_back({ sphere.origin - radius, sphere.origin + radius });
 		}
 
-		m_Materials.clear();
+		for (uint32_t i{ 0 }; i < m_TriangleMeshGeometries.size(); ++i)
+		{
+			const TriangleMesh& mesh = m_TriangleMeshGeometries[i];
+
+			m_TopLevelPrimitives.push_back({ PrimitiveType::TriangleMesh, i });
+			m_TopLevelBounds.push_back({ mesh.transformedMinAABB, mesh.transformedMaxAABB });
+		}
+
+		for (uint32_t i{ 0 }; i < m_TriangleMeshInstances.size(); ++i)
+		{
+			const TriangleMeshInstance& instance = m_TriangleMeshInstances[i];
+
+			m_TopLevelPrimitives.push_back({ PrimitiveType::TriangleMeshInstance, i });
+			m_TopLevelBounds.push_back(instance.GetTransformedAABB(m_SharedTriangleMeshes[instance.meshIndex]));
+		}
+
+		if (m_AccelerationStructure == AccelerationStructure::TwoLevelGrid)
+			m_TopLevelGrid.Build(m_TopLevelBounds);
+		else
+			m_TopLevelBVH.Update(m_TopLevelBounds, m_TopLevelRebuildThreshold);
 	}
 
-	void Scene::Clear()
+	void Scene::SetAccelerationStructure(AccelerationStructure accelerationStructure)
 	{
-		m_Camera.Clear();
+		m_AccelerationStructure = accelerationStructure;
+		m_TopLevelBVH.Clear();
+		m_TopLevelGrid.Clear();
+	}
 
-		for (auto& pMaterial : m_Materials)
+	SceneView Scene::CreateView()
+	{
+		SceneView view{};
+		view.cameraOrigin = m_Camera.origin;
+		view.cameraToWorld = m_Camera.CalculateCameraToWorld();
+		view.fov = tan(m_Camera.fovAngle * (PI / 180.f) / 2.f);
+
+		view.planes = m_PlaneGeometries;
+		view.spheres = m_SphereGeometries;
+		view.triangleMeshes = m_TriangleMeshGeometries;
+		view.sharedTriangleMeshes = m_SharedTriangleMeshes;
+		view.triangleMeshInstances = m_TriangleMeshInstances;
+		view.lights = m_Lights;
+		view.pMaterials = &m_Materials;
+
+		view.accelerationStructure = m_AccelerationStructure;
+		view.pTopLevelBVH = &m_TopLevelBVH;
+		view.pTopLevelGrid = &m_TopLevelGrid;
+		view.topLevelPrimitives = m_TopLevelPrimitives;
+
+		view.pKernels = &CpuDispatch::GetKernels();
+		return view;
+	}
+
+	void Scene::SetThreadPool(ThreadPool* pThreadPool)
+	{
+		m_pThreadPool = pThreadPool;
+		m_TopLevelBVH.pThreadPool = pThreadPool;
+
+		for (TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			delete pMaterial;
+			mesh.pThreadPool = pThreadPool;
 		}
-		m_Materials.clear();
+		for (TriangleMesh& mesh : m_SharedTriangleMeshes)
+		{
+			mesh.pThreadPool = pThreadPool;
+		}
+	}
 
-		m_SphereGeometries.clear();
-		m_PlaneGeometries.clear();
-		m_TriangleMeshGeometries.clear();
-		m_Lights.clear();
+#pragma region Scene Snapshots
+	bool Scene::SaveSnapshot(const std::string& path) const
+	{
+		SnapshotWriter writer{};
+		writer.Write(Snapshot::Magic);
+		writer.Write(Snapshot::Version);
+		writer.WriteString(GetSnapshotKey());
+
+		writer.WriteString(sceneName);
+		Snapshot::WriteCamera(writer, m_Camera);
+
+		writer.WriteArray(m_PlaneGeometries);
+		writer.WriteArray(m_SphereGeometries);
+		writer.WriteArray(m_Lights);
+
+		writer.Write<uint64_t>(m_Materials.GetSize());
+		for (size_t i{ 0 }; i < m_Materials.GetSize(); ++i)
+		{
+			writer.Write(m_Materials.GetDesc(static_cast<unsigned char>(i)));
+		}
+
+		writer.Write<uint64_t>(m_TriangleMeshGeometries.size());
+		for (const TriangleMesh& mesh : m_TriangleMeshGeometries)
+		{
+			Snapshot::WriteTriangleMesh(writer, mesh);
+		}
+
+		writer.Write<uint64_t>(m_SharedTriangleMeshes.size());
+		for (const TriangleMesh& mesh : m_SharedTriangleMeshes)
+		{
+			Snapshot::WriteTriangleMesh(writer, mesh);
+		}
+
+		writer.Write<uint64_t>(m_TriangleMeshInstances.size());
+		for (const TriangleMeshInstance& instance : m_TriangleMeshInstances)
+		{
+			Snapshot::WriteTriangleMeshInstance(writer, instance);
+		}
+
+		Snapshot::WriteBVH(writer, m_TopLevelBVH);
+		writer.WriteArray(m_TopLevelPrimitives);
+		writer.WriteArray(m_TopLevelBounds);
+		writer.Write(m_TopLevelRebuildThreshold);
+		writer.Write(m_AccelerationStructure);
+		Snapshot::WriteGrid(writer, m_TopLevelGrid);
+
+		return writer.SaveToFile(path);
 	}
 
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	bool Scene::LoadSnapshot(const std::string& path)
 	{
-		HitRecord subHitRecord{};
+		const MappedFile file{ path };
+		if (!file.IsOpen())
+			return false;
+
+		SnapshotReader reader{ file.GetData(), file.GetSize() };
+		if (reader.Read<uint32_t>() != Snapshot::Magic || reader.Read<uint32_t>() != Snapshot::Version || reader.ReadString() != GetSnapshotKey())
+			return false;
+
+		Clear();
 
+		sceneName = reader.ReadString();
+		Snapshot::ReadCamera(reader, m_Camera);
 
-		for (int i{ 0 }; i < m_SphereGeometries.size(); ++i)
+		reader.ReadArray(m_PlaneGeometries);
+		reader.ReadArray(m_SphereGeometries);
+		reader.ReadArray(m_Lights);
+
+		const uint64_t materialCount{ reader.Read<uint64_t>() };
+		for (uint64_t i{ 0 }; i < materialCount && reader.IsValid(); ++i)
 		{
-			GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray, subHitRecord);
-			if (closestHit.t > subHitRecord.t) closestHit = subHitRecord;
+			if (!m_Materials.Add(reader.Read<MaterialDesc>()))
+				reader.Invalidate();
 		}
-		for (int i{ 0 }; i < m_PlaneGeometries.size(); ++i)
+
+		//Containers keep their capacity so pointers handed out by OnSnapshotLoaded stay stable like after Initialize
+		const uint64_t meshCount{ reader.Read<uint64_t>() };
+		for (uint64_t i{ 0 }; i < meshCount && reader.IsValid(); ++i)
 		{
-			GeometryUtils::HitTest_Plane(m_PlaneGeometries[i], ray, subHitRecord);
-			if (closestHit.t > subHitRecord.t) closestHit = subHitRecord;
+			Snapshot::ReadTriangleMesh(reader, m_TriangleMeshGeometries.emplace_back());
 		}
-		for (int i{ 0 }; i < m_TriangleMeshGeometries.size(); ++i)
+
+		const uint64_t sharedMeshCount{ reader.Read<uint64_t>() };
+		for (uint64_t i{ 0 }; i < sharedMeshCount && reader.IsValid(); ++i)
+		{
+			Snapshot::ReadTriangleMesh(reader, m_SharedTriangleMeshes.emplace_back());
+		}
+
+		const uint64_t instanceCount{ reader.Read<uint64_t>() };
+		for (uint64_t i{ 0 }; i < instanceCount && reader.IsValid(); ++i)
+		{
+			Snapshot::ReadTriangleMeshInstance(reader, m_TriangleMeshInstances.emplace_back());
+		}
+
+		Snapshot::ReadBVH(reader, m_TopLevelBVH);
+		reader.ReadArray(m_TopLevelPrimitives);
+		reader.ReadArray(m_TopLevelBounds);
+		m_TopLevelRebuildThreshold = reader.Read<float>();
+		m_AccelerationStructure = reader.ReadEnum(AccelerationStructure::TwoLevelGrid);
+		Snapshot::ReadGrid(reader, m_TopLevelGrid);
+
+		if (!reader.IsValid() || !HasValidIndices() || !OnSnapshotLoaded())
 		{
-			GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray, subHitRecord);
-			if (closestHit.t > subHitRecord.t) closestHit = subHitRecord;
+			Clear();
+			return false;
 		}
 
+		//The loaded meshes start out without one
+		SetThreadPool(m_pThreadPool);
+		return true;
 	}
 
-	bool Scene::DoesHit(const Ray& ray) const
+	bool Scene::HasValidIndices() const
 	{
-		for (int i{ 0 }; i < m_SphereGeometries.size(); ++i)
+		const size_t materialCount{ m_Materials.GetSize() };
+		for (const Plane& plane : m_PlaneGeometries)
+		{
+			if (plane.materialIndex >= materialCount) return false;
+		}
+		for (const Sphere& sphere : m_SphereGeometries)
 		{
-			if(GeometryUtils::HitTest_Sphere(m_SphereGeometries[i], ray)) return true;
+			if (sphere.materialIndex >= materialCount) return false;
 		}
-		for (int i{ 0 }; i < m_PlaneGeometries.size(); ++i)
+		for (const TriangleMesh& mesh : m_TriangleMeshGeometries)
 		{
-			if(GeometryUtils::HitTest_Plane(m_PlaneGeometries[i], ray)) return true;
+			if (mesh.materialIndex >= materialCount) return false;
 		}
-		for (int i{ 0 }; i < m_TriangleMeshGeometries.size(); ++i)
+		for (const TriangleMeshInstance& instance : m_TriangleMeshInstances)
 		{
-			if(GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[i], ray)) return true;
+			if (instance.materialIndex >= materialCount || instance.meshIndex >= m_SharedTriangleMeshes.size()) return false;
+		}
+		for (const Light& light : m_Lights)
+		{
+			if (light.type != LightType::Point && light.type != LightType::Directional) return false;
 		}
 
-		return false;
+		for (const PrimitiveReference& primitive : m_TopLevelPrimitives)
+		{
+			switch (primitive.type)
+			{
+			case PrimitiveType::Sphere:
+				if (primitive.index >= m_SphereGeometries.size()) return false;
+				break;
+			case PrimitiveType::TriangleMesh:
+				if (primitive.index >= m_TriangleMeshGeometries.size()) return false;
+				break;
+			case PrimitiveType::TriangleMeshInstance:
+				if (primitive.index >= m_TriangleMeshInstances.size()) return false;
+				break;
+			default:
+				return false;
+			}
+		}
+
+		//Both top-level structures index m_TopLevelPrimitives
+		const size_t primitiveCount{ m_TopLevelPrimitives.size() };
+		return m_TopLevelBounds.size() == primitiveCount && m_TopLevelBVH.primitiveCount <= primitiveCount && m_TopLevelGrid.primitiveCount <= primitiveCount;
 	}
+#pragma endregion
 
 #pragma region Scene Helpers
 	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
@@ -111,11 +309,33 @@ namespace dae {
 		TriangleMesh m{};
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
+		m.pThreadPool = m_pThreadPool;
 
 		m_TriangleMeshGeometries.emplace_back(m);
 		return &m_TriangleMeshGeometries.back();
 	}
 
+	TriangleMesh* Scene::AddSharedTriangleMesh(TriangleCullMode cullMode)
+	{
+		TriangleMesh m{};
+		m.cullMode = cullMode;
+		m.pThreadPool = m_pThreadPool;
+
+		m_SharedTriangleMeshes.emplace_back(m);
+		return &m_SharedTriangleMeshes.back();
+	}
+
+	TriangleMeshInstance* Scene::AddTriangleMeshInstance(const TriangleMesh* pSharedMesh, unsigned char materialIndex)
+	{
+		TriangleMeshInstance instance{};
+		instance.meshIndex = static_cast<uint32_t>(pSharedMesh - m_SharedTriangleMeshes.data());
+		instance.materialIndex = materialIndex;
+		instance.UpdateTransforms();
+
+		m_TriangleMeshInstances.emplace_back(instance);
+		return &m_TriangleMeshInstances.back();
+	}
+
 	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
 	{
 		Light l;
@@ -140,10 +360,10 @@ namespace dae {
 		return &m_Lights.back();
 	}
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	unsigned char Scene::AddMaterial(const MaterialDesc& desc)
 	{
-		m_Materials.push_back(pMaterial);
-		return static_cast<unsigned char>(m_Materials.size() - 1);
+		m_Materials.Add(desc);
+		return static_cast<unsigned char>(m_Materials.GetSize() - 1);
 	}
 #pragma endregion
 #pragma endregion
@@ -155,16 +375,16 @@ void Scene_W4_ReferenceScene::Initialize()
 	m_Camera.origin = { 0, 3, -9 };
 	m_Camera.fovAngle = 45.f;
 
-	const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, 1.f));
-	const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
-	const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
+	const auto matCT_GrayRoughMetal = AddMaterial(MaterialDesc::CookTorrence({ .972f, .960f, .915f }, 1.f, 1.f));
+	const auto matCT_GrayMediumMetal = AddMaterial(MaterialDesc::CookTorrence({ .972f, .960f, .915f }, 1.f, .6f));
+	const auto matCT_GraySmoothMetal = AddMaterial(MaterialDesc::CookTorrence({ .972f, .960f, .915f }, 1.f, .1f));
 
-	const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
-	const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
-	const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
+	const auto matCT_GrayRoughPlastic = AddMaterial(MaterialDesc::CookTorrence({ .75f, .75f, .75f }, 0.f, 1.f));
+	const auto matCT_GrayMediumPlastic = AddMaterial(MaterialDesc::CookTorrence({ .75f, .75f, .75f }, 0.f, .6f));
+	const auto matCT_GraySmoothPlastic = AddMaterial(MaterialDesc::CookTorrence({ .75f, .75f, .75f }, 0.f, .1f));
 
-	const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, .57f }, 1.f));
-	const auto matLambert_White = AddMaterial(new Material_Lambert({ 1.f, 1.f, 1.f }, 1.f));
+	const auto matLambert_GrayBlue = AddMaterial(MaterialDesc::Lambert({ .49f, .57f, .57f }, 1.f));
+	const auto matLambert_White = AddMaterial(MaterialDesc::Lambert({ 1.f, 1.f, 1.f }, 1.f));
 
 	AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue); // BACK
 	AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert_GrayBlue);   // BOTTOM
@@ -205,6 +425,23 @@ void Scene_W4_ReferenceScene::Initialize()
 	AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, { .34f, .47f, .68f });
 }
 
+bool Scene_W4_ReferenceScene::OnSnapshotLoaded()
+{
+	if (m_TriangleMeshGeometries.size() != std::size(m_Meshes))
+		return false;
+
+	for (size_t i{ 0 }; i < std::size(m_Meshes); ++i)
+	{
+		m_Meshes[i] = &m_TriangleMeshGeometries[i];
+	}
+	return true;
+}
+
+std::string Scene_W4_ReferenceScene::GetSnapshotKey() const
+{
+	return "Reference Scene 1";
+}
+
 void Scene_W4_ReferenceScene::Update(Timer* pTimer)
 {
 	Scene::Update(pTimer);
@@ -226,8 +463,8 @@ void Scene_W4_BunnyScene::Initialize()
 	m_Camera.fovAngle = 45.f;
 
 	//Materials
-	const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ .49f, .57f, 0.57f }, 1.f));
-	const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+	const auto matLambert_GrayBlue = AddMaterial(MaterialDesc::Lambert({ .49f, .57f, 0.57f }, 1.f));
+	const auto matLambert_White = AddMaterial(MaterialDesc::Lambert(colors::White, 1.f));
 
 	//Planes
 	AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f,-1.f }, matLambert_GrayBlue);
@@ -236,14 +473,18 @@ void Scene_W4_BunnyScene::Initialize()
 	AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f,0.f }, matLambert_GrayBlue);
 	AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f,0.f }, matLambert_GrayBlue);
 
-	pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
-	Utils::ParseOBJ("Resources/lowpoly_bunny.obj",
-		pMesh->positions,
-		pMesh->normals,
-		pMesh->indices);
+	//The bunny geometry stays in object space, only its instance transform is animated
+	TriangleMesh* pBunnyMesh = AddSharedTriangleMesh(TriangleCullMode::BackFaceCulling);
+	Utils::ParseOBJ(MeshPath,
+		pBunnyMesh->positions,
+		pBunnyMesh->normals,
+		pBunnyMesh->indices);
 
+	pBunnyMesh->UpdateAABB();
+	pBunnyMesh->UpdateTransforms();
+
+	pMesh = AddTriangleMeshInstance(pBunnyMesh, matLambert_White);
 	pMesh->Scale({ 2.f, 2.f, 2.f });
-	pMesh->UpdateAABB();
 	pMesh->UpdateTransforms();
 
 	AddPointLight({ 0.f, 5.5f, 5.f }, 50.f, { 1.f, .61f, .45f });
@@ -251,6 +492,21 @@ void Scene_W4_BunnyScene::Initialize()
 	AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, { .34f, .47f, .68f });
 }
 
+bool Scene_W4_BunnyScene::OnSnapshotLoaded()
+{
+	if (m_TriangleMeshInstances.size() != 1)
+		return false;
+
+	pMesh = &m_TriangleMeshInstances[0];
+	return true;
+}
+
+std::string Scene_W4_BunnyScene::GetSnapshotKey() const
+{
+	//The bunny is parsed from its OBJ, so editing that file rebuilds the snapshot too
+	return "Bunny Scene 1 " + Snapshot::GetFileKey(MeshPath);
+}
+
 void Scene_W4_BunnyScene::Update(Timer* pTimer)
 {
 	Scene::Update(pTimer);
@@ -4,13 +4,15 @@
 
 #include "Maths.h"
 #include "DataTypes.h"
+#include "Grid.h"
 #include "Camera.h"
+#include "Material.h"
+#include "SceneView.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
@@ -34,17 +36,41 @@ namespace dae
 		}
 		virtual void Clear();
 
+		//Refits (or rebuilds) the top-level BVH or grid to the current object bounds, call once per frame after Update
+		void UpdateAccelerationStructure();
+
+		//Threads the meshes transform on and the BVHs build on, nullptr keeps everything on the calling thread. Never used while rendering
+		void SetThreadPool(ThreadPool* pThreadPool);
+
+		//The new structure is built by the next UpdateAccelerationStructure
+		void SetAccelerationStructure(AccelerationStructure accelerationStructure);
+		AccelerationStructure GetAccelerationStructure() const { return m_AccelerationStructure; }
+
+		/**
+		 * \brief Stores the fully initialized scene: geometry, transforms, materials, lights, camera and all BVHs
+		 * \return true when the snapshot was written
+		 */
+		bool SaveSnapshot(const std::string& path) const;
+
+		/**
+		 * \brief Replaces the scene with a snapshot written by SaveSnapshot, instead of calling Initialize
+		 * \return false when the file is missing, from another snapshot version or scene content, truncated or indexes out of range,
+		 * the scene is left empty then
+		 */
+		bool LoadSnapshot(const std::string& path);
+
 		Camera& GetCamera() { return m_Camera; }
-		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
 		const std::string& GetTitle() { 
 			return sceneName;
 		};
-		bool DoesHit(const Ray& ray) const;
+
+		//What the renderer traces this frame, call after Update and UpdateAccelerationStructure
+		SceneView CreateView();
 
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const MaterialTable& GetMaterials() const { return m_Materials; }
 
 	protected:
 		std::string	sceneName;
@@ -52,18 +78,46 @@ namespace dae
 		std::vector<Plane> m_PlaneGeometries{};
 		std::vector<Sphere> m_SphereGeometries{};
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
+
+		//Object space meshes, only rendered through the instances referencing them
+		std::vector<TriangleMesh> m_SharedTriangleMeshes{};
+		std::vector<TriangleMeshInstance> m_TriangleMeshInstances{};
 		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		MaterialTable m_Materials{};
 
 		Camera m_Camera{};
 
+		BVH m_TopLevelBVH{};
+		std::vector<PrimitiveReference> m_TopLevelPrimitives{};
+		std::vector<AABB> m_TopLevelBounds{};
+		float m_TopLevelRebuildThreshold{ 1.5f };
+
+		AccelerationStructure m_AccelerationStructure{ AccelerationStructure::BVH };
+		TwoLevelGrid m_TopLevelGrid{};
+
+		ThreadPool* m_pThreadPool{ nullptr };
+
 		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
 		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
 		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		TriangleMesh* AddSharedTriangleMesh(TriangleCullMode cullMode);
+		TriangleMeshInstance* AddTriangleMeshInstance(const TriangleMesh* pSharedMesh, unsigned char materialIndex = 0);
+
+		//Called after LoadSnapshot, scenes point their animated objects back into the loaded containers here
+		//\return false when the snapshot does not hold the objects the scene expects, it is rejected then
+		virtual bool OnSnapshotLoaded() { return true; }
+
+		//Identifies what Initialize builds, snapshots stored under another key are rebuilt.
+		//Scenes change the version in it whenever Initialize changes and add Snapshot::GetFileKey of the files they load
+		virtual std::string GetSnapshotKey() const { return {}; }
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		unsigned char AddMaterial(const MaterialDesc& desc);
+
+	private:
+		//Every index a loaded snapshot holds has to point inside the scene, the renderer does not check them
+		bool HasValidIndices() const;
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -82,6 +136,10 @@ namespace dae
 		void Initialize() override;
 		void Update(Timer* pTimer) override;
 
+	protected:
+		bool OnSnapshotLoaded() override;
+		std::string GetSnapshotKey() const override;
+
 	private:
 		TriangleMesh* m_Meshes[3]{};
 	};
@@ -100,7 +158,13 @@ namespace dae
 		void Initialize() override;
 		void Update(Timer* pTimer) override;
 
+	protected:
+		bool OnSnapshotLoaded() override;
+		std::string GetSnapshotKey() const override;
+
 	private:
-		TriangleMesh* pMesh{ nullptr };
+		static constexpr const char* MeshPath{ "Resources/lowpoly_bunny.obj" };
+
+		TriangleMeshInstance* pMesh{ nullptr };
 	};
 }
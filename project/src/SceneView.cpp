@@ -0,0 +1,220 @@
+#include "SceneView.h"
+#include "Utils.h"
+
+namespace dae
+{
+	void SceneView::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	{
+		const Kernels& kernels{ *pKernels };
+		HitRecord subHitRecord{};
+
+		for (size_t i{ 0 }; i < planes.size(); ++i)
+		{
+			GeometryUtils::HitTest_Plane(planes[i], ray, subHitRecord);
+			if (closestHit.t > subHitRecord.t) closestHit = subHitRecord;
+		}
+
+		//Objects behind the closest hit so far are culled by the shortened ray
+		Ray closestRay{ ray };
+		closestRay.max = std::min(ray.max, closestHit.t);
+
+		const auto primitiveTest = [&](uint32_t primitiveIndex)
+			{
+				const PrimitiveReference& primitive = topLevelPrimitives[primitiveIndex];
+
+				bool didHit{ false };
+				switch (primitive.type)
+				{
+				case PrimitiveType::Sphere:
+					didHit = GeometryUtils::HitTest_Sphere(spheres[primitive.index], closestRay, subHitRecord);
+					break;
+				case PrimitiveType::TriangleMesh:
+					didHit = kernels.hitTestTriangleMesh(triangleMeshes[primitive.index], closestRay, subHitRecord, false);
+					break;
+				case PrimitiveType::TriangleMeshInstance:
+				{
+					const TriangleMeshInstance& instance = triangleMeshInstances[primitive.index];
+					didHit = kernels.hitTestTriangleMeshInstance(instance, sharedTriangleMeshes[instance.meshIndex], closestRay, subHitRecord, false);
+					break;
+				}
+				}
+
+				if (didHit && closestHit.t > subHitRecord.t)
+				{
+					closestHit = subHitRecord;
+					closestRay.max = closestHit.t;
+				}
+				return false;
+			};
+
+		if (accelerationStructure == AccelerationStructure::TwoLevelGrid)
+			GeometryUtils::TraverseGrid(*pTopLevelGrid, closestRay, primitiveTest);
+		else
+			GeometryUtils::TraverseBVH(*pTopLevelBVH, closestRay, primitiveTest);
+	}
+
+	void SceneView::GetClosestHits(RayPacket& packet, HitRecord* pClosestHits) const
+	{
+		//The grid walks every ray on its own
+		if (accelerationStructure == AccelerationStructure::TwoLevelGrid)
+		{
+			for (uint32_t i{ 0 }; i < packet.size; ++i)
+			{
+				GetClosestHit(packet.GetRay(i), pClosestHits[i]);
+				packet.max[i] = std::min(packet.max[i], pClosestHits[i].t);
+			}
+			return;
+		}
+
+		for (uint32_t i{ 0 }; i < packet.size; ++i)
+		{
+			const Ray ray{ packet.GetRay(i) };
+			HitRecord subHitRecord{};
+			for (size_t planeIndex{ 0 }; planeIndex < planes.size(); ++planeIndex)
+			{
+				GeometryUtils::HitTest_Plane(planes[planeIndex], ray, subHitRecord);
+				if (pClosestHits[i].t > subHitRecord.t) pClosestHits[i] = subHitRecord;
+			}
+			packet.max[i] = std::min(packet.max[i], pClosestHits[i].t);
+		}
+
+		const Kernels& kernels{ *pKernels };
+
+		//Meshes take the packet on through their own BVH, everything else is tested ray by ray
+		const auto primitiveTest = [&](const uint32_t* pPrimitiveIndices, uint32_t primitiveCount, uint64_t rayMask)
+			{
+				for (uint32_t p{ 0 }; p < primitiveCount; ++p)
+				{
+					const PrimitiveReference& primitive = topLevelPrimitives[pPrimitiveIndices[p]];
+					if (primitive.type == PrimitiveType::TriangleMesh)
+					{
+						kernels.hitTestTriangleMeshPacket(triangleMeshes[primitive.index], packet, rayMask, pClosestHits);
+						continue;
+					}
+
+					for (uint64_t remainingRays{ rayMask }; remainingRays; remainingRays &= remainingRays - 1)
+					{
+						const uint32_t i{ static_cast<uint32_t>(std::countr_zero(remainingRays)) };
+						const Ray ray{ packet.GetRay(i) };
+
+						HitRecord subHitRecord{};
+						bool didHit{ false };
+						if (primitive.type == PrimitiveType::Sphere)
+						{
+							didHit = GeometryUtils::HitTest_Sphere(spheres[primitive.index], ray, subHitRecord);
+						}
+						else
+						{
+							const TriangleMeshInstance& instance = triangleMeshInstances[primitive.index];
+							didHit = kernels.hitTestTriangleMeshInstance(instance, sharedTriangleMeshes[instance.meshIndex], ray, subHitRecord, false);
+						}
+
+						if (didHit && pClosestHits[i].t > subHitRecord.t)
+						{
+							pClosestHits[i] = subHitRecord;
+							packet.max[i] = subHitRecord.t;
+						}
+					}
+				}
+			};
+
+		GeometryUtils::TraversePacketBVH(*pTopLevelBVH, packet, packet.GetFullMask(), primitiveTest);
+	}
+
+	bool SceneView::DoesHit(const Ray& ray) const
+	{
+		if (DoesHitPlane(ray)) return true;
+
+		const auto primitiveTest = [&](uint32_t primitiveIndex)
+			{
+				return DoesHitPrimitive(topLevelPrimitives[primitiveIndex], ray);
+			};
+
+		if (accelerationStructure == AccelerationStructure::TwoLevelGrid)
+			return GeometryUtils::TraverseGrid(*pTopLevelGrid, ray, primitiveTest);
+		return GeometryUtils::TraverseBVH(*pTopLevelBVH, ray, primitiveTest);
+	}
+
+	bool SceneView::DoesHit(const Ray& ray, uint32_t lightIndex, OccluderCache& cache) const
+	{
+		if (lightIndex >= OccluderCache::MaxLights) return DoesHit(ray);
+
+		++cache.stats.shadowRays;
+		if (DoesHitPlane(ray)) return true;
+
+		OccluderCache::Occluder& occluder = cache.occluders[lightIndex];
+		if (occluder.isValid)
+		{
+			++cache.stats.lookups;
+			if (DoesHitOccluder(occluder, ray))
+			{
+				++cache.stats.hits;
+				return true;
+			}
+		}
+
+		const auto primitiveTest = [&](uint32_t primitiveIndex)
+			{
+				const PrimitiveReference& primitive = topLevelPrimitives[primitiveIndex];
+
+				uint32_t triangleIndex{};
+				if (!DoesHitPrimitive(primitive, ray, &triangleIndex)) return false;
+
+				occluder = { primitive, triangleIndex, true };
+				return true;
+			};
+
+		if (accelerationStructure == AccelerationStructure::TwoLevelGrid)
+			return GeometryUtils::TraverseGrid(*pTopLevelGrid, ray, primitiveTest);
+		return GeometryUtils::TraverseBVH(*pTopLevelBVH, ray, primitiveTest);
+	}
+
+	bool SceneView::DoesHitPlane(const Ray& ray) const
+	{
+		for (size_t i{ 0 }; i < planes.size(); ++i)
+		{
+			if(GeometryUtils::HitTest_Plane(planes[i], ray)) return true;
+		}
+		return false;
+	}
+
+	bool SceneView::DoesHitPrimitive(const PrimitiveReference& primitive, const Ray& ray, uint32_t* pOccludingTriangle) const
+	{
+		switch (primitive.type)
+		{
+		case PrimitiveType::Sphere:
+			return GeometryUtils::HitTest_Sphere(spheres[primitive.index], ray);
+		case PrimitiveType::TriangleMesh:
+			return pKernels->occlusionTestTriangleMesh(triangleMeshes[primitive.index], ray, pOccludingTriangle);
+		case PrimitiveType::TriangleMeshInstance:
+		{
+			const TriangleMeshInstance& instance = triangleMeshInstances[primitive.index];
+			return pKernels->occlusionTestTriangleMeshInstance(instance, sharedTriangleMeshes[instance.meshIndex], ray, pOccludingTriangle);
+		}
+		}
+		return false;
+	}
+
+	bool SceneView::DoesHitOccluder(const OccluderCache::Occluder& occluder, const Ray& ray) const
+	{
+		//Only the cached triangle is tested, not the whole mesh it belongs to
+		switch (occluder.primitive.type)
+		{
+		case PrimitiveType::Sphere:
+			return GeometryUtils::HitTest_Sphere(spheres[occluder.primitive.index], ray);
+		case PrimitiveType::TriangleMesh:
+		{
+			const TriangleMesh& mesh = triangleMeshes[occluder.primitive.index];
+			return GeometryUtils::HitTest_Triangle(mesh.precomputedTriangles, occluder.triangleIndex, mesh.cullMode, ray);
+		}
+		case PrimitiveType::TriangleMeshInstance:
+		{
+			const TriangleMeshInstance& instance = triangleMeshInstances[occluder.primitive.index];
+			const TriangleMesh& mesh = sharedTriangleMeshes[instance.meshIndex];
+			return GeometryUtils::HitTest_Triangle(mesh.precomputedTriangles, occluder.triangleIndex, mesh.cullMode,
+				GeometryUtils::TransformRayToObjectSpace(instance, ray));
+		}
+		}
+		return false;
+	}
+}
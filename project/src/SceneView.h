@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+#include "Maths.h"
+#include "DataTypes.h"
+#include "Grid.h"
+#include "Material.h"
+#include "CpuDispatch.h"
+
+namespace dae
+{
+	//Objects covered by the top-level BVH, planes are unbounded and stay outside of it
+	enum class PrimitiveType
+	{
+		Sphere,
+		TriangleMesh,
+		TriangleMeshInstance
+	};
+
+	struct PrimitiveReference
+	{
+		PrimitiveType type{};
+		uint32_t index{};
+	};
+
+	//Counters of a shadow occluder cache, summed over caches by the renderer
+	struct OccluderCacheStats
+	{
+		uint64_t shadowRays{};
+		//Shadow rays that found a cached occluder to test first, and how many of them it blocked
+		uint64_t lookups{};
+		uint64_t hits{};
+	};
+
+	//Last primitive that blocked a shadow ray towards each light. Owned by one worker and reused over the shadow rays it traces,
+	//neighbouring shadow rays towards the same light are usually blocked by the same object
+	struct OccluderCache
+	{
+		static constexpr uint32_t MaxLights{ 16 };
+
+		struct Occluder
+		{
+			PrimitiveReference primitive{};
+			//Triangle of a mesh or instance primitive
+			uint32_t triangleIndex{};
+			bool isValid{};
+		};
+
+		Occluder occluders[MaxLights]{};
+		OccluderCacheStats stats{};
+	};
+
+	//Structure the top-level objects are found through, selected per scene
+	enum class AccelerationStructure
+	{
+		BVH, //Any mix of object sizes, refitted while objects move
+		TwoLevelGrid //Many objects of a similar size, rebuilt on every update
+	};
+
+	/**
+	 * \brief Read-only snapshot of everything a frame is rendered from: flat views of the geometry, lights and materials of a scene,
+	 * its top-level acceleration structure and the camera. Built once per frame by Scene::CreateView, after Update and UpdateAccelerationStructure,
+	 * and shared by const reference between the render workers. It only points into the scene, so it is invalidated by the next update
+	 */
+	struct SceneView
+	{
+		//Camera
+		Vector3 cameraOrigin{};
+		Matrix cameraToWorld{};
+		//Tangent of half the field of view angle
+		float fov{};
+
+		std::span<const Plane> planes{};
+		std::span<const Sphere> spheres{};
+		std::span<const TriangleMesh> triangleMeshes{};
+		//Object space meshes, only rendered through the instances referencing them
+		std::span<const TriangleMesh> sharedTriangleMeshes{};
+		std::span<const TriangleMeshInstance> triangleMeshInstances{};
+		std::span<const Light> lights{};
+		const MaterialTable* pMaterials{};
+
+		AccelerationStructure accelerationStructure{ AccelerationStructure::BVH };
+		const BVH* pTopLevelBVH{};
+		const TwoLevelGrid* pTopLevelGrid{};
+		std::span<const PrimitiveReference> topLevelPrimitives{};
+
+		//Kernels of the instruction set selected when the view was built
+		const Kernels* pKernels{};
+
+		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		//Closest hits of all rays of the packet, one record per ray, packet.max ends up at each ray's closest hit
+		void GetClosestHits(RayPacket& packet, HitRecord* pClosestHits) const;
+		bool DoesHit(const Ray& ray) const;
+		//Shadow ray towards light lightIndex, tests the cached occluder of that light before traversing the scene and caches the new occluder
+		bool DoesHit(const Ray& ray, uint32_t lightIndex, OccluderCache& cache) const;
+
+	private:
+		bool DoesHitPlane(const Ray& ray) const;
+		//pOccludingTriangle optional, receives the blocking triangle of a mesh or instance
+		bool DoesHitPrimitive(const PrimitiveReference& primitive, const Ray& ray, uint32_t* pOccludingTriangle = nullptr) const;
+		//Tests only the primitive, or the single triangle, a shadow ray towards the same light was blocked by before
+		bool DoesHitOccluder(const OccluderCache::Occluder& occluder, const Ray& ray) const;
+	};
+}
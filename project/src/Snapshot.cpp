@@ -0,0 +1,430 @@
+#include "Snapshot.h"
+
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Camera.h"
+
+namespace dae {
+
+#pragma region Mapped File
+	MappedFile::MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+		m_FileHandle = file;
+
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) return;
+
+		m_MappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_MappingHandle) return;
+
+		m_pData = static_cast<const unsigned char*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (m_pData) m_Size = static_cast<size_t>(size.QuadPart);
+#else
+		const int file{ open(path.c_str(), O_RDONLY) };
+		if (file < 0) return;
+
+		struct stat fileInfo {};
+		if (fstat(file, &fileInfo) == 0 && fileInfo.st_size > 0)
+		{
+			void* pMapping = mmap(nullptr, static_cast<size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (pMapping != MAP_FAILED)
+			{
+				m_pData = static_cast<const unsigned char*>(pMapping);
+				m_Size = static_cast<size_t>(fileInfo.st_size);
+			}
+		}
+
+		//The mapping stays valid after the descriptor is closed
+		close(file);
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#ifdef _WIN32
+		if (m_pData) UnmapViewOfFile(m_pData);
+		if (m_MappingHandle) CloseHandle(m_MappingHandle);
+		if (m_FileHandle) CloseHandle(m_FileHandle);
+#else
+		if (m_pData) munmap(const_cast<unsigned char*>(m_pData), m_Size);
+#endif
+	}
+#pragma endregion
+
+#pragma region Snapshot Writer
+	void SnapshotWriter::WriteString(const std::string& value)
+	{
+		Write<uint64_t>(value.size());
+		Append(value.data(), value.size());
+	}
+
+	void SnapshotWriter::WriteMatrix(const Matrix& matrix)
+	{
+		for (int row{ 0 }; row < 4; ++row)
+		{
+			Write(matrix[row]);
+		}
+	}
+
+	bool SnapshotWriter::SaveToFile(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		file.write(reinterpret_cast<const char*>(m_Data.data()), static_cast<std::streamsize>(m_Data.size()));
+		return file.good();
+	}
+
+	void SnapshotWriter::Append(const void* pData, size_t size)
+	{
+		const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+		m_Data.insert(m_Data.end(), pBytes, pBytes + size);
+	}
+
+	void SnapshotWriter::Align()
+	{
+		m_Data.resize((m_Data.size() + 15) & ~size_t(15), 0);
+	}
+#pragma endregion
+
+#pragma region Snapshot Reader
+	std::string SnapshotReader::ReadString()
+	{
+		const uint64_t size{ Read<uint64_t>() };
+		const unsigned char* pSource = size <= m_Size - m_Offset ? Consume(size) : nullptr;
+		if (!pSource)
+		{
+			m_IsValid = false;
+			return {};
+		}
+		return std::string(reinterpret_cast<const char*>(pSource), size);
+	}
+
+	Matrix SnapshotReader::ReadMatrix()
+	{
+		const Vector4 xAxis{ Read<Vector4>() };
+		const Vector4 yAxis{ Read<Vector4>() };
+		const Vector4 zAxis{ Read<Vector4>() };
+		const Vector4 t{ Read<Vector4>() };
+		return { xAxis, yAxis, zAxis, t };
+	}
+
+	const unsigned char* SnapshotReader::Consume(size_t size)
+	{
+		if (!m_IsValid || size > m_Size - m_Offset)
+		{
+			m_IsValid = false;
+			return nullptr;
+		}
+
+		const unsigned char* pData = m_pData + m_Offset;
+		m_Offset += size;
+		return pData;
+	}
+
+	void SnapshotReader::Align()
+	{
+		m_Offset = std::min(m_Size, (m_Offset + 15) & ~size_t(15));
+	}
+#pragma endregion
+
+#pragma region Snapshot Format
+	//Child indices and primitive ranges of wide or compressed nodes, and the binary nodes they refit from, have to stay inside their arrays
+	template<typename Node>
+	static bool IsValidWideBVH(const std::vector<Node>& nodes, const std::vector<uint32_t>& sourceNodes, const BVH& bvh)
+	{
+		if (sourceNodes.size() != nodes.size() * Node::Width)
+			return false;
+
+		for (uint32_t sourceNode : sourceNodes)
+		{
+			if (sourceNode >= bvh.nodes.size())
+				return false;
+		}
+
+		for (const Node& node : nodes)
+		{
+			for (int i{ 0 }; i < Node::Width; ++i)
+			{
+				const bool isInside{ node.primitiveCounts[i] > 0 ? uint64_t(node.children[i]) + node.primitiveCounts[i] <= bvh.primitiveIndices.size()
+					: node.children[i] < nodes.size() };
+				if (!isInside)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	std::string Snapshot::GetFileKey(const std::string& path)
+	{
+		std::error_code error{};
+		const uintmax_t size{ std::filesystem::file_size(path, error) };
+		if (error)
+			return "missing";
+
+		const auto writeTime = std::filesystem::last_write_time(path, error);
+		return std::to_string(size) + ":" + std::to_string(writeTime.time_since_epoch().count());
+	}
+
+	void Snapshot::WriteBVH(SnapshotWriter& writer, const BVH& bvh)
+	{
+		writer.WriteArray(bvh.nodes);
+		writer.WriteArray(bvh.primitiveIndices);
+		writer.Write(bvh.primitiveCount);
+		writer.Write(bvh.buildCost);
+		writer.Write(bvh.parallelBuildThreshold);
+		writer.Write(bvh.builder);
+		writer.Write(bvh.layout);
+		writer.Write(bvh.spatialSplitBudget);
+	}
+
+	void Snapshot::ReadBVH(SnapshotReader& reader, BVH& bvh)
+	{
+		reader.ReadArray(bvh.nodes);
+		reader.ReadArray(bvh.primitiveIndices);
+		bvh.primitiveCount = reader.Read<uint32_t>();
+		bvh.buildCost = reader.Read<float>();
+		bvh.parallelBuildThreshold = reader.Read<uint32_t>();
+		bvh.builder = reader.ReadEnum(BVHBuilder::SpatialSplitSAH);
+		bvh.layout = reader.ReadEnum(BVHLayout::VanEmdeBoas);
+		bvh.spatialSplitBudget = reader.Read<float>();
+
+		//Children are always stored after their parent, which also rules out cycles for the traversal
+		for (uint32_t i{ 0 }; i < bvh.nodes.size(); ++i)
+		{
+			const BVHNode& node = bvh.nodes[i];
+			if (node.IsLeaf() ? uint64_t(node.leftFirst) + node.primitiveCount > bvh.primitiveIndices.size()
+				: node.leftFirst <= i || uint64_t(node.leftFirst) + 1 >= bvh.nodes.size())
+				reader.Invalidate();
+		}
+		for (uint32_t primitiveIndex : bvh.primitiveIndices)
+		{
+			if (primitiveIndex >= bvh.primitiveCount)
+				reader.Invalidate();
+		}
+	}
+
+	void Snapshot::WriteGrid(SnapshotWriter& writer, const TwoLevelGrid& grid)
+	{
+		writer.Write(grid.bounds);
+		writer.Write(grid.resolution);
+		writer.Write(grid.cellSize);
+		writer.WriteArray(grid.cells);
+		writer.WriteArray(grid.leafCells);
+		writer.WriteArray(grid.primitiveIndices);
+		writer.Write(grid.primitiveCount);
+		writer.Write(grid.topLevelDensity);
+		writer.Write(grid.leafDensity);
+	}
+
+	void Snapshot::ReadGrid(SnapshotReader& reader, TwoLevelGrid& grid)
+	{
+		grid.bounds = reader.Read<AABB>();
+		for (int& resolution : grid.resolution)
+		{
+			resolution = reader.Read<int>();
+		}
+		grid.cellSize = reader.Read<Vector3>();
+		reader.ReadArray(grid.cells);
+		reader.ReadArray(grid.leafCells);
+		reader.ReadArray(grid.primitiveIndices);
+		grid.primitiveCount = reader.Read<uint32_t>();
+		grid.topLevelDensity = reader.Read<float>();
+		grid.leafDensity = reader.Read<float>();
+
+		uint64_t cellCount{ 1 };
+		for (int resolution : grid.resolution)
+		{
+			if (resolution < 0 || resolution > TwoLevelGrid::MaxResolution)
+				reader.Invalidate();
+			cellCount *= static_cast<uint32_t>(resolution);
+		}
+		if (grid.cells.size() != cellCount)
+			reader.Invalidate();
+
+		for (const GridCell& cell : grid.cells)
+		{
+			const uint64_t leafCellCount{ uint64_t(cell.resolution[0]) * cell.resolution[1] * cell.resolution[2] };
+			if (cell.firstLeafCell + leafCellCount > grid.leafCells.size())
+				reader.Invalidate();
+		}
+		for (const GridLeafCell& leafCell : grid.leafCells)
+		{
+			if (uint64_t(leafCell.first) + leafCell.count > grid.primitiveIndices.size())
+				reader.Invalidate();
+		}
+		for (uint32_t primitiveIndex : grid.primitiveIndices)
+		{
+			if (primitiveIndex >= grid.primitiveCount)
+				reader.Invalidate();
+		}
+	}
+
+	void Snapshot::WriteTriangleMesh(SnapshotWriter& writer, const TriangleMesh& mesh)
+	{
+		writer.WriteArray(mesh.positions);
+		writer.WriteArray(mesh.normals);
+		writer.WriteArray(mesh.indices);
+		writer.Write(mesh.materialIndex);
+		writer.Write(mesh.cullMode);
+
+		writer.WriteMatrix(mesh.rotationTransform);
+		writer.WriteMatrix(mesh.translationTransform);
+		writer.WriteMatrix(mesh.scaleTransform);
+
+		writer.Write(mesh.minAABB);
+		writer.Write(mesh.maxAABB);
+		writer.Write(mesh.transformedMinAABB);
+		writer.Write(mesh.transformedMaxAABB);
+		writer.WriteArray(mesh.transformedPositions);
+		writer.WriteArray(mesh.transformedNormals);
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			writer.WriteArray(mesh.precomputedTriangles.v0[axis]);
+			writer.WriteArray(mesh.precomputedTriangles.edge1[axis]);
+			writer.WriteArray(mesh.precomputedTriangles.edge2[axis]);
+			writer.WriteArray(mesh.precomputedTriangles.normal[axis]);
+		}
+
+		WriteBVH(writer, mesh.bvh);
+		writer.WriteArray(mesh.triangleBounds);
+		writer.Write(mesh.bvhRebuildThreshold);
+		writer.WriteArray(mesh.wideBvh.nodes);
+		writer.WriteArray(mesh.wideBvh.sourceNodes);
+		writer.Write(mesh.useWideBVH);
+		writer.WriteArray(mesh.compressedBvh.nodes);
+		writer.WriteArray(mesh.compressedBvh.sourceNodes);
+		writer.Write(mesh.useCompressedBVH);
+	}
+
+	void Snapshot::ReadTriangleMesh(SnapshotReader& reader, TriangleMesh& mesh)
+	{
+		reader.ReadArray(mesh.positions);
+		reader.ReadArray(mesh.normals);
+		reader.ReadArray(mesh.indices);
+		mesh.materialIndex = reader.Read<unsigned char>();
+		mesh.cullMode = reader.ReadEnum(TriangleCullMode::NoCulling);
+
+		mesh.rotationTransform = reader.ReadMatrix();
+		mesh.translationTransform = reader.ReadMatrix();
+		mesh.scaleTransform = reader.ReadMatrix();
+
+		mesh.minAABB = reader.Read<Vector3>();
+		mesh.maxAABB = reader.Read<Vector3>();
+		mesh.transformedMinAABB = reader.Read<Vector3>();
+		mesh.transformedMaxAABB = reader.Read<Vector3>();
+		reader.ReadArray(mesh.transformedPositions);
+		reader.ReadArray(mesh.transformedNormals);
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			reader.ReadArray(mesh.precomputedTriangles.v0[axis]);
+			reader.ReadArray(mesh.precomputedTriangles.edge1[axis]);
+			reader.ReadArray(mesh.precomputedTriangles.edge2[axis]);
+			reader.ReadArray(mesh.precomputedTriangles.normal[axis]);
+		}
+
+		//The wide triangle kernels read whole vectors past the last triangle, so unpadded arrays are never accepted
+		const size_t paddedCount{ mesh.indices.size() / 3 + PrecomputedTriangles::Padding };
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			const PrecomputedTriangles& triangles = mesh.precomputedTriangles;
+			if (triangles.v0[axis].size() != paddedCount || triangles.edge1[axis].size() != paddedCount ||
+				triangles.edge2[axis].size() != paddedCount || triangles.normal[axis].size() != paddedCount)
+				reader.Invalidate();
+		}
+
+		ReadBVH(reader, mesh.bvh);
+		reader.ReadArray(mesh.triangleBounds);
+		mesh.bvhRebuildThreshold = reader.Read<float>();
+		reader.ReadArray(mesh.wideBvh.nodes);
+		reader.ReadArray(mesh.wideBvh.sourceNodes);
+		mesh.useWideBVH = reader.ReadBool();
+		reader.ReadArray(mesh.compressedBvh.nodes);
+		reader.ReadArray(mesh.compressedBvh.sourceNodes);
+		mesh.useCompressedBVH = reader.ReadBool();
+
+		//Everything the intersection tests index with has to stay inside the mesh
+		const size_t triangleCount{ mesh.indices.size() / 3 };
+		if (mesh.indices.size() % 3 != 0 || mesh.normals.size() != triangleCount || mesh.transformedNormals.size() != triangleCount ||
+			mesh.transformedPositions.size() != mesh.positions.size() || mesh.triangleBounds.size() != triangleCount ||
+			mesh.bvh.primitiveCount > triangleCount)
+			reader.Invalidate();
+
+		for (int index : mesh.indices)
+		{
+			if (index < 0 || static_cast<size_t>(index) >= mesh.positions.size())
+				reader.Invalidate();
+		}
+
+		if (!IsValidWideBVH(mesh.wideBvh.nodes, mesh.wideBvh.sourceNodes, mesh.bvh) ||
+			!IsValidWideBVH(mesh.compressedBvh.nodes, mesh.compressedBvh.sourceNodes, mesh.bvh))
+			reader.Invalidate();
+	}
+
+	void Snapshot::WriteTriangleMeshInstance(SnapshotWriter& writer, const TriangleMeshInstance& instance)
+	{
+		writer.Write(instance.meshIndex);
+		writer.Write(instance.materialIndex);
+
+		writer.WriteMatrix(instance.rotationTransform);
+		writer.WriteMatrix(instance.translationTransform);
+		writer.WriteMatrix(instance.scaleTransform);
+		writer.WriteMatrix(instance.transform);
+		writer.WriteMatrix(instance.inverseTransform);
+		writer.WriteMatrix(instance.normalTransform);
+	}
+
+	void Snapshot::ReadTriangleMeshInstance(SnapshotReader& reader, TriangleMeshInstance& instance)
+	{
+		instance.meshIndex = reader.Read<uint32_t>();
+		instance.materialIndex = reader.Read<unsigned char>();
+
+		instance.rotationTransform = reader.ReadMatrix();
+		instance.translationTransform = reader.ReadMatrix();
+		instance.scaleTransform = reader.ReadMatrix();
+		instance.transform = reader.ReadMatrix();
+		instance.inverseTransform = reader.ReadMatrix();
+		instance.normalTransform = reader.ReadMatrix();
+	}
+
+	void Snapshot::WriteCamera(SnapshotWriter& writer, const Camera& camera)
+	{
+		writer.Write(camera.origin);
+		writer.Write(camera.fovAngle);
+		writer.Write(camera.forward);
+		writer.Write(camera.up);
+		writer.Write(camera.right);
+		writer.Write(camera.totalPitch);
+		writer.Write(camera.totalYaw);
+		writer.WriteMatrix(camera.cameraToWorld);
+	}
+
+	void Snapshot::ReadCamera(SnapshotReader& reader, Camera& camera)
+	{
+		camera.origin = reader.Read<Vector3>();
+		camera.fovAngle = reader.Read<float>();
+		camera.forward = reader.Read<Vector3>();
+		camera.up = reader.Read<Vector3>();
+		camera.right = reader.Read<Vector3>();
+		camera.totalPitch = reader.Read<float>();
+		camera.totalYaw = reader.Read<float>();
+		camera.cameraToWorld = reader.ReadMatrix();
+	}
+#pragma endregion
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "DataTypes.h"
+#include "Grid.h"
+
+namespace dae
+{
+	struct Camera;
+
+#pragma region MAPPED FILE
+	//Read-only view of a whole file, mapped into the address space instead of being read into a buffer
+	class MappedFile final
+	{
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile(MappedFile&&) noexcept = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+		bool IsOpen() const { return m_pData != nullptr; }
+		const unsigned char* GetData() const { return m_pData; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const unsigned char* m_pData{ nullptr };
+		size_t m_Size{};
+
+#ifdef _WIN32
+		void* m_FileHandle{ nullptr };
+		void* m_MappingHandle{ nullptr };
+#endif
+	};
+#pragma endregion
+
+#pragma region SNAPSHOT WRITER
+	/**
+	 * \brief Builds a snapshot in memory. Values are stored as raw bytes, arrays as their element count
+	 * followed by the elements themselves, starting 16-byte aligned so they can be copied out in one go.
+	 */
+	class SnapshotWriter final
+	{
+	public:
+		template<typename T>
+		void Write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Snapshots only store trivially copyable values");
+			Append(&value, sizeof(T));
+		}
+
+		template<typename T>
+		void WriteArray(const std::vector<T>& values)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Snapshots only store trivially copyable values");
+			Write<uint64_t>(values.size());
+			Align();
+			Append(values.data(), values.size() * sizeof(T));
+		}
+
+		void WriteString(const std::string& value);
+		void WriteMatrix(const Matrix& matrix);
+
+		bool SaveToFile(const std::string& path) const;
+
+	private:
+		std::vector<unsigned char> m_Data{};
+
+		void Append(const void* pData, size_t size);
+		void Align();
+	};
+#pragma endregion
+
+#pragma region SNAPSHOT READER
+	//Reads back what SnapshotWriter wrote, reading past the end marks the reader invalid instead of throwing
+	class SnapshotReader final
+	{
+	public:
+		SnapshotReader(const unsigned char* pData, size_t size) :
+			m_pData{ pData }, m_Size{ size }
+		{
+		}
+
+		template<typename T>
+		T Read()
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Snapshots only store trivially copyable values");
+
+			T value{};
+			if (const unsigned char* pSource = Consume(sizeof(T)))
+				std::memcpy(&value, pSource, sizeof(T));
+			return value;
+		}
+
+		template<typename T>
+		void ReadArray(std::vector<T>& values)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Snapshots only store trivially copyable values");
+
+			const uint64_t count{ Read<uint64_t>() };
+			Align();
+
+			//Bulk copy straight out of the mapping, no per element work
+			const unsigned char* pSource = count <= (m_Size - m_Offset) / sizeof(T) ? Consume(count * sizeof(T)) : nullptr;
+			if (!pSource)
+			{
+				m_IsValid = false;
+				values.clear();
+				return;
+			}
+
+			values.resize(count);
+			if (count > 0) std::memcpy(values.data(), pSource, count * sizeof(T));
+		}
+
+		//Any byte other than 0 or 1 marks the reader invalid, copying it into a bool would be undefined
+		bool ReadBool()
+		{
+			const uint8_t value{ Read<uint8_t>() };
+			if (value > 1) m_IsValid = false;
+			return value == 1;
+		}
+
+		//Values past last mark the reader invalid and read as the first enumerator
+		template<typename T>
+		T ReadEnum(T last)
+		{
+			static_assert(std::is_enum_v<T>, "ReadEnum only reads enumerations");
+
+			//Negative values wrap around to large unsigned ones, so one comparison covers both ends
+			using Unsigned = std::make_unsigned_t<std::underlying_type_t<T>>;
+			const Unsigned value{ Read<Unsigned>() };
+			if (value > static_cast<Unsigned>(last))
+			{
+				m_IsValid = false;
+				return T{};
+			}
+			return static_cast<T>(value);
+		}
+
+		std::string ReadString();
+		Matrix ReadMatrix();
+
+		bool IsValid() const { return m_IsValid; }
+		//For data that reads fine but does not hold together, the snapshot is rejected like a truncated one
+		void Invalidate() { m_IsValid = false; }
+
+	private:
+		const unsigned char* m_pData{ nullptr };
+		size_t m_Size{};
+		size_t m_Offset{};
+		bool m_IsValid{ true };
+
+		const unsigned char* Consume(size_t size);
+		void Align();
+	};
+#pragma endregion
+
+#pragma region SNAPSHOT FORMAT
+	namespace Snapshot
+	{
+		constexpr uint32_t Magic{ 0x53535452 }; //"RTSS"
+		//Bump whenever the layout of anything stored below changes, old snapshots are then rebuilt
+		constexpr uint32_t Version{ 8 };
+
+		//Size and last write time of a file a scene is built from, so a snapshot of an older version of it is rebuilt
+		std::string GetFileKey(const std::string& path);
+
+		void WriteBVH(SnapshotWriter& writer, const BVH& bvh);
+		void ReadBVH(SnapshotReader& reader, BVH& bvh);
+
+		void WriteGrid(SnapshotWriter& writer, const TwoLevelGrid& grid);
+		void ReadGrid(SnapshotReader& reader, TwoLevelGrid& grid);
+
+		void WriteTriangleMesh(SnapshotWriter& writer, const TriangleMesh& mesh);
+		void ReadTriangleMesh(SnapshotReader& reader, TriangleMesh& mesh);
+
+		void WriteTriangleMeshInstance(SnapshotWriter& writer, const TriangleMeshInstance& instance);
+		void ReadTriangleMeshInstance(SnapshotReader& reader, TriangleMeshInstance& instance);
+
+		void WriteCamera(SnapshotWriter& writer, const Camera& camera);
+		void ReadCamera(SnapshotReader& reader, Camera& camera);
+	}
+#pragma endregion
+}
@@ -0,0 +1,183 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double ElapsedMilliseconds(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	uint64_t PackRange(uint32_t begin, uint32_t end)
+	{
+		return (uint64_t(end) << 32) | begin;
+	}
+
+	uint32_t GetBegin(uint64_t range)
+	{
+		return static_cast<uint32_t>(range);
+	}
+
+	uint32_t GetEnd(uint64_t range)
+	{
+		return static_cast<uint32_t>(range >> 32);
+	}
+}
+
+namespace dae
+{
+	ThreadPool::ThreadPool(uint32_t threadCount) :
+		m_ThreadCount(std::max(threadCount, 1u)),
+		m_pWorkers(std::make_unique<Worker[]>(m_ThreadCount))
+	{
+		m_Threads.reserve(m_ThreadCount - 1);
+		for (uint32_t threadIndex{ 1 }; threadIndex < m_ThreadCount; ++threadIndex)
+		{
+			m_Threads.emplace_back(&ThreadPool::ThreadLoop, this, threadIndex);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			const std::lock_guard lock{ m_Mutex };
+			m_IsShuttingDown = true;
+		}
+		m_StartCondition.notify_all();
+
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	uint32_t ThreadPool::GetDefaultThreadCount()
+	{
+		return std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	void ThreadPool::ResetStats()
+	{
+		for (uint32_t threadIndex{ 0 }; threadIndex < m_ThreadCount; ++threadIndex)
+		{
+			m_pWorkers[threadIndex].stats = ThreadStats{};
+		}
+		m_RunMilliseconds = 0.0;
+	}
+
+	void ThreadPool::RunTasks(uint32_t taskCount, void* pFunction, TaskFunction taskFunction)
+	{
+		const Clock::time_point start{ Clock::now() };
+
+		//Contiguous ranges, so every thread starts on its own part of the frame
+		for (uint32_t threadIndex{ 0 }; threadIndex < m_ThreadCount; ++threadIndex)
+		{
+			const uint32_t begin{ static_cast<uint32_t>(uint64_t(taskCount) * threadIndex / m_ThreadCount) };
+			const uint32_t end{ static_cast<uint32_t>(uint64_t(taskCount) * (threadIndex + 1) / m_ThreadCount) };
+			m_pWorkers[threadIndex].range.store(PackRange(begin, end), std::memory_order_relaxed);
+		}
+
+		{
+			const std::lock_guard lock{ m_Mutex };
+			m_pFunction = pFunction;
+			m_TaskFunction = taskFunction;
+			m_BusyThreads = m_ThreadCount - 1;
+			++m_Generation;
+		}
+		m_StartCondition.notify_all();
+
+		Work(0);
+
+		//Tasks a thread stole are run by that thread, so the batch is done once every thread is out of work
+		std::unique_lock lock{ m_Mutex };
+		m_DoneCondition.wait(lock, [this]() { return m_BusyThreads == 0; });
+
+		m_RunMilliseconds += ElapsedMilliseconds(start, Clock::now());
+	}
+
+	void ThreadPool::ThreadLoop(uint32_t threadIndex)
+	{
+		uint64_t generation{ 0 };
+		while (true)
+		{
+			{
+				std::unique_lock lock{ m_Mutex };
+				m_StartCondition.wait(lock, [&]() { return m_IsShuttingDown || m_Generation != generation; });
+				if (m_IsShuttingDown) return;
+				generation = m_Generation;
+			}
+
+			Work(threadIndex);
+
+			bool isLast{};
+			{
+				const std::lock_guard lock{ m_Mutex };
+				isLast = --m_BusyThreads == 0;
+			}
+			if (isLast) m_DoneCondition.notify_one();
+		}
+	}
+
+	void ThreadPool::Work(uint32_t threadIndex)
+	{
+		Worker& worker = m_pWorkers[threadIndex];
+
+		while (true)
+		{
+			uint32_t taskIndex{};
+			while (PopTask(worker, taskIndex))
+			{
+				const Clock::time_point start{ Clock::now() };
+				m_TaskFunction(m_pFunction, taskIndex, threadIndex);
+				worker.stats.busyMilliseconds += ElapsedMilliseconds(start, Clock::now());
+				++worker.stats.tasks;
+			}
+
+			//Victims are tried in order from the next thread on, so thieves spread over the others
+			bool didSteal{ false };
+			for (uint32_t offset{ 1 }; offset < m_ThreadCount && !didSteal; ++offset)
+			{
+				didSteal = StealTasks(worker, m_pWorkers[(threadIndex + offset) % m_ThreadCount]);
+			}
+			if (!didSteal) return;
+		}
+	}
+
+	bool ThreadPool::PopTask(Worker& worker, uint32_t& taskIndex)
+	{
+		uint64_t range{ worker.range.load(std::memory_order_acquire) };
+		while (GetBegin(range) < GetEnd(range))
+		{
+			if (worker.range.compare_exchange_weak(range, PackRange(GetBegin(range) + 1, GetEnd(range)), std::memory_order_acq_rel))
+			{
+				taskIndex = GetBegin(range);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ThreadPool::StealTasks(Worker& thief, Worker& victim)
+	{
+		uint64_t range{ victim.range.load(std::memory_order_acquire) };
+		while (GetBegin(range) < GetEnd(range))
+		{
+			//The back half, the victim keeps working from the front of its range
+			const uint32_t stolenCount{ (GetEnd(range) - GetBegin(range) + 1) / 2 };
+			const uint32_t middle{ GetEnd(range) - stolenCount };
+
+			if (victim.range.compare_exchange_weak(range, PackRange(GetBegin(range), middle), std::memory_order_acq_rel))
+			{
+				//The thief only steals once its own range is empty, so nobody else changes it in the meantime
+				thief.range.store(PackRange(middle, GetEnd(range)), std::memory_order_release);
+				thief.stats.stolenTasks += stolenCount;
+				return true;
+			}
+		}
+		return false;
+	}
+}
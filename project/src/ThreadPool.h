@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dae
+{
+	//Work one thread of the pool did since the last reset
+	struct ThreadStats
+	{
+		uint64_t tasks{};
+		//Tasks taken from the range of another thread after running out of its own
+		uint64_t stolenTasks{};
+		double busyMilliseconds{};
+	};
+
+	/**
+	 * \brief Worker threads that stay alive between frames and run batches of numbered tasks.
+	 * Every batch is split into one contiguous range of tasks per thread, so neighbouring tiles start on the same thread,
+	 * a thread that runs out of tasks steals half of the remaining range of another one
+	 */
+	class ThreadPool final
+	{
+	public:
+		//threadCount includes the thread calling Run, which works along with the others
+		explicit ThreadPool(uint32_t threadCount);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		//One thread per hardware thread
+		static uint32_t GetDefaultThreadCount();
+
+		/**
+		 * \brief Calls function(taskIndex, threadIndex) for every task index below taskCount and returns once all of them are done
+		 * \param function called concurrently, threadIndex is below GetThreadCount and the calling thread is thread 0
+		 */
+		template<typename Function>
+		void Run(uint32_t taskCount, Function&& function)
+		{
+			RunTasks(taskCount, &function, [](void* pFunction, uint32_t taskIndex, uint32_t threadIndex)
+				{
+					(*static_cast<std::remove_reference_t<Function>*>(pFunction))(taskIndex, threadIndex);
+				});
+		}
+
+		uint32_t GetThreadCount() const { return m_ThreadCount; }
+		const ThreadStats& GetThreadStats(uint32_t threadIndex) const { return m_pWorkers[threadIndex].stats; }
+		//Time spent in Run since the last reset, a thread was idle for the part of it it was not busy
+		double GetRunMilliseconds() const { return m_RunMilliseconds; }
+		void ResetStats();
+
+	private:
+		using TaskFunction = void(*)(void* pFunction, uint32_t taskIndex, uint32_t threadIndex);
+
+		struct alignas(64) Worker
+		{
+			//Tasks left to this thread: the first in the low 32 bits, one past the last in the high 32 bits
+			std::atomic<uint64_t> range{};
+			ThreadStats stats{};
+		};
+
+		uint32_t m_ThreadCount{};
+		std::unique_ptr<Worker[]> m_pWorkers;
+		//Threads 1 and up, thread 0 is whoever calls Run
+		std::vector<std::thread> m_Threads{};
+
+		//Batch being run, published to the threads under m_Mutex by bumping m_Generation
+		void* m_pFunction{};
+		TaskFunction m_TaskFunction{};
+
+		std::mutex m_Mutex{};
+		std::condition_variable m_StartCondition{};
+		std::condition_variable m_DoneCondition{};
+		uint64_t m_Generation{};
+		uint32_t m_BusyThreads{};
+		bool m_IsShuttingDown{};
+
+		double m_RunMilliseconds{};
+
+		void RunTasks(uint32_t taskCount, void* pFunction, TaskFunction taskFunction);
+		void ThreadLoop(uint32_t threadIndex);
+		//Runs tasks from its own range and from the others until every range is empty
+		void Work(uint32_t threadIndex);
+		bool PopTask(Worker& worker, uint32_t& taskIndex);
+		bool StealTasks(Worker& thief, Worker& victim);
+	};
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	//Order the workers take the tiles of a frame in, consecutive tasks of a thread are its neighbouring tiles
+	enum class TileOrder
+	{
+		//Row by row
+		Scanline,
+		//Z-order: 2x2 blocks of tiles, in 2x2 blocks of those and so on
+		Morton,
+		//Like Morton, but every tile is next to the one before it
+		Hilbert
+	};
+
+	namespace TileOrdering
+	{
+		//Spreads the lower 16 bits of value so there is a zero bit between each of them
+		inline uint32_t ExpandBits(uint32_t value)
+		{
+			value &= 0x0000FFFFu;
+			value = (value | (value << 8)) & 0x00FF00FFu;
+			value = (value | (value << 4)) & 0x0F0F0F0Fu;
+			value = (value | (value << 2)) & 0x33333333u;
+			value = (value | (value << 1)) & 0x55555555u;
+			return value;
+		}
+
+		inline uint32_t MortonIndex(uint32_t x, uint32_t y)
+		{
+			return (ExpandBits(y) << 1) | ExpandBits(x);
+		}
+
+		//Distance along the Hilbert curve through a size x size grid, size a power of two
+		inline uint32_t HilbertIndex(uint32_t size, uint32_t x, uint32_t y)
+		{
+			uint32_t index{ 0 };
+			for (uint32_t half{ size / 2 }; half > 0; half /= 2)
+			{
+				const uint32_t rx{ (x & half) > 0 }, ry{ (y & half) > 0 };
+				index += half * half * ((3 * rx) ^ ry);
+
+				//Rotate the quadrant so the curve through it starts where the previous one ended
+				if (ry == 0)
+				{
+					if (rx == 1)
+					{
+						x = size - 1 - x;
+						y = size - 1 - y;
+					}
+					std::swap(x, y);
+				}
+			}
+			return index;
+		}
+
+		/**
+		 * \brief Fills tileIndices with the row by row index of every tile of a tilesX x tilesY grid, in the given order.
+		 * The curves run through the power of two square around the grid, tiles outside of it are skipped
+		 */
+		inline void Build(TileOrder order, uint32_t tilesX, uint32_t tilesY, std::vector<uint32_t>& tileIndices)
+		{
+			const uint32_t tileCount{ tilesX * tilesY };
+			tileIndices.resize(tileCount);
+			for (uint32_t i{ 0 }; i < tileCount; ++i) tileIndices[i] = i;
+			if (order == TileOrder::Scanline) return;
+
+			uint32_t size{ 1 };
+			while (size < std::max(tilesX, tilesY)) size *= 2;
+
+			//Curve index in the upper half of every key, tile index in the lower half
+			std::vector<uint64_t> keys(tileCount);
+			for (uint32_t i{ 0 }; i < tileCount; ++i)
+			{
+				const uint32_t x{ i % tilesX }, y{ i / tilesX };
+				const uint32_t curveIndex{ order == TileOrder::Morton ? MortonIndex(x, y) : HilbertIndex(size, x, y) };
+				keys[i] = (uint64_t(curveIndex) << 32) | i;
+			}
+			std::sort(keys.begin(), keys.end());
+
+			for (uint32_t i{ 0 }; i < tileCount; ++i) tileIndices[i] = static_cast<uint32_t>(keys[i]);
+		}
+	}
+}
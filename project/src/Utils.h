@@ -1,12 +1,28 @@
 #pragma once
+#include <bit>
+#include <cstring>
 #include <fstream>
+#include <type_traits>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "Maths.h"
 #include "DataTypes.h"
+#include "Grid.h"
+
+//Kernel variants (KernelVariant.h) compile this header for other instruction sets, their copies of the inline
+//kernels go in a namespace of their own so the linker never swaps them for the baseline ones
+#ifndef KERNEL_ISA
+#define KERNEL_ISA Baseline
+#endif
 
 namespace dae
 {
 	namespace GeometryUtils
 	{
+	inline namespace KERNEL_ISA
+	{
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
@@ -46,10 +62,24 @@ namespace dae
 			return true;
 		}
 
+		//Occlusion query, the same test without any hit record work
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Sphere(sphere, ray, temp, true);
+			const float offset[3]{ ray.origin.x - sphere.origin.x, ray.origin.y - sphere.origin.y, ray.origin.z - sphere.origin.z };
+			const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+
+			const float A{ direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2] };
+			const float B{ 2.f * direction[0] * offset[0] + 2.f * direction[1] * offset[1] + 2.f * direction[2] * offset[2] };
+			const float C{ offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2] - (sphere.radius * sphere.radius) };
+			const float D{ B * B - 4.f * A * C };
+			if (D <= 0.f) return false;
+
+			const float NormDiscriminant = sqrtf(D);
+
+			float t = (-B - NormDiscriminant) / (2 * A);
+			if (t < ray.min) t = (-B + NormDiscriminant) / (2 * A);
+
+			return !(t < ray.min || t >= ray.max);
 		}
 #pragma endregion
 #pragma region Plane HitTest
@@ -78,26 +108,41 @@ namespace dae
 			return true;
 		}
 
+		//Occlusion query, the same test without any hit record work
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			const float originToPlane[3]{ plane.origin.x - ray.origin.x, plane.origin.y - ray.origin.y, plane.origin.z - ray.origin.z };
+
+			const float t{ (originToPlane[0] * plane.normal.x + originToPlane[1] * plane.normal.y + originToPlane[2] * plane.normal.z)
+				/ (ray.direction.x * plane.normal.x + ray.direction.y * plane.normal.y + ray.direction.z * plane.normal.z) };
+
+			return !(t < ray.min || t >= ray.max);
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		/**
+		 * \brief Möller–Trumbore intersection on a precomputed vertex and edges, culling still goes by the stored normal.
+		 * Shadow rays (ignoreHitRecord) cull the opposite side, so a culled face does not cast a shadow either.
+		 * \param t distance along the ray, only written on a hit
+		 * \param isFrontFacing whether the ray hits the side the normal points to, only written on a hit
+		 */
+		inline bool HitTest_Triangle(const float (&v0)[3], const float (&edge1)[3], const float (&edge2)[3], const float (&normal)[3],
+			TriangleCullMode cullMode, const Ray& ray, bool ignoreHitRecord, float& t, bool& isFrontFacing)
 		{
-			float normalDotRayDir = Vector3::Dot(triangle.normal, ray.direction);
+			const float origin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+			const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+
+			const float normalDotRayDir{ normal[0] * direction[0] + normal[1] * direction[1] + normal[2] * direction[2] };
 
-			bool isFrontFacing = normalDotRayDir < 0;
-			switch (triangle.cullMode)
+			const bool isFront{ normalDotRayDir < 0 };
+			switch (cullMode)
 			{
 			case TriangleCullMode::FrontFaceCulling:
-				if (isFrontFacing == !ignoreHitRecord) return false;
+				if (isFront == !ignoreHitRecord) return false;
 				break;
 			case TriangleCullMode::BackFaceCulling:
-				if (isFrontFacing == ignoreHitRecord) return false;
+				if (isFront == ignoreHitRecord) return false;
 				break;
 			case TriangleCullMode::NoCulling:
 			default:
@@ -106,40 +151,307 @@ namespace dae
 
 			if (std::abs(normalDotRayDir) < FLT_EPSILON) return false;
 
-			float d = Vector3::Dot(triangle.normal, triangle.v0);
-			float t = (d - Vector3::Dot(triangle.normal, ray.origin)) / normalDotRayDir;
-			if (t < ray.min || t > ray.max) return false;
+			const float p[3]{
+				direction[1] * edge2[2] - direction[2] * edge2[1],
+				direction[2] * edge2[0] - direction[0] * edge2[2],
+				direction[0] * edge2[1] - direction[1] * edge2[0] };
+			const float determinant{ edge1[0] * p[0] + edge1[1] * p[1] + edge1[2] * p[2] };
+			if (determinant == 0.f) return false;
+			const float inverseDeterminant{ 1.f / determinant };
+
+			//Barycentrics of the hit point, points on an edge count as inside
+			const float s[3]{ origin[0] - v0[0], origin[1] - v0[1], origin[2] - v0[2] };
+			const float u{ (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant };
+			if (u < 0.f || u > 1.f) return false;
+
+			const float q[3]{
+				s[1] * edge1[2] - s[2] * edge1[1],
+				s[2] * edge1[0] - s[0] * edge1[2],
+				s[0] * edge1[1] - s[1] * edge1[0] };
+			const float v{ (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inverseDeterminant };
+			if (v < 0.f || u + v > 1.f) return false;
 
-			Vector3 hitPoint = ray.origin + t * ray.direction;
+			const float distance{ (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) * inverseDeterminant };
+			if (distance < ray.min || distance > ray.max) return false;
 
-			Vector3 edge0 = triangle.v1 - triangle.v0;
-			Vector3 edge1 = triangle.v2 - triangle.v1;
-			Vector3 edge2 = triangle.v0 - triangle.v2;
+			t = distance;
+			isFrontFacing = isFront;
+			return true;
+		}
+
+		inline void FillTriangleHitRecord(float t, const Vector3& normal, bool isFrontFacing, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord)
+		{
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			hitRecord.materialIndex = materialIndex;
+			hitRecord.origin = ray.origin + t * ray.direction;
+			hitRecord.normal = isFrontFacing ? normal : -normal;
+		}
 
-			Vector3 C0 = hitPoint - triangle.v0;
-			Vector3 C1 = hitPoint - triangle.v1;
-			Vector3 C2 = hitPoint - triangle.v2;
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const float v0[3]{ triangle.v0.x, triangle.v0.y, triangle.v0.z };
+			const float edge1[3]{ triangle.v1.x - triangle.v0.x, triangle.v1.y - triangle.v0.y, triangle.v1.z - triangle.v0.z };
+			const float edge2[3]{ triangle.v2.x - triangle.v0.x, triangle.v2.y - triangle.v0.y, triangle.v2.z - triangle.v0.z };
+			const float normal[3]{ triangle.normal.x, triangle.normal.y, triangle.normal.z };
 
-			if (Vector3::Dot(triangle.normal, Vector3::Cross(edge0, C0)) < 0) return false;
-			if (Vector3::Dot(triangle.normal, Vector3::Cross(edge1, C1)) < 0) return false;
-			if (Vector3::Dot(triangle.normal, Vector3::Cross(edge2, C2)) < 0) return false;
+			float t;
+			bool isFrontFacing;
+			if (!HitTest_Triangle(v0, edge1, edge2, normal, triangle.cullMode, ray, ignoreHitRecord, t, isFrontFacing)) return false;
 
 			if (!ignoreHitRecord)
-			{
-				hitRecord.didHit = true;
-				hitRecord.t = t; 
-				hitRecord.materialIndex = triangle.materialIndex;
-				hitRecord.origin = hitPoint;
-				hitRecord.normal = isFrontFacing ? triangle.normal : -triangle.normal;
-			}
+				FillTriangleHitRecord(t, triangle.normal, isFrontFacing, triangle.materialIndex, ray, hitRecord);
+			return true;
+		}
+
+		//Reads triangle triangleIndex straight from the precomputed arrays of its mesh
+		inline bool HitTest_Triangle(const PrecomputedTriangles& triangles, uint32_t triangleIndex, TriangleCullMode cullMode, unsigned char materialIndex,
+			const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			const float v0[3]{ triangles.v0[0][triangleIndex], triangles.v0[1][triangleIndex], triangles.v0[2][triangleIndex] };
+			const float edge1[3]{ triangles.edge1[0][triangleIndex], triangles.edge1[1][triangleIndex], triangles.edge1[2][triangleIndex] };
+			const float edge2[3]{ triangles.edge2[0][triangleIndex], triangles.edge2[1][triangleIndex], triangles.edge2[2][triangleIndex] };
+			const float normal[3]{ triangles.normal[0][triangleIndex], triangles.normal[1][triangleIndex], triangles.normal[2][triangleIndex] };
+
+			float t;
+			bool isFrontFacing;
+			if (!HitTest_Triangle(v0, edge1, edge2, normal, cullMode, ray, ignoreHitRecord, t, isFrontFacing)) return false;
 
+			if (!ignoreHitRecord)
+				FillTriangleHitRecord(t, { normal[0], normal[1], normal[2] }, isFrontFacing, materialIndex, ray, hitRecord);
 			return true;
 		}
 
+		//Occlusion query, skips the hit record entirely
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			const float v0[3]{ triangle.v0.x, triangle.v0.y, triangle.v0.z };
+			const float edge1[3]{ triangle.v1.x - triangle.v0.x, triangle.v1.y - triangle.v0.y, triangle.v1.z - triangle.v0.z };
+			const float edge2[3]{ triangle.v2.x - triangle.v0.x, triangle.v2.y - triangle.v0.y, triangle.v2.z - triangle.v0.z };
+			const float normal[3]{ triangle.normal.x, triangle.normal.y, triangle.normal.z };
+
+			float t;
+			bool isFrontFacing;
+			return HitTest_Triangle(v0, edge1, edge2, normal, triangle.cullMode, ray, true, t, isFrontFacing);
+		}
+
+		inline bool HitTest_Triangle(const PrecomputedTriangles& triangles, uint32_t triangleIndex, TriangleCullMode cullMode, const Ray& ray)
+		{
+			const float v0[3]{ triangles.v0[0][triangleIndex], triangles.v0[1][triangleIndex], triangles.v0[2][triangleIndex] };
+			const float edge1[3]{ triangles.edge1[0][triangleIndex], triangles.edge1[1][triangleIndex], triangles.edge1[2][triangleIndex] };
+			const float edge2[3]{ triangles.edge2[0][triangleIndex], triangles.edge2[1][triangleIndex], triangles.edge2[2][triangleIndex] };
+			const float normal[3]{ triangles.normal[0][triangleIndex], triangles.normal[1][triangleIndex], triangles.normal[2][triangleIndex] };
+
+			float t;
+			bool isFrontFacing;
+			return HitTest_Triangle(v0, edge1, edge2, normal, cullMode, ray, true, t, isFrontFacing);
+		}
+#pragma endregion
+#pragma region Triangle SIMD HitTest
+		//Lane operations the wide triangle kernel is written against, one set per instruction set
+		struct SSETriangleLanes
+		{
+			static constexpr uint32_t Width{ 4 };
+			using Float = __m128;
+
+			static Float Set1(float value) { return _mm_set1_ps(value); }
+			static Float Load(const float* pValues) { return _mm_loadu_ps(pValues); }
+			static Float Gather(const float* pValues, const uint32_t (&indices)[Width])
+			{
+				return _mm_setr_ps(pValues[indices[0]], pValues[indices[1]], pValues[indices[2]], pValues[indices[3]]);
+			}
+
+			static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+			static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+			static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+			static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+			static Float Abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+
+			static Float Less(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+			static Float Greater(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+			static Float Equal(Float a, Float b) { return _mm_cmpeq_ps(a, b); }
+			static Float Or(Float a, Float b) { return _mm_or_ps(a, b); }
+			static Float AndNot(Float a, Float b) { return _mm_andnot_ps(a, b); }
+			static Float Zero() { return _mm_setzero_ps(); }
+			static Float AllSet() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+
+			static int MoveMask(Float a) { return _mm_movemask_ps(a); }
+			static void Store(float* pValues, Float a) { _mm_storeu_ps(pValues, a); }
+		};
+
+#ifdef __AVX2__
+		struct AVXTriangleLanes
+		{
+			static constexpr uint32_t Width{ 8 };
+			using Float = __m256;
+
+			static Float Set1(float value) { return _mm256_set1_ps(value); }
+			static Float Load(const float* pValues) { return _mm256_loadu_ps(pValues); }
+			static Float Gather(const float* pValues, const uint32_t (&indices)[Width])
+			{
+				return _mm256_i32gather_ps(pValues, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), 4);
+			}
+
+			static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+			static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+			static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+			static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+			static Float Abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+
+			static Float Less(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+			static Float Greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+			static Float Equal(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+			static Float Or(Float a, Float b) { return _mm256_or_ps(a, b); }
+			static Float AndNot(Float a, Float b) { return _mm256_andnot_ps(a, b); }
+			static Float Zero() { return _mm256_setzero_ps(); }
+			static Float AllSet() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+
+			static int MoveMask(Float a) { return _mm256_movemask_ps(a); }
+			static void Store(float* pValues, Float a) { _mm256_storeu_ps(pValues, a); }
+		};
+
+		using TriangleLanes = AVXTriangleLanes;
+#else
+		using TriangleLanes = SSETriangleLanes;
+#endif
+
+		/**
+		 * \brief Möller–Trumbore against up to Lanes::Width triangles of the precomputed arrays at once.
+		 * Every lane makes exactly the decisions of the scalar HitTest_Triangle, including the culling that flips for shadow rays.
+		 * \param pTriangleIndices triangleCount indices, 1 to Lanes::Width of them
+		 * \param distance hit distance per lane
+		 * \param isFront per lane, whether the ray comes from the side the normal points to
+		 * \return mask of the lanes with a valid hit
+		 */
+		template<typename Lanes>
+		inline int IntersectTriangleLanes(const PrecomputedTriangles& triangles, const uint32_t* pTriangleIndices, uint32_t triangleCount,
+			TriangleCullMode cullMode, const Ray& ray, bool ignoreHitRecord, typename Lanes::Float& distance, typename Lanes::Float& isFront)
+		{
+			using Float = typename Lanes::Float;
+			constexpr uint32_t width{ Lanes::Width };
+
+			//Triangles sorted into leaf order come in one contiguous run and are loaded directly, the padding of the arrays
+			//covers the lanes past the end, everything else is gathered with unused lanes repeating the first triangle
+			bool isContiguous{ true };
+			for (uint32_t lane{ 1 }; lane < triangleCount; ++lane)
+			{
+				isContiguous = isContiguous && pTriangleIndices[lane] == pTriangleIndices[0] + lane;
+			}
+
+			uint32_t indices[width];
+			if (!isContiguous)
+			{
+				for (uint32_t lane{ 0 }; lane < width; ++lane)
+				{
+					indices[lane] = lane < triangleCount ? pTriangleIndices[lane] : pTriangleIndices[0];
+				}
+			}
+
+			const auto load = [&](const std::vector<float>& values)
+				{
+					return isContiguous ? Lanes::Load(&values[pTriangleIndices[0]]) : Lanes::Gather(values.data(), indices);
+				};
+
+			const Float v0[3]{ load(triangles.v0[0]), load(triangles.v0[1]), load(triangles.v0[2]) };
+			const Float edge1[3]{ load(triangles.edge1[0]), load(triangles.edge1[1]), load(triangles.edge1[2]) };
+			const Float edge2[3]{ load(triangles.edge2[0]), load(triangles.edge2[1]), load(triangles.edge2[2]) };
+			const Float normal[3]{ load(triangles.normal[0]), load(triangles.normal[1]), load(triangles.normal[2]) };
+
+			const Float origin[3]{ Lanes::Set1(ray.origin.x), Lanes::Set1(ray.origin.y), Lanes::Set1(ray.origin.z) };
+			const Float direction[3]{ Lanes::Set1(ray.direction.x), Lanes::Set1(ray.direction.y), Lanes::Set1(ray.direction.z) };
+
+			const auto dot = [](const Float (&a)[3], const Float (&b)[3])
+				{
+					return Lanes::Add(Lanes::Add(Lanes::Mul(a[0], b[0]), Lanes::Mul(a[1], b[1])), Lanes::Mul(a[2], b[2]));
+				};
+			const auto cross = [](const Float (&a)[3], const Float (&b)[3], Float (&result)[3])
+				{
+					result[0] = Lanes::Sub(Lanes::Mul(a[1], b[2]), Lanes::Mul(a[2], b[1]));
+					result[1] = Lanes::Sub(Lanes::Mul(a[2], b[0]), Lanes::Mul(a[0], b[2]));
+					result[2] = Lanes::Sub(Lanes::Mul(a[0], b[1]), Lanes::Mul(a[1], b[0]));
+				};
+
+			//Lanes are rejected with the same comparisons as the scalar test, so NaNs slip through exactly the same way
+			const Float normalDotRayDir{ dot(normal, direction) };
+			isFront = Lanes::Less(normalDotRayDir, Lanes::Zero());
+
+			Float rejected{ Lanes::Zero() };
+			switch (cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				rejected = ignoreHitRecord ? Lanes::AndNot(isFront, Lanes::AllSet()) : isFront;
+				break;
+			case TriangleCullMode::BackFaceCulling:
+				rejected = ignoreHitRecord ? isFront : Lanes::AndNot(isFront, Lanes::AllSet());
+				break;
+			case TriangleCullMode::NoCulling:
+			default:
+				break;
+			}
+
+			rejected = Lanes::Or(rejected, Lanes::Less(Lanes::Abs(normalDotRayDir), Lanes::Set1(FLT_EPSILON)));
+
+			Float p[3];
+			cross(direction, edge2, p);
+			const Float determinant{ dot(edge1, p) };
+			rejected = Lanes::Or(rejected, Lanes::Equal(determinant, Lanes::Zero()));
+			const Float inverseDeterminant{ Lanes::Div(Lanes::Set1(1.f), determinant) };
+
+			const Float offset[3]{ Lanes::Sub(origin[0], v0[0]), Lanes::Sub(origin[1], v0[1]), Lanes::Sub(origin[2], v0[2]) };
+			const Float u{ Lanes::Mul(dot(offset, p), inverseDeterminant) };
+			rejected = Lanes::Or(rejected, Lanes::Or(Lanes::Less(u, Lanes::Zero()), Lanes::Greater(u, Lanes::Set1(1.f))));
+
+			Float q[3];
+			cross(offset, edge1, q);
+			const Float v{ Lanes::Mul(dot(direction, q), inverseDeterminant) };
+			rejected = Lanes::Or(rejected, Lanes::Or(Lanes::Less(v, Lanes::Zero()), Lanes::Greater(Lanes::Add(u, v), Lanes::Set1(1.f))));
+
+			distance = Lanes::Mul(dot(edge2, q), inverseDeterminant);
+			rejected = Lanes::Or(rejected, Lanes::Or(Lanes::Less(distance, Lanes::Set1(ray.min)), Lanes::Greater(distance, Lanes::Set1(ray.max))));
+
+			return ~Lanes::MoveMask(rejected) & ((1 << triangleCount) - 1);
+		}
+
+		/**
+		 * \brief Closest hit among up to Lanes::Width triangles of the precomputed arrays, see IntersectTriangleLanes
+		 * \param t distance of the closest hit, only written on a hit
+		 * \param isFrontFacing whether the closest hit is on the side the normal points to, only written on a hit
+		 * \return lane of the closest hit (the last one on a tie, like a scalar loop shortening the ray), -1 on a miss
+		 */
+		template<typename Lanes>
+		inline int HitTest_Triangles(const PrecomputedTriangles& triangles, const uint32_t* pTriangleIndices, uint32_t triangleCount,
+			TriangleCullMode cullMode, const Ray& ray, bool ignoreHitRecord, float& t, bool& isFrontFacing)
+		{
+			typename Lanes::Float distance, isFront;
+			int hitMask{ IntersectTriangleLanes<Lanes>(triangles, pTriangleIndices, triangleCount, cullMode, ray, ignoreHitRecord, distance, isFront) };
+			if (hitMask == 0) return -1;
+
+			constexpr uint32_t width{ Lanes::Width };
+
+			float distances[width];
+			Lanes::Store(distances, distance);
+
+			int closestLane{ -1 };
+			while (hitMask)
+			{
+				const int lane{ std::countr_zero(static_cast<uint32_t>(hitMask)) };
+				hitMask &= hitMask - 1;
+				if (closestLane < 0 || distances[lane] <= distances[closestLane]) closestLane = lane;
+			}
+
+			t = distances[closestLane];
+			isFrontFacing = (Lanes::MoveMask(isFront) >> closestLane) & 1;
+			return closestLane;
+		}
+
+		//Occlusion query with the culling of shadow rays, returns the lane of a triangle blocking the ray without picking the closest one, -1 when none does
+		template<typename Lanes>
+		inline int HitTest_Triangles(const PrecomputedTriangles& triangles, const uint32_t* pTriangleIndices, uint32_t triangleCount,
+			TriangleCullMode cullMode, const Ray& ray)
+		{
+			typename Lanes::Float distance, isFront;
+			const int hitMask{ IntersectTriangleLanes<Lanes>(triangles, pTriangleIndices, triangleCount, cullMode, ray, true, distance, isFront) };
+			return hitMask == 0 ? -1 : std::countr_zero(static_cast<uint32_t>(hitMask));
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
@@ -168,6 +480,528 @@ namespace dae
 			return tmax > 0 && tmax >= tmin;
 		}
 
+		//Returns the entry distance of the ray into the node, FLT_MAX when the node is missed
+		inline float SlabTest_BVHNode(const BVHNode& node, const Ray& ray, const Vector3& invDirection)
+		{
+			float tx1 = (node.minAABB.x - ray.origin.x) * invDirection.x;
+			float tx2 = (node.maxAABB.x - ray.origin.x) * invDirection.x;
+
+			float tmin = std::min(tx1, tx2);
+			float tmax = std::max(tx1, tx2);
+
+			float ty1 = (node.minAABB.y - ray.origin.y) * invDirection.y;
+			float ty2 = (node.maxAABB.y - ray.origin.y) * invDirection.y;
+
+			tmin = std::max(tmin, std::min(ty1, ty2));
+			tmax = std::min(tmax, std::max(ty1, ty2));
+
+			float tz1 = (node.minAABB.z - ray.origin.z) * invDirection.z;
+			float tz2 = (node.maxAABB.z - ray.origin.z) * invDirection.z;
+
+			tmin = std::max(tmin, std::min(tz1, tz2));
+			tmax = std::min(tmax, std::max(tz1, tz2));
+
+			if (tmax >= tmin && tmax > ray.min && tmin < ray.max) return tmin;
+			return FLT_MAX;
+		}
+
+		//Hands a leaf to primitiveTest in one call when it takes whole leaves, one primitive at a time otherwise
+		template<typename PrimitiveTest>
+		inline bool TestLeafPrimitives(PrimitiveTest& primitiveTest, const uint32_t* pPrimitiveIndices, uint32_t primitiveCount)
+		{
+			if constexpr (std::is_invocable_r_v<bool, PrimitiveTest&, const uint32_t*, uint32_t>)
+			{
+				return primitiveTest(pPrimitiveIndices, primitiveCount);
+			}
+			else
+			{
+				for (uint32_t i{ 0 }; i < primitiveCount; ++i)
+				{
+					if (primitiveTest(pPrimitiveIndices[i])) return true;
+				}
+				return false;
+			}
+		}
+
+		/**
+		 * \brief Walks the subtree below rootIndex front-to-back along the ray
+		 * \param bvh hierarchy to traverse
+		 * \param rootIndex node to start at, 0 for the whole hierarchy
+		 * \param ray ray to traverse with, primitiveTest may shorten ray.max to cull farther nodes
+		 * \param primitiveTest callable bool(uint32_t primitiveIndex) or bool(const uint32_t* primitiveIndices, uint32_t count)
+		 * for whole leaves, returning true stops the traversal
+		 * \param pStats optional counters for the node and primitive tests of this traversal
+		 * \return true when primitiveTest stopped the traversal
+		 */
+		template<typename PrimitiveTest>
+		inline bool TraverseBVHSubtree(const BVH& bvh, uint32_t rootIndex, const Ray& ray, PrimitiveTest&& primitiveTest, TraversalStats* pStats = nullptr)
+		{
+			if (bvh.nodes.empty()) return false;
+
+			const std::vector<BVHNode>& nodes = bvh.nodes;
+			const Vector3 invDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+
+			if (pStats)
+			{
+				++pStats->nodeTests;
+				if (pStats->pTestedNodes) pStats->pTestedNodes->push_back(rootIndex);
+			}
+			if (SlabTest_BVHNode(nodes[rootIndex], ray, invDirection) == FLT_MAX) return false;
+
+			uint32_t nodeStack[64];
+			int stackSize{ 0 };
+			const BVHNode* pNode = &nodes[rootIndex];
+
+			while (true)
+			{
+				if (pNode->IsLeaf())
+				{
+					if (pStats) pStats->primitiveTests += pNode->primitiveCount;
+					if (TestLeafPrimitives(primitiveTest, &bvh.primitiveIndices[pNode->leftFirst], pNode->primitiveCount)) return true;
+
+					if (stackSize == 0) break;
+					pNode = &nodes[nodeStack[--stackSize]];
+					continue;
+				}
+
+				//Visit the nearest child first, the other one is pushed on the stack
+				uint32_t nearIndex = pNode->leftFirst;
+				uint32_t farIndex = pNode->leftFirst + 1;
+				float nearDistance = SlabTest_BVHNode(nodes[nearIndex], ray, invDirection);
+				float farDistance = SlabTest_BVHNode(nodes[farIndex], ray, invDirection);
+				if (pStats)
+				{
+					pStats->nodeTests += 2;
+					if (pStats->pTestedNodes) pStats->pTestedNodes->insert(pStats->pTestedNodes->end(), { nearIndex, farIndex });
+				}
+
+				if (nearDistance > farDistance)
+				{
+					std::swap(nearIndex, farIndex);
+					std::swap(nearDistance, farDistance);
+				}
+
+				if (nearDistance == FLT_MAX)
+				{
+					if (stackSize == 0) break;
+					pNode = &nodes[nodeStack[--stackSize]];
+				}
+				else
+				{
+					pNode = &nodes[nearIndex];
+					if (farDistance != FLT_MAX) nodeStack[stackSize++] = farIndex;
+				}
+			}
+
+			return false;
+		}
+
+		//Walks the whole BVH front-to-back along the ray, see TraverseBVHSubtree
+		template<typename PrimitiveTest>
+		inline bool TraverseBVH(const BVH& bvh, const Ray& ray, PrimitiveTest&& primitiveTest, TraversalStats* pStats = nullptr)
+		{
+			return TraverseBVHSubtree(bvh, 0, ray, primitiveTest, pStats);
+		}
+
+		//Mask of the rays in rayMask that enter the node before their max, with the checks of the single ray slab test, 4 rays per SSE test
+		inline uint64_t SlabTest_BVHNode(const BVHNode& node, const RayPacket& packet, uint64_t rayMask)
+		{
+			const __m128 minX = _mm_set1_ps(node.minAABB.x);
+			const __m128 minY = _mm_set1_ps(node.minAABB.y);
+			const __m128 minZ = _mm_set1_ps(node.minAABB.z);
+			const __m128 maxX = _mm_set1_ps(node.maxAABB.x);
+			const __m128 maxY = _mm_set1_ps(node.maxAABB.y);
+			const __m128 maxZ = _mm_set1_ps(node.maxAABB.z);
+
+			uint64_t hitMask{ 0 };
+			for (uint32_t first{ 0 }; first < packet.size; first += 4)
+			{
+				const int groupMask{ static_cast<int>((rayMask >> first) & 0xF) };
+				if (groupMask == 0) continue;
+
+				const __m128 originX = _mm_load_ps(&packet.origin[0][first]);
+				const __m128 originY = _mm_load_ps(&packet.origin[1][first]);
+				const __m128 originZ = _mm_load_ps(&packet.origin[2][first]);
+				const __m128 invDirectionX = _mm_load_ps(&packet.invDirection[0][first]);
+				const __m128 invDirectionY = _mm_load_ps(&packet.invDirection[1][first]);
+				const __m128 invDirectionZ = _mm_load_ps(&packet.invDirection[2][first]);
+
+				const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(minX, originX), invDirectionX);
+				const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(maxX, originX), invDirectionX);
+				const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(minY, originY), invDirectionY);
+				const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(maxY, originY), invDirectionY);
+				const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(minZ, originZ), invDirectionZ);
+				const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(maxZ, originZ), invDirectionZ);
+
+				const __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+				const __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+
+				__m128 isHit = _mm_cmpge_ps(tmax, tmin);
+				isHit = _mm_and_ps(isHit, _mm_cmpgt_ps(tmax, _mm_load_ps(&packet.min[first])));
+				isHit = _mm_and_ps(isHit, _mm_cmplt_ps(tmin, _mm_load_ps(&packet.max[first])));
+
+				hitMask |= static_cast<uint64_t>(_mm_movemask_ps(isHit) & groupMask) << first;
+			}
+			return hitMask;
+		}
+
+		/**
+		 * \brief Walks the BVH with a whole packet of coherent rays. Every node is slab tested against the active rays at once
+		 * and only the rays entering it go on to its children. Subtrees entered by too few rays to keep the SIMD lanes busy
+		 * are finished one ray at a time with TraverseBVHSubtree.
+		 * \param packet rays to traverse with, primitiveTest may shorten packet.max to cull farther nodes
+		 * \param rayMask rays of the packet to traverse
+		 * \param primitiveTest callable void(const uint32_t* primitiveIndices, uint32_t count, uint64_t rayMask),
+		 * testing a leaf against the rays of rayMask, all of which enter the leaf
+		 */
+		template<typename PrimitiveTest>
+		inline void TraversePacketBVH(const BVH& bvh, RayPacket& packet, uint64_t rayMask, PrimitiveTest&& primitiveTest)
+		{
+			if (bvh.nodes.empty() || rayMask == 0) return;
+
+			const std::vector<BVHNode>& nodes = bvh.nodes;
+			const int minActiveRays{ std::max(2, static_cast<int>(packet.size / 4)) };
+
+			const auto traverseSingleRays = [&](uint32_t rootIndex, uint64_t singleRayMask)
+				{
+					while (singleRayMask)
+					{
+						const uint32_t rayIndex{ static_cast<uint32_t>(std::countr_zero(singleRayMask)) };
+						const uint64_t rayBit{ uint64_t{ 1 } << rayIndex };
+						singleRayMask &= singleRayMask - 1;
+
+						Ray ray{ packet.GetRay(rayIndex) };
+						TraverseBVHSubtree(bvh, rootIndex, ray, [&](const uint32_t* pPrimitiveIndices, uint32_t primitiveCount)
+							{
+								primitiveTest(pPrimitiveIndices, primitiveCount, rayBit);
+								ray.max = packet.max[rayIndex];
+								return false;
+							});
+					}
+				};
+
+			//Nodes are tested when they are popped, so hits found in the meantime already cull them
+			struct StackEntry
+			{
+				uint32_t index;
+				uint64_t rayMask;
+			};
+
+			StackEntry stack[64];
+			int stackSize{ 0 };
+			stack[stackSize++] = { 0, rayMask };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry = stack[--stackSize];
+				const BVHNode& node = nodes[entry.index];
+
+				const uint64_t activeMask{ SlabTest_BVHNode(node, packet, entry.rayMask) };
+				if (activeMask == 0) continue;
+
+				if (std::popcount(activeMask) < minActiveRays)
+				{
+					traverseSingleRays(entry.index, activeMask);
+					continue;
+				}
+
+				if (node.IsLeaf())
+				{
+					primitiveTest(&bvh.primitiveIndices[node.leftFirst], node.primitiveCount, activeMask);
+					continue;
+				}
+
+				//The children are ordered for the first active ray, along the axis that separates them most
+				const BVHNode& left = nodes[node.leftFirst];
+				const BVHNode& right = nodes[node.leftFirst + 1];
+				const float separation[3]{
+					right.minAABB.x + right.maxAABB.x - left.minAABB.x - left.maxAABB.x,
+					right.minAABB.y + right.maxAABB.y - left.minAABB.y - left.maxAABB.y,
+					right.minAABB.z + right.maxAABB.z - left.minAABB.z - left.maxAABB.z };
+
+				int axis{ 0 };
+				if (std::abs(separation[1]) > std::abs(separation[axis])) axis = 1;
+				if (std::abs(separation[2]) > std::abs(separation[axis])) axis = 2;
+
+				const uint32_t firstRay{ static_cast<uint32_t>(std::countr_zero(activeMask)) };
+				const bool isLeftNear{ separation[axis] * packet.direction[axis][firstRay] >= 0.f };
+
+				stack[stackSize++] = { isLeftNear ? node.leftFirst + 1 : node.leftFirst, activeMask };
+				stack[stackSize++] = { isLeftNear ? node.leftFirst : node.leftFirst + 1, activeMask };
+			}
+		}
+
+		//Child bounds of a wide node as minX, minY, minZ, maxX, maxY, maxZ, one child per lane
+		inline void LoadChildBounds(const WideBVHNode& node, __m128 (&bounds)[6])
+		{
+			bounds[0] = _mm_load_ps(node.minX);
+			bounds[1] = _mm_load_ps(node.minY);
+			bounds[2] = _mm_load_ps(node.minZ);
+			bounds[3] = _mm_load_ps(node.maxX);
+			bounds[4] = _mm_load_ps(node.maxY);
+			bounds[5] = _mm_load_ps(node.maxZ);
+		}
+
+		inline void LoadChildBounds(const CompressedWideBVHNode& node, __m128 (&bounds)[6])
+		{
+			const auto dequantize = [&node](const uint8_t* pCells, int axis)
+				{
+					int32_t packedCells;
+					std::memcpy(&packedCells, pCells, sizeof(packedCells));
+
+					const __m128i zero = _mm_setzero_si128();
+					const __m128i cells = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedCells), zero), zero);
+					const float cellSize{ std::bit_cast<float>(static_cast<uint32_t>(node.exponents[axis] + 127) << 23) };
+					return _mm_add_ps(_mm_set1_ps(node.origin[axis]), _mm_mul_ps(_mm_cvtepi32_ps(cells), _mm_set1_ps(cellSize)));
+				};
+
+			bounds[0] = dequantize(node.minX, 0);
+			bounds[1] = dequantize(node.minY, 1);
+			bounds[2] = dequantize(node.minZ, 2);
+			bounds[3] = dequantize(node.maxX, 0);
+			bounds[4] = dequantize(node.maxY, 1);
+			bounds[5] = dequantize(node.maxZ, 2);
+
+			//Unused slots get infinite bounds on one axis, which the slab test always rejects
+			static const __m128 laneIndices = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+			const __m128 isUnused = _mm_cmpge_ps(laneIndices, _mm_set1_ps(node.childCount));
+			bounds[0] = _mm_or_ps(_mm_andnot_ps(isUnused, bounds[0]), _mm_and_ps(isUnused, _mm_set1_ps(INFINITY)));
+			bounds[3] = _mm_or_ps(_mm_andnot_ps(isUnused, bounds[3]), _mm_and_ps(isUnused, _mm_set1_ps(INFINITY)));
+		}
+
+		/**
+		 * \brief Walks a 4-wide BVH along the ray, testing all children of a node with one SSE slab test
+		 * and visiting the hit children front-to-back
+		 * \param nodes nodes of a WideBVH or CompressedWideBVH
+		 * \param bvh binary BVH the wide BVH was collapsed from, owner of the primitive indices
+		 * \param ray ray to traverse with, primitiveTest may shorten ray.max to cull farther nodes
+		 * \param primitiveTest callable bool(uint32_t primitiveIndex) or bool(const uint32_t* primitiveIndices, uint32_t count)
+		 * for whole leaves, returning true stops the traversal
+		 * \param isOcclusion visit the children the ray crosses longest first instead of front-to-back,
+		 * for queries that stop at any hit, where those are the likeliest to hold one
+		 * \return true when primitiveTest stopped the traversal
+		 */
+		template<typename WideNode, typename PrimitiveTest>
+		inline bool TraverseWideNodes(const std::vector<WideNode>& nodes, const BVH& bvh, const Ray& ray, PrimitiveTest&& primitiveTest, bool isOcclusion = false)
+		{
+			if (nodes.empty()) return false;
+
+			const __m128 originX = _mm_set1_ps(ray.origin.x);
+			const __m128 originY = _mm_set1_ps(ray.origin.y);
+			const __m128 originZ = _mm_set1_ps(ray.origin.z);
+			const __m128 invDirectionX = _mm_set1_ps(1.f / ray.direction.x);
+			const __m128 invDirectionY = _mm_set1_ps(1.f / ray.direction.y);
+			const __m128 invDirectionZ = _mm_set1_ps(1.f / ray.direction.z);
+			const __m128 rayMin = _mm_set1_ps(ray.min);
+
+			//Leaf children go on the stack too, so primitives are tested in front-to-back order as well
+			struct StackEntry
+			{
+				uint32_t index;
+				uint32_t primitiveCount;
+				float distance;
+			};
+
+			StackEntry stack[256];
+			int stackSize{ 0 };
+			stack[stackSize++] = { 0, 0, ray.min };
+
+			while (stackSize > 0)
+			{
+				const StackEntry entry = stack[--stackSize];
+
+				//A closer hit was found after this entry was pushed
+				if (entry.distance > ray.max) continue;
+
+				if (entry.primitiveCount > 0)
+				{
+					if (TestLeafPrimitives(primitiveTest, &bvh.primitiveIndices[entry.index], entry.primitiveCount)) return true;
+					continue;
+				}
+
+				const WideNode& node = nodes[entry.index];
+
+				__m128 bounds[6];
+				LoadChildBounds(node, bounds);
+
+				const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(bounds[0], originX), invDirectionX);
+				const __m128 tx2 = _mm_mul_ps(_mm_sub_ps(bounds[3], originX), invDirectionX);
+				const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(bounds[1], originY), invDirectionY);
+				const __m128 ty2 = _mm_mul_ps(_mm_sub_ps(bounds[4], originY), invDirectionY);
+				const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(bounds[2], originZ), invDirectionZ);
+				const __m128 tz2 = _mm_mul_ps(_mm_sub_ps(bounds[5], originZ), invDirectionZ);
+
+				__m128 tmin = _mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2));
+				tmin = _mm_max_ps(tmin, _mm_min_ps(tz1, tz2));
+				tmin = _mm_max_ps(tmin, rayMin);
+
+				__m128 tmax = _mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2));
+				tmax = _mm_min_ps(tmax, _mm_max_ps(tz1, tz2));
+				tmax = _mm_min_ps(tmax, _mm_set1_ps(ray.max));
+
+				int hitMask = _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+				if (hitMask == 0) continue;
+
+				alignas(16) float distances[WideBVHNode::Width];
+				_mm_store_ps(distances, tmin);
+
+				//Occlusion queries sort on the negated length of the ray inside each child
+				alignas(16) float keys[WideBVHNode::Width];
+				_mm_store_ps(keys, isOcclusion ? _mm_sub_ps(tmin, tmax) : tmin);
+
+				//Sort the hit children on their key from high to low, so the lowest one ends up on top of the stack
+				int order[WideBVHNode::Width];
+				int hitCount{ 0 };
+				while (hitMask)
+				{
+					const int child{ hitMask & 1 ? 0 : hitMask & 2 ? 1 : hitMask & 4 ? 2 : 3 };
+					hitMask &= hitMask - 1;
+
+					int slot{ hitCount++ };
+					while (slot > 0 && keys[order[slot - 1]] < keys[child])
+					{
+						order[slot] = order[slot - 1];
+						--slot;
+					}
+					order[slot] = child;
+				}
+
+				for (int i{ 0 }; i < hitCount; ++i)
+				{
+					const int child{ order[i] };
+					stack[stackSize++] = { node.children[child], node.primitiveCounts[child], distances[child] };
+				}
+			}
+
+			return false;
+		}
+
+		template<typename PrimitiveTest>
+		inline bool TraverseWideBVH(const WideBVH& wideBvh, const BVH& bvh, const Ray& ray, PrimitiveTest&& primitiveTest, bool isOcclusion = false)
+		{
+			return TraverseWideNodes(wideBvh.nodes, bvh, ray, primitiveTest, isOcclusion);
+		}
+
+		template<typename PrimitiveTest>
+		inline bool TraverseCompressedBVH(const CompressedWideBVH& compressedBvh, const BVH& bvh, const Ray& ray, PrimitiveTest&& primitiveTest, bool isOcclusion = false)
+		{
+			return TraverseWideNodes(compressedBvh.nodes, bvh, ray, primitiveTest, isOcclusion);
+		}
+
+		/**
+		 * \brief 3D-DDA over one level of a grid, visits the cells the ray crosses between tStart and tEnd in order
+		 * \param visitCell callable bool(const int (&cell)[3], float tCellStart, float tCellEnd), returning true stops the walk
+		 */
+		template<typename CellVisitor>
+		inline void WalkGridCells(const float (&gridMin)[3], const float (&cellSize)[3], const int (&resolution)[3],
+			const float (&origin)[3], const float (&direction)[3], const float (&invDirection)[3], float tStart, float tEnd, CellVisitor&& visitCell)
+		{
+			int cell[3], step[3];
+			float tNext[3], tDelta[3];
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				const float entry{ origin[axis] + direction[axis] * tStart };
+				cell[axis] = std::clamp(static_cast<int>((entry - gridMin[axis]) / cellSize[axis]), 0, resolution[axis] - 1);
+
+				if (direction[axis] > 0.f)
+				{
+					step[axis] = 1;
+					tNext[axis] = (gridMin[axis] + (cell[axis] + 1) * cellSize[axis] - origin[axis]) * invDirection[axis];
+					tDelta[axis] = cellSize[axis] * invDirection[axis];
+				}
+				else if (direction[axis] < 0.f)
+				{
+					step[axis] = -1;
+					tNext[axis] = (gridMin[axis] + cell[axis] * cellSize[axis] - origin[axis]) * invDirection[axis];
+					tDelta[axis] = -cellSize[axis] * invDirection[axis];
+				}
+				else
+				{
+					step[axis] = 0;
+					tNext[axis] = INFINITY;
+					tDelta[axis] = INFINITY;
+				}
+			}
+
+			while (true)
+			{
+				//Step across the nearest cell border
+				const int axis{ tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2) };
+				if (visitCell(cell, tStart, std::min(tNext[axis], tEnd))) return;
+				if (tNext[axis] >= tEnd) return;
+
+				cell[axis] += step[axis];
+				if (cell[axis] < 0 || cell[axis] >= resolution[axis]) return;
+
+				tStart = tNext[axis];
+				tNext[axis] += tDelta[axis];
+			}
+		}
+
+		/**
+		 * \brief Walks the top-level cells of the grid front-to-back along the ray, and the leaf cells inside every occupied one.
+		 * Shortening ray.max from primitiveTest ends the walk once no cell further along can hold a closer hit.
+		 * \param primitiveTest callable bool(uint32_t primitiveIndex), returning true stops the traversal
+		 * \return true when primitiveTest stopped the traversal
+		 */
+		template<typename PrimitiveTest>
+		inline bool TraverseGrid(const TwoLevelGrid& grid, const Ray& ray, PrimitiveTest&& primitiveTest)
+		{
+			if (grid.cells.empty()) return false;
+
+			const float origin[3]{ ray.origin.x, ray.origin.y, ray.origin.z };
+			const float direction[3]{ ray.direction.x, ray.direction.y, ray.direction.z };
+			const float invDirection[3]{ 1.f / direction[0], 1.f / direction[1], 1.f / direction[2] };
+			const float gridMin[3]{ grid.bounds.min.x, grid.bounds.min.y, grid.bounds.min.z };
+			const float gridMax[3]{ grid.bounds.max.x, grid.bounds.max.y, grid.bounds.max.z };
+			const float cellSize[3]{ grid.cellSize.x, grid.cellSize.y, grid.cellSize.z };
+
+			//Part of the ray inside the grid
+			float tStart{ ray.min }, tEnd{ ray.max };
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				const float t1{ (gridMin[axis] - origin[axis]) * invDirection[axis] };
+				const float t2{ (gridMax[axis] - origin[axis]) * invDirection[axis] };
+				tStart = std::max(tStart, std::min(t1, t2));
+				tEnd = std::min(tEnd, std::max(t1, t2));
+			}
+			if (tStart > tEnd) return false;
+
+			bool isStopped{ false };
+			WalkGridCells(gridMin, cellSize, grid.resolution, origin, direction, invDirection, tStart, tEnd,
+				[&](const int (&cellCoordinates)[3], float tCellStart, float tCellEnd)
+				{
+					const GridCell& cell = grid.cells[(cellCoordinates[2] * grid.resolution[1] + cellCoordinates[1]) * grid.resolution[0] + cellCoordinates[0]];
+					if (cell.resolution[0] == 0) return false;
+
+					const int leafResolution[3]{ cell.resolution[0], cell.resolution[1], cell.resolution[2] };
+					const float leafSize[3]{ cellSize[0] / leafResolution[0], cellSize[1] / leafResolution[1], cellSize[2] / leafResolution[2] };
+					const float cellMin[3]{
+						gridMin[0] + cellCoordinates[0] * cellSize[0], gridMin[1] + cellCoordinates[1] * cellSize[1], gridMin[2] + cellCoordinates[2] * cellSize[2] };
+
+					bool isDone{ false };
+					WalkGridCells(cellMin, leafSize, leafResolution, origin, direction, invDirection, tCellStart, tCellEnd,
+						[&](const int (&leafCoordinates)[3], float, float tLeafEnd)
+						{
+							const uint32_t leafIndex{ static_cast<uint32_t>((leafCoordinates[2] * leafResolution[1] + leafCoordinates[1]) * leafResolution[0] + leafCoordinates[0]) };
+							const GridLeafCell& leafCell = grid.leafCells[cell.firstLeafCell + leafIndex];
+
+							for (uint32_t i{ 0 }; i < leafCell.count && !isStopped; ++i)
+							{
+								isStopped = primitiveTest(grid.primitiveIndices[leafCell.first + i]);
+							}
+
+							//A hit before the end of this cell cannot be beaten by the cells behind it
+							isDone = isStopped || ray.max <= tLeafEnd;
+							return isDone;
+						});
+
+					return isDone;
+				});
+
+			return isStopped;
+		}
+
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
 			if (!SlabTest_TriangleMesh(mesh, ray))
@@ -175,49 +1009,145 @@ namespace dae
 				return false;
 			}
 
+			//Every hit shortens the ray, so nodes behind the closest hit so far are skipped
+			Ray closestRay{ ray };
 			bool didHit = false;
-			float closestT = INFINITY;
 
-			for (size_t i{ 0 }; i < mesh.indices.size(); i += 3)
-			{
-				int index0 = mesh.indices[i];
-				int index1 = mesh.indices[i + 1];
-				int index2 = mesh.indices[i + 2];
-
-				Triangle triangle;
-				triangle.v0 = mesh.transformedPositions[index0];
-				triangle.v1 = mesh.transformedPositions[index1];
-				triangle.v2 = mesh.transformedPositions[index2];
-				triangle.normal = mesh.transformedNormals[i / 3];
-				triangle.cullMode = mesh.cullMode;
-				triangle.materialIndex = mesh.materialIndex;
-
-				if (HitTest_Triangle(triangle, ray, hitRecord, ignoreHitRecord))
+			//Whole leaves at once, TriangleLanes::Width triangles per kernel call
+			auto triangleTest = [&](const uint32_t* pTriangleIndices, uint32_t triangleCount)
 				{
-					if (hitRecord.t < closestT)
+					for (uint32_t first{ 0 }; first < triangleCount; first += TriangleLanes::Width)
 					{
-						closestT = hitRecord.t;
+						float t;
+						bool isFrontFacing;
+						const int lane{ HitTest_Triangles<TriangleLanes>(mesh.precomputedTriangles, pTriangleIndices + first,
+							std::min(TriangleLanes::Width, triangleCount - first), mesh.cullMode, closestRay, ignoreHitRecord, t, isFrontFacing) };
+						if (lane < 0) continue;
+
 						didHit = true;
+						closestRay.max = t;
 
-						if (!ignoreHitRecord)
-						{
-							hitRecord = hitRecord;
-						}
+						//Any hit is enough for shadow queries
+						if (ignoreHitRecord) return true;
+
+						const PrecomputedTriangles& triangles = mesh.precomputedTriangles;
+						const uint32_t triangleIndex{ pTriangleIndices[first + lane] };
+						const Vector3 normal{ triangles.normal[0][triangleIndex], triangles.normal[1][triangleIndex], triangles.normal[2][triangleIndex] };
+						FillTriangleHitRecord(t, normal, isFrontFacing, mesh.materialIndex, closestRay, hitRecord);
 					}
-				}
-			}
+					return false;
+				};
+
+			if (mesh.useCompressedBVH)
+				TraverseCompressedBVH(mesh.compressedBvh, mesh.bvh, closestRay, triangleTest);
+			else if (mesh.useWideBVH)
+				TraverseWideBVH(mesh.wideBvh, mesh.bvh, closestRay, triangleTest);
+			else
+				TraverseBVH(mesh.bvh, closestRay, triangleTest);
 
 			return didHit;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		/**
+		 * \brief Occlusion query: stops at the first triangle blocking the ray, without picking a closest hit or filling a hit record
+		 * \param pOccludingTriangle optional, receives the index of the blocking triangle
+		 */
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle = nullptr)
+		{
+			if (!SlabTest_TriangleMesh(mesh, ray))
+			{
+				return false;
+			}
+
+			const auto triangleTest = [&](const uint32_t* pTriangleIndices, uint32_t triangleCount)
+				{
+					for (uint32_t first{ 0 }; first < triangleCount; first += TriangleLanes::Width)
+					{
+						const int lane{ HitTest_Triangles<TriangleLanes>(mesh.precomputedTriangles, pTriangleIndices + first,
+							std::min(TriangleLanes::Width, triangleCount - first), mesh.cullMode, ray) };
+						if (lane < 0) continue;
+
+						if (pOccludingTriangle) *pOccludingTriangle = pTriangleIndices[first + lane];
+						return true;
+					}
+					return false;
+				};
+
+			if (mesh.useCompressedBVH)
+				return TraverseCompressedBVH(mesh.compressedBvh, mesh.bvh, ray, triangleTest, true);
+			if (mesh.useWideBVH)
+				return TraverseWideBVH(mesh.wideBvh, mesh.bvh, ray, triangleTest, true);
+			return TraverseBVH(mesh.bvh, ray, triangleTest);
+		}
+
+		inline Ray TransformRayToObjectSpace(const TriangleMeshInstance& instance, const Ray& ray);
+
+		inline bool HitTest_TriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			if (!HitTest_TriangleMesh(mesh, TransformRayToObjectSpace(instance, ray), hitRecord, ignoreHitRecord)) return false;
+
+			if (!ignoreHitRecord)
+			{
+				hitRecord.origin = ray.origin + hitRecord.t * ray.direction;
+				hitRecord.normal = instance.normalTransform.TransformVector(hitRecord.normal).Normalized();
+				hitRecord.materialIndex = instance.materialIndex;
+			}
+			return true;
+		}
+
+		inline Ray TransformRayToObjectSpace(const TriangleMeshInstance& instance, const Ray& ray)
+		{
+			//The direction is not renormalized, so t means the same in object and world space
+			return Ray{
+				instance.inverseTransform.TransformPoint(ray.origin),
+				instance.inverseTransform.TransformVector(ray.direction),
+				ray.min, ray.max };
+		}
+
+		inline bool HitTest_TriangleMeshInstance(const TriangleMeshInstance& instance, const TriangleMesh& mesh, const Ray& ray, uint32_t* pOccludingTriangle = nullptr)
+		{
+			return HitTest_TriangleMesh(mesh, TransformRayToObjectSpace(instance, ray), pOccludingTriangle);
+		}
+
+		/**
+		 * \brief Closest hits of a packet of rays with the mesh, traced through its binary BVH
+		 * \param rayMask rays of the packet to test
+		 * \param pHitRecords one record per packet ray, only written for rays hitting the mesh before their packet.max, which is shortened to the hit
+		 */
+		inline void HitTest_TriangleMesh(const TriangleMesh& mesh, RayPacket& packet, uint64_t rayMask, HitRecord* pHitRecords)
+		{
+			const PrecomputedTriangles& triangles = mesh.precomputedTriangles;
+
+			TraversePacketBVH(mesh.bvh, packet, rayMask, [&](const uint32_t* pTriangleIndices, uint32_t triangleCount, uint64_t leafRayMask)
+				{
+					while (leafRayMask)
+					{
+						const uint32_t rayIndex{ static_cast<uint32_t>(std::countr_zero(leafRayMask)) };
+						leafRayMask &= leafRayMask - 1;
+
+						Ray ray{ packet.GetRay(rayIndex) };
+						for (uint32_t first{ 0 }; first < triangleCount; first += TriangleLanes::Width)
+						{
+							float t;
+							bool isFrontFacing;
+							const int lane{ HitTest_Triangles<TriangleLanes>(triangles, pTriangleIndices + first,
+								std::min(TriangleLanes::Width, triangleCount - first), mesh.cullMode, ray, false, t, isFrontFacing) };
+							if (lane < 0) continue;
+
+							ray.max = t;
+							packet.max[rayIndex] = t;
+
+							const uint32_t triangleIndex{ pTriangleIndices[first + lane] };
+							const Vector3 normal{ triangles.normal[0][triangleIndex], triangles.normal[1][triangleIndex], triangles.normal[2][triangleIndex] };
+							FillTriangleHitRecord(t, normal, isFrontFacing, mesh.materialIndex, ray, pHitRecords[rayIndex]);
+						}
+					}
+				});
 		}
 
 #pragma endregion
 	}
+	}
 
 	namespace LightUtils
 	{
@@ -7,12 +7,17 @@
 #undef main
 
 //Standard includes
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
 //Project includes
+#include "CpuDispatch.h"
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 
 using namespace dae;
 
@@ -22,17 +27,50 @@ void ShutDown(SDL_Window* pWindow)
 	SDL_Quit();
 }
 
-void SetScene(SDL_Window* pWindow, Scene* pScene)
+//Scenes load from their snapshot when there is one, otherwise they are initialized once and snapshotted for the next time
+void SetScene(SDL_Window* pWindow, Scene* pScene, int sceneIndex)
 {
-	pScene->Initialize();
+	const auto start = std::chrono::high_resolution_clock::now();
+	const std::string snapshotPath{ "Resources/Scene" + std::to_string(sceneIndex) + ".snapshot" };
+
+	const bool isLoaded{ pScene->LoadSnapshot(snapshotPath) };
+	if (!isLoaded)
+	{
+		pScene->Initialize();
+		pScene->UpdateAccelerationStructure();
+		pScene->SaveSnapshot(snapshotPath);
+	}
+
+	const std::chrono::duration<float, std::milli> loadTime{ std::chrono::high_resolution_clock::now() - start };
+	std::cout << pScene->GetTitle() << (isLoaded ? " loaded from snapshot in " : " initialized in ") << loadTime.count() << " ms\n";
+
 	SDL_SetWindowTitle(pWindow, ("Raytracer: " + pScene->GetTitle() + " - Athan Van den Steen 2GD10E").c_str());
 }
 
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	//The kernels of the best instruction set are selected at startup, --isa=sse4.2|avx2|avx512 forces another one
+	//One render thread per hardware thread by default, --threads=N uses N
+	uint32_t threadCount{ 0 };
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		const std::string argument{ args[i] };
+		if (argument.rfind("--threads=", 0) == 0)
+		{
+			threadCount = static_cast<uint32_t>(std::strtoul(argument.c_str() + 10, nullptr, 10));
+			if (threadCount == 0) std::cout << "Invalid thread count " << argument.substr(10) << '\n';
+			continue;
+		}
+		if (argument.rfind("--isa=", 0) != 0) continue;
+
+		InstructionSet instructionSet{};
+		if (!CpuDispatch::ParseInstructionSet(argument.substr(6), instructionSet))
+			std::cout << "Unknown instruction set " << argument.substr(6) << ", use sse4.2, avx2 or avx512\n";
+		else if (!CpuDispatch::SelectInstructionSet(instructionSet))
+			std::cout << "This CPU does not support " << CpuDispatch::GetName(instructionSet) << '\n';
+	}
+	std::cout << "Kernels: " << CpuDispatch::GetName(CpuDispatch::GetInstructionSet())
+		<< " (best supported: " << CpuDispatch::GetName(CpuDispatch::DetectInstructionSet()) << ")\n";
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
@@ -52,6 +90,8 @@ int main(int argc, char* args[])
 	//Initialize "framework"
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
+	if (threadCount > 0) pRenderer->SetThreadCount(threadCount);
+	std::cout << "Render threads: " << pRenderer->GetThreadCount() << '\n';
 
 	std::vector<Scene*> scenes = {
 		new Scene_W4_ReferenceScene(),
@@ -59,8 +99,14 @@ int main(int argc, char* args[])
 	};
 	int currentSceneIndex{ 0 };
 
+	//Scene updates happen between frames, so they share the render threads
+	for (Scene* pScene : scenes)
+	{
+		pScene->SetThreadPool(&pRenderer->GetThreadPool());
+	}
+
 	Scene* pScene = scenes[currentSceneIndex];
-	SetScene(pWindow, pScene);
+	SetScene(pWindow, pScene, currentSceneIndex);
 
 	//Start loop
 	pTimer->Start();
@@ -73,6 +119,9 @@ int main(int argc, char* args[])
 	bool takeScreenshot = false;
 
 	std::cout << "Press 'TAB' to change scenes!\n";
+	std::cout << "Press 'P' to change the ray packet size!\n";
+	std::cout << "Press 'M' to switch between megakernel and wavefront rendering!\n";
+	std::cout << "Press 'O' to change the tile order!\n";
 
 	while (isLooping)
 	{
@@ -89,6 +138,26 @@ int main(int argc, char* args[])
 			case SDL_KEYUP:
 				if (e.key.keysym.scancode == SDL_SCANCODE_X)
 					takeScreenshot = true;
+				if (e.key.keysym.scancode == SDL_SCANCODE_P)
+				{
+					//Cycles 1, 2, 4, 8 pixel wide ray packets
+					const uint32_t packetSize{ pRenderer->GetPacketSize() };
+					pRenderer->SetPacketSize(packetSize == 8 ? 1 : packetSize * 2);
+					std::cout << "Ray packets: " << pRenderer->GetPacketSize() << "x" << pRenderer->GetPacketSize() << '\n';
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_M)
+				{
+					const bool isWavefront{ pRenderer->GetRenderMode() == RenderMode::Wavefront };
+					pRenderer->SetRenderMode(isWavefront ? RenderMode::Megakernel : RenderMode::Wavefront);
+					std::cout << "Render mode: " << (isWavefront ? "megakernel" : "wavefront") << '\n';
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_O)
+				{
+					//Cycles scanline, Morton and Hilbert order
+					const TileOrder tileOrder{ static_cast<TileOrder>((static_cast<int>(pRenderer->GetTileOrder()) + 1) % 3) };
+					pRenderer->SetTileOrder(tileOrder);
+					std::cout << "Tile order: " << (tileOrder == TileOrder::Scanline ? "scanline" : tileOrder == TileOrder::Morton ? "Morton" : "Hilbert") << '\n';
+				}
 				if (e.key.keysym.scancode == SDL_SCANCODE_TAB)
 				{
 					pScene->Clear();
@@ -96,7 +165,8 @@ int main(int argc, char* args[])
 					currentSceneIndex = (currentSceneIndex + 1) % scenes.size();
 
 					pScene = scenes[currentSceneIndex];
-					SetScene(pWindow, pScene);
+					SetScene(pWindow, pScene, currentSceneIndex);
+					pRenderer->AutotuneTileSize();
 				}
 				break;
 			}
@@ -104,9 +174,13 @@ int main(int argc, char* args[])
 
 		//--------- Update ---------
 		pScene->Update(pTimer);
+		pScene->UpdateAccelerationStructure();
 
 		//--------- Render ---------
-		pRenderer->Render(pScene);
+		const bool wasTuning{ pRenderer->IsTuningTileSize() };
+		pRenderer->Render(pScene->CreateView());
+		if (wasTuning && !pRenderer->IsTuningTileSize())
+			std::cout << "Tile size: " << pRenderer->GetTileSize() << "x" << pRenderer->GetTileSize() << " (autotuned)\n";
 
 		//--------- Timer ---------
 		pTimer->Update();
@@ -115,6 +189,28 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+
+			const OccluderCacheStats occluderStats{ pRenderer->GetOccluderCacheStats() };
+			if (occluderStats.lookups > 0)
+			{
+				std::cout << "Occluder cache: " << 100.f * occluderStats.hits / occluderStats.lookups << "% hits over "
+					<< occluderStats.lookups << " lookups, " << occluderStats.shadowRays << " shadow rays" << std::endl;
+			}
+			pRenderer->ResetOccluderCacheStats();
+
+			//Busy time of every thread over the time spent rendering, uneven numbers mean the tiles are spread badly
+			const ThreadPool& threadPool{ pRenderer->GetThreadPool() };
+			if (threadPool.GetRunMilliseconds() > 0.0)
+			{
+				std::cout << "Thread utilization:";
+				for (uint32_t threadIndex{ 0 }; threadIndex < threadPool.GetThreadCount(); ++threadIndex)
+				{
+					const ThreadStats& stats{ threadPool.GetThreadStats(threadIndex) };
+					std::cout << ' ' << int(100.0 * stats.busyMilliseconds / threadPool.GetRunMilliseconds()) << "% (" << stats.stolenTasks << " stolen)";
+				}
+				std::cout << std::endl;
+			}
+			pRenderer->ResetThreadStats();
 		}
 
 		//Save screenshot after full render
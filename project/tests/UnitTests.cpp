@@ -1,7 +1,15 @@
 #include <gtest/gtest.h>
+#include <numeric>
 #include "../src/Vector3.h"
 #include "../src/Vector4.h"
 #include "../src/Matrix.h"
+#include "../src/Utils.h"
+#include "../src/Snapshot.h"
+#include "../src/Scene.h"
+#include "../src/CpuDispatch.h"
+#include "../src/Material.h"
+#include "../src/ThreadPool.h"
+#include "../src/TileOrder.h"
 
 namespace dae
 {
@@ -37,6 +45,981 @@ namespace dae
 
 	// W1
 
+	// Instancing
+	TEST(Matrix, Inverse) {
+		const Matrix transform{ Matrix::CreateScale(2.f, 3.f, .5f) * Matrix::CreateRotation(.3f, 1.2f, -.7f) * Matrix::CreateTranslation({ 4.f, -2.f, 7.f }) };
+		const Matrix inverse{ Matrix::Inverse(transform) };
+
+		const Vector3 point{ 1.f, -5.f, 3.f };
+		const Vector3 roundTrip{ inverse.TransformPoint(transform.TransformPoint(point)) };
+		EXPECT_NEAR(point.x, roundTrip.x, 1e-4f);
+		EXPECT_NEAR(point.y, roundTrip.y, 1e-4f);
+		EXPECT_NEAR(point.z, roundTrip.z, 1e-4f);
+	}
+
+	TEST(Matrix, BatchedTransformsMatchSingleTransforms) {
+		const Matrix transform{ Matrix::CreateScale(2.f, 3.f, .5f) * Matrix::CreateRotation(.3f, 1.2f, -.7f) * Matrix::CreateTranslation({ 4.f, -2.f, 7.f }) };
+		const AffineMatrix affine{ transform };
+
+		//Not a multiple of the batch width, so the remainder goes through the single transforms
+		std::vector<Vector3> points{};
+		for (int i{ 0 }; i < 11; ++i) points.emplace_back(i * .5f, 3.f - i, i * i * .1f);
+
+		std::vector<Vector3> transformedPoints(points.size()), transformedVectors(points.size());
+		affine.TransformPoints(points.data(), transformedPoints.data(), points.size());
+		affine.TransformVectors(points.data(), transformedVectors.data(), points.size());
+
+		for (size_t i{ 0 }; i < points.size(); ++i)
+		{
+			const Vector3 expectedPoint{ transform.TransformPoint(points[i]) };
+			const Vector3 expectedVector{ transform.TransformVector(points[i]) };
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				EXPECT_FLOAT_EQ(expectedPoint[axis], transformedPoints[i][axis]);
+				EXPECT_FLOAT_EQ(expectedVector[axis], transformedVectors[i][axis]);
+			}
+		}
+
+		//In place
+		transform.TransformPoints(points.data(), points.data(), points.size());
+		for (size_t i{ 0 }; i < points.size(); ++i)
+		{
+			EXPECT_EQ(transformedPoints[i], points[i]);
+		}
+
+		EXPECT_EQ(transform, affine.ToMatrix());
+	}
+
+	// BVH
+	static uint32_t NextRandom(uint32_t& seed)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	}
+
+	static float RandomFloat(uint32_t& seed, float min, float max)
+	{
+		return min + (max - min) * (NextRandom(seed) / float(1 << 24));
+	}
+
+	//Every triangle gets its own three positions, triangle i is positions 3i..3i+2
+	static TriangleMesh CreateTriangleSoup(const std::vector<Vector3>& positions)
+	{
+		std::vector<int> indices(positions.size());
+		std::iota(indices.begin(), indices.end(), 0);
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+		return mesh;
+	}
+
+	static TriangleMesh MergeMeshes(const TriangleMesh& first, const TriangleMesh& second)
+	{
+		std::vector<Vector3> positions{ first.positions };
+		positions.insert(positions.end(), second.positions.begin(), second.positions.end());
+		return CreateTriangleSoup(positions);
+	}
+
+	//Deterministic cloud of small triangles inside a 10x10x10 box
+	static TriangleMesh CreateRandomMesh(uint32_t seed, int triangleCount)
+	{
+		std::vector<Vector3> positions{};
+		for (int i{ 0 }; i < triangleCount; ++i)
+		{
+			const Vector3 center{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+			for (int v{ 0 }; v < 3; ++v)
+			{
+				positions.emplace_back(center + Vector3{ RandomFloat(seed, -.5f, .5f), RandomFloat(seed, -.5f, .5f), RandomFloat(seed, -.5f, .5f) });
+			}
+		}
+		return CreateTriangleSoup(positions);
+	}
+
+	//Long thin slivers across the whole box in random directions, their bounds overlap along every axis, which is what spatial splits are for
+	static TriangleMesh CreateSliverMesh(uint32_t seed, int triangleCount)
+	{
+		std::vector<Vector3> positions{};
+		for (int i{ 0 }; i < triangleCount; ++i)
+		{
+			const Vector3 start{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+			const Vector3 end{ -start.x + RandomFloat(seed, -1.f, 1.f), -start.y + RandomFloat(seed, -1.f, 1.f), -start.z + RandomFloat(seed, -1.f, 1.f) };
+			const Vector3 side{ RandomFloat(seed, -.2f, .2f), RandomFloat(seed, -.2f, .2f), RandomFloat(seed, -.2f, .2f) };
+			positions.insert(positions.end(), { start, end, start + side });
+		}
+		return CreateTriangleSoup(positions);
+	}
+
+	//Clusters of very different sizes and densities, most triangles end up in the first few, so good splits are far from the middle
+	static TriangleMesh CreateClusteredMesh(uint32_t seed, int clusterCount, int triangleCount)
+	{
+		std::vector<Vector3> centers{};
+		std::vector<float> radii{};
+		for (int i{ 0 }; i < clusterCount; ++i)
+		{
+			centers.emplace_back(RandomFloat(seed, -4.f, 4.f), RandomFloat(seed, -4.f, 4.f), RandomFloat(seed, -4.f, 4.f));
+			radii.emplace_back(RandomFloat(seed, .02f, 1.f));
+		}
+
+		std::vector<Vector3> positions{};
+		for (int i{ 0 }; i < triangleCount; ++i)
+		{
+			const uint32_t cluster{ std::min(NextRandom(seed) % clusterCount, NextRandom(seed) % clusterCount) };
+			const float radius{ radii[cluster] };
+			const Vector3 center{ centers[cluster] + Vector3{ RandomFloat(seed, -radius, radius), RandomFloat(seed, -radius, radius), RandomFloat(seed, -radius, radius) } };
+			for (int v{ 0 }; v < 3; ++v)
+			{
+				const float size{ radius * .2f };
+				positions.emplace_back(center + Vector3{ RandomFloat(seed, -size, size), RandomFloat(seed, -size, size), RandomFloat(seed, -size, size) });
+			}
+		}
+		return CreateTriangleSoup(positions);
+	}
+
+	//Different triangles that all have the bounds [-1, 1] on every axis, no split can separate them so they share one leaf and one Morton code
+	static TriangleMesh CreateCoincidentMesh(uint32_t seed, int triangleCount)
+	{
+		std::vector<Vector3> positions{};
+		for (int i{ 0 }; i < triangleCount; ++i)
+		{
+			positions.insert(positions.end(), {
+				Vector3{ -1.f, -1.f, RandomFloat(seed, -1.f, 1.f) },
+				Vector3{ 1.f, RandomFloat(seed, -1.f, 1.f), -1.f },
+				Vector3{ RandomFloat(seed, -1.f, 1.f), 1.f, 1.f } });
+		}
+		return CreateTriangleSoup(positions);
+	}
+
+	//Rotates every vertex around the y axis by an angle that grows with its height, unlike a rigid transform this changes how the triangles overlap
+	static void TwistMesh(TriangleMesh& mesh, float anglePerUnit)
+	{
+		for (Vector3& position : mesh.positions)
+		{
+			position = Matrix::CreateRotationY(position.y * anglePerUnit).TransformPoint(position);
+		}
+		mesh.CalculateNormals();
+		mesh.UpdateAABB();
+		mesh.UpdateTransforms();
+	}
+
+	static uint32_t GetLargestLeafSize(const BVH& bvh)
+	{
+		uint32_t largestLeafSize{ 0 };
+		for (const BVHNode& node : bvh.nodes)
+		{
+			largestLeafSize = std::max(largestLeafSize, node.primitiveCount);
+		}
+		return largestLeafSize;
+	}
+
+	static void ExpectMeshMatchesLinearScan(const TriangleMesh& mesh, uint32_t seed)
+	{
+		for (int i{ 0 }; i < 200; ++i)
+		{
+			const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+			const Vector3 target{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+			const Ray ray{ origin, (target - origin).Normalized() };
+
+			HitRecord expected{};
+			bool expectedIsOccluded{ false };
+			for (size_t t{ 0 }; t < mesh.indices.size(); t += 3)
+			{
+				const std::vector<Vector3>& positions = mesh.transformedPositions;
+				Triangle triangle{ positions[mesh.indices[t]], positions[mesh.indices[t + 1]], positions[mesh.indices[t + 2]], mesh.transformedNormals[t / 3] };
+				triangle.cullMode = mesh.cullMode;
+
+				HitRecord hit{};
+				if (GeometryUtils::HitTest_Triangle(triangle, ray, hit) && hit.t < expected.t) expected = hit;
+				expectedIsOccluded = expectedIsOccluded || GeometryUtils::HitTest_Triangle(triangle, ray);
+			}
+
+			HitRecord actual{};
+			EXPECT_EQ(expected.didHit, GeometryUtils::HitTest_TriangleMesh(mesh, ray, actual));
+			if (expected.didHit)
+			{
+				EXPECT_FLOAT_EQ(expected.t, actual.t);
+			}
+
+			//Shadow rays flip the culling
+			EXPECT_EQ(expectedIsOccluded, GeometryUtils::HitTest_TriangleMesh(mesh, ray));
+		}
+	}
+
+	TEST(BVH, ClosestHitMatchesLinearScan) {
+		const TriangleMesh mesh{ CreateClusteredMesh(12345, 8, 2000) };
+
+		//No two centroids coincide, so the SAH always finds a split before a leaf grows too large
+		EXPECT_LE(GetLargestLeafSize(mesh.bvh), BVH::MaxLeafSize);
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	TEST(BVH, RefitMatchesLinearScan) {
+		TriangleMesh mesh{ CreateClusteredMesh(12345, 8, 2000) };
+		mesh.bvhRebuildThreshold = FLT_MAX;
+
+		const BVHNode rootBefore{ mesh.bvh.nodes[0] };
+		const size_t nodeCount{ mesh.bvh.nodes.size() };
+		mesh.Translate({ 2.f, 0.f, 0.f });
+		TwistMesh(mesh, .5f);
+
+		//Same topology, new bounds that overlap more than the built ones
+		EXPECT_EQ(rootBefore.leftFirst, mesh.bvh.nodes[0].leftFirst);
+		EXPECT_EQ(nodeCount, mesh.bvh.nodes.size());
+		EXPECT_FALSE(rootBefore.maxAABB == mesh.bvh.nodes[0].maxAABB);
+		EXPECT_GT(mesh.bvh.CalculateSAHCost(), mesh.bvh.buildCost);
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	TEST(BVH, WideRefitMatchesLinearScan) {
+		for (bool useCompressedBVH : { false, true })
+		{
+			TriangleMesh mesh{ CreateClusteredMesh(12345, 8, 2000) };
+			mesh.bvhRebuildThreshold = FLT_MAX;
+			mesh.useWideBVH = true;
+			mesh.useCompressedBVH = useCompressedBVH;
+			mesh.UpdateBVH();
+
+			//A refit updates the wide and compressed nodes in place instead of collapsing the BVH again
+			const size_t wideNodeCount{ mesh.wideBvh.nodes.size() }, compressedNodeCount{ mesh.compressedBvh.nodes.size() };
+			mesh.Translate({ 2.f, 0.f, 0.f });
+			TwistMesh(mesh, .5f);
+
+			EXPECT_EQ(wideNodeCount, mesh.wideBvh.nodes.size());
+			EXPECT_EQ(compressedNodeCount, mesh.compressedBvh.nodes.size());
+			ExpectMeshMatchesLinearScan(mesh, 678);
+		}
+	}
+
+	TEST(BVH, LinearBuildMatchesLinearScan) {
+		//Tight clusters share Morton cells and the coincident triangles share one code, those runs have to be halved
+		TriangleMesh mesh{ MergeMeshes(CreateClusteredMesh(12345, 8, 2000), CreateCoincidentMesh(678, 40)) };
+		mesh.bvh.builder = BVHBuilder::Linear;
+		mesh.UpdateTransforms();
+		EXPECT_LE(GetLargestLeafSize(mesh.bvh), BVH::LinearLeafSize);
+		ExpectMeshMatchesLinearScan(mesh, 678);
+
+		//Large enough to go through the partitioned parallel path
+		ThreadPool threadPool{ 4 };
+		mesh.pThreadPool = &threadPool;
+		mesh.bvh.parallelBuildThreshold = 0;
+		mesh.UpdateTransforms();
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	TEST(BVH, ParallelBuildMatchesSerialBuild) {
+		//Enough triangles for the top nodes to be binned and partitioned on the pool as well
+		TriangleMesh serialMesh{ CreateRandomMesh(4242, BVH::ParallelBinningThreshold + 5000) };
+		serialMesh.bvh.parallelBuildThreshold = UINT32_MAX;
+		serialMesh.bvh.Clear();
+		serialMesh.UpdateBVH();
+
+		ThreadPool threadPool{ 4 };
+		TriangleMesh parallelMesh{ serialMesh };
+		parallelMesh.pThreadPool = &threadPool;
+		parallelMesh.bvh.parallelBuildThreshold = 0;
+		parallelMesh.bvh.Clear();
+		parallelMesh.UpdateBVH();
+
+		//Every triangle still ends up in exactly one leaf
+		std::vector<uint32_t> primitiveIndices{ parallelMesh.bvh.primitiveIndices };
+		std::sort(primitiveIndices.begin(), primitiveIndices.end());
+		for (uint32_t i{ 0 }; i < primitiveIndices.size(); ++i)
+		{
+			EXPECT_EQ(i, primitiveIndices[i]);
+		}
+
+		uint32_t seed{ 678 };
+		for (int i{ 0 }; i < 500; ++i)
+		{
+			const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+			const Vector3 target{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+			const Ray ray{ origin, (target - origin).Normalized() };
+
+			HitRecord expected{}, actual{};
+			ASSERT_EQ(GeometryUtils::HitTest_TriangleMesh(serialMesh, ray, expected), GeometryUtils::HitTest_TriangleMesh(parallelMesh, ray, actual));
+			EXPECT_FLOAT_EQ(expected.t, actual.t);
+		}
+	}
+
+	TEST(BVH, SpatialSplitBuildMatchesLinearScan) {
+		TriangleMesh mesh{ CreateSliverMesh(12345, 500) };
+		mesh.bvh.builder = BVHBuilder::SpatialSplitSAH;
+		mesh.bvh.Clear();
+		mesh.UpdateBVH();
+
+		//The slivers have to be split, or the test would only cover the object split path
+		EXPECT_GT(mesh.bvh.primitiveIndices.size(), mesh.bvh.primitiveCount);
+		EXPECT_LE(mesh.bvh.primitiveIndices.size(), mesh.bvh.primitiveCount * (1.f + mesh.bvh.spatialSplitBudget));
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	TEST(BVH, VanEmdeBoasLayoutMatchesLinearScan) {
+		//Deep and lopsided, so the layout recurses several times and splits subtrees of uneven height
+		const TriangleMesh mesh{ CreateClusteredMesh(12345, 8, 5000) };
+		ASSERT_EQ(mesh.bvh.layout, BVHLayout::VanEmdeBoas);
+
+		//Refits rely on children being stored after their parent
+		for (uint32_t i{ 0 }; i < mesh.bvh.nodes.size(); ++i)
+		{
+			if (!mesh.bvh.nodes[i].IsLeaf())
+			{
+				EXPECT_GT(mesh.bvh.nodes[i].leftFirst, i);
+			}
+		}
+
+		//The triangles themselves are sorted into leaf order
+		for (uint32_t i{ 0 }; i < mesh.bvh.primitiveIndices.size(); ++i)
+		{
+			EXPECT_EQ(mesh.bvh.primitiveIndices[i], i);
+		}
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	static void ExpectCompressedMatchesLinearScan(TriangleMesh& mesh)
+	{
+		mesh.useCompressedBVH = true;
+		mesh.UpdateBVH();
+
+		EXPECT_FALSE(mesh.compressedBvh.nodes.empty());
+		EXPECT_TRUE(mesh.wideBvh.nodes.empty());
+
+		//Every primitive reference ends up in exactly one compressed leaf slot
+		uint32_t leafPrimitiveCount{ 0 };
+		for (const CompressedWideBVHNode& node : mesh.compressedBvh.nodes)
+		{
+			for (int i{ 0 }; i < node.childCount; ++i) leafPrimitiveCount += node.primitiveCounts[i];
+		}
+		EXPECT_EQ(mesh.bvh.primitiveIndices.size(), leafPrimitiveCount);
+		ExpectMeshMatchesLinearScan(mesh, 678);
+	}
+
+	TEST(BVH, CompressedMatchesLinearScan) {
+		TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+		ExpectCompressedMatchesLinearScan(mesh);
+	}
+
+	TEST(BVH, CompressedSplitsLargeLeaves) {
+		//Too many for one leaf slot and for four of them, so the leaf is spread over two levels of extra nodes
+		TriangleMesh mesh{ MergeMeshes(CreateRandomMesh(12345, 500), CreateCoincidentMesh(678, 1100)) };
+		EXPECT_GT(GetLargestLeafSize(mesh.bvh), CompressedWideBVHNode::Width * UINT8_MAX);
+		ExpectCompressedMatchesLinearScan(mesh);
+	}
+
+	TEST(BVH, CompressedQuantizesLargeAndFlatBounds) {
+		//A few huge triangles far away blow up the cell size of the root, the small triangles get only a cell or two there
+		std::vector<Vector3> hugePositions{};
+		for (float sign : { -1.f, 1.f })
+		{
+			hugePositions.insert(hugePositions.end(), { Vector3{ sign * 1e8f, 0.f, 0.f }, Vector3{ sign * 1e8f, 1e8f, 0.f }, Vector3{ sign * 1e8f, 0.f, 1e8f } });
+		}
+		TriangleMesh largeMesh{ MergeMeshes(CreateRandomMesh(12345, 500), CreateTriangleSoup(hugePositions)) };
+		ExpectCompressedMatchesLinearScan(largeMesh);
+		EXPECT_GE(largeMesh.compressedBvh.nodes[0].exponents[0], 19);
+
+		//Every node of a flat mesh has a zero extent along z, which takes the smallest cell size
+		std::vector<Vector3> flatPositions{ CreateRandomMesh(12345, 500).positions };
+		for (Vector3& position : flatPositions) position.z = 0.f;
+		TriangleMesh flatMesh{ CreateTriangleSoup(flatPositions) };
+		ExpectCompressedMatchesLinearScan(flatMesh);
+		for (const CompressedWideBVHNode& node : flatMesh.compressedBvh.nodes)
+		{
+			EXPECT_EQ(-126, node.exponents[2]);
+		}
+	}
+
+	//Every lane has to make the decisions of the scalar test, culling flipped for shadow rays included
+	template<typename Lanes>
+	static void ExpectTriangleKernelMatchesScalar(const TriangleMesh& mesh, uint32_t seed)
+	{
+		const PrecomputedTriangles& triangles = mesh.precomputedTriangles;
+		const uint32_t triangleCount{ static_cast<uint32_t>(mesh.indices.size() / 3) };
+
+		for (TriangleCullMode cullMode : { TriangleCullMode::NoCulling, TriangleCullMode::FrontFaceCulling, TriangleCullMode::BackFaceCulling })
+		{
+			for (bool ignoreHitRecord : { false, true })
+			{
+				for (int i{ 0 }; i < 200; ++i)
+				{
+					const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+					const Vector3 target{ RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f) };
+					const Ray ray{ origin, (target - origin).Normalized() };
+
+					//Contiguous runs load directly, scattered and partial ones are gathered
+					uint32_t indices[Lanes::Width];
+					const uint32_t count{ 1 + NextRandom(seed) % Lanes::Width };
+					const bool isContiguous{ NextRandom(seed) % 2 == 0 };
+					const uint32_t first{ NextRandom(seed) % (triangleCount - count + 1) };
+					for (uint32_t lane{ 0 }; lane < count; ++lane)
+					{
+						indices[lane] = isContiguous ? first + lane : NextRandom(seed) % triangleCount;
+					}
+
+					Ray scalarRay{ ray };
+					float expectedT{};
+					bool expectedIsFrontFacing{};
+					int expectedLane{ -1 };
+					for (uint32_t lane{ 0 }; lane < count; ++lane)
+					{
+						const uint32_t index{ indices[lane] };
+						const float v0[3]{ triangles.v0[0][index], triangles.v0[1][index], triangles.v0[2][index] };
+						const float edge1[3]{ triangles.edge1[0][index], triangles.edge1[1][index], triangles.edge1[2][index] };
+						const float edge2[3]{ triangles.edge2[0][index], triangles.edge2[1][index], triangles.edge2[2][index] };
+						const float normal[3]{ triangles.normal[0][index], triangles.normal[1][index], triangles.normal[2][index] };
+						if (!GeometryUtils::HitTest_Triangle(v0, edge1, edge2, normal, cullMode, scalarRay, ignoreHitRecord, expectedT, expectedIsFrontFacing)) continue;
+
+						expectedLane = static_cast<int>(lane);
+						scalarRay.max = expectedT;
+					}
+
+					float t{};
+					bool isFrontFacing{};
+					const int lane{ GeometryUtils::HitTest_Triangles<Lanes>(triangles, indices, count, cullMode, ray, ignoreHitRecord, t, isFrontFacing) };
+					EXPECT_EQ(expectedLane, lane);
+					if (expectedLane >= 0)
+					{
+						EXPECT_FLOAT_EQ(expectedT, t);
+						EXPECT_EQ(expectedIsFrontFacing, isFrontFacing);
+					}
+				}
+			}
+		}
+	}
+
+	TEST(BVH, WideTriangleKernelMatchesScalar) {
+		//Not a multiple of any lane count, with a collapsed and a collinear triangle among them
+		std::vector<Vector3> degeneratePositions{ Vector3{ 1.f, 1.f, 0.f }, Vector3{ 1.f, 1.f, 0.f }, Vector3{ 1.f, 1.f, 0.f } };
+		degeneratePositions.insert(degeneratePositions.end(), { Vector3{ -2.f, -2.f, -2.f }, Vector3{ 2.f, 2.f, 2.f }, Vector3{ 0.f, 0.f, 0.f } });
+		const TriangleMesh mesh{ MergeMeshes(CreateRandomMesh(12345, 51), CreateTriangleSoup(degeneratePositions)) };
+		ExpectTriangleKernelMatchesScalar<GeometryUtils::SSETriangleLanes>(mesh, 678);
+		ExpectTriangleKernelMatchesScalar<GeometryUtils::TriangleLanes>(mesh, 678);
+
+		//Culled meshes go through the same kernel from their BVH leaves
+		for (TriangleCullMode cullMode : { TriangleCullMode::FrontFaceCulling, TriangleCullMode::BackFaceCulling })
+		{
+			TriangleMesh culledMesh{ CreateClusteredMesh(12345, 8, 2000) };
+			culledMesh.cullMode = cullMode;
+			ExpectMeshMatchesLinearScan(culledMesh, 678);
+		}
+	}
+
+	TEST(BVH, PacketTraversalMatchesSingleRays) {
+		const TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+		uint32_t seed{ 678 };
+
+		//Coherent packets stay together, scattered ones diverge and finish ray by ray
+		for (float spread : { .05f, 5.f })
+		{
+			for (int packetIndex{ 0 }; packetIndex < 20; ++packetIndex)
+			{
+				const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+				const Vector3 target{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), 0.f };
+
+				RayPacket packet{};
+				packet.size = 1 + NextRandom(seed) % RayPacket::MaxSize;
+				for (uint32_t i{ 0 }; i < packet.size; ++i)
+				{
+					const Vector3 offset{ RandomFloat(seed, -spread, spread), RandomFloat(seed, -spread, spread), 0.f };
+					packet.SetRay(i, Ray{ origin, (target + offset - origin).Normalized() });
+				}
+
+				HitRecord hitRecords[RayPacket::MaxSize]{};
+				GeometryUtils::HitTest_TriangleMesh(mesh, packet, packet.GetFullMask(), hitRecords);
+
+				for (uint32_t i{ 0 }; i < packet.size; ++i)
+				{
+					HitRecord expected{};
+					GeometryUtils::HitTest_TriangleMesh(mesh, Ray{ origin, packet.GetRay(i).direction }, expected);
+
+					EXPECT_EQ(expected.didHit, hitRecords[i].didHit);
+					if (expected.didHit)
+					{
+						EXPECT_FLOAT_EQ(expected.t, hitRecords[i].t);
+						EXPECT_FLOAT_EQ(expected.t, packet.max[i]);
+					}
+				}
+			}
+		}
+	}
+
+	TEST(TriangleMesh, ParallelTransformMatchesSingleTransforms) {
+		//Enough positions and normals to be split over the worker threads
+		TriangleMesh mesh{ CreateRandomMesh(4242, 30000) };
+		ASSERT_GE(mesh.positions.size() + mesh.normals.size(), mesh.parallelTransformThreshold);
+		ThreadPool threadPool{ 4 };
+		mesh.pThreadPool = &threadPool;
+
+		mesh.Scale({ 2.f, .5f, 1.5f });
+		mesh.RotateY(.8f);
+		mesh.Translate({ 3.f, -1.f, 2.f });
+
+		const Matrix finalTransform{ mesh.scaleTransform * mesh.rotationTransform * mesh.translationTransform };
+		const Matrix normalTransform{ mesh.rotationTransform * mesh.scaleTransform };
+		mesh.TransformVertices(AffineMatrix{ finalTransform }, AffineMatrix{ normalTransform });
+
+		ASSERT_EQ(mesh.positions.size(), mesh.transformedPositions.size());
+		ASSERT_EQ(mesh.normals.size(), mesh.transformedNormals.size());
+		for (size_t i{ 0 }; i < mesh.positions.size(); ++i)
+		{
+			EXPECT_EQ(finalTransform.TransformPoint(mesh.positions[i]), mesh.transformedPositions[i]);
+		}
+		for (size_t i{ 0 }; i < mesh.normals.size(); ++i)
+		{
+			EXPECT_EQ(normalTransform.TransformVector(mesh.normals[i]).Normalized(), mesh.transformedNormals[i]);
+		}
+
+		//Below the threshold the same blocks run on this thread
+		mesh.parallelTransformThreshold = UINT32_MAX;
+		const std::vector<Vector3> parallelPositions{ mesh.transformedPositions };
+		const std::vector<AABB> parallelBounds{ mesh.triangleBounds };
+		const PrecomputedTriangles parallelTriangles{ mesh.precomputedTriangles };
+		mesh.TransformVertices(AffineMatrix{ finalTransform }, AffineMatrix{ normalTransform });
+		EXPECT_EQ(parallelPositions, mesh.transformedPositions);
+
+		ASSERT_EQ(parallelBounds.size(), mesh.triangleBounds.size());
+		for (size_t i{ 0 }; i < parallelBounds.size(); ++i)
+		{
+			EXPECT_EQ(parallelBounds[i].min, mesh.triangleBounds[i].min);
+			EXPECT_EQ(parallelBounds[i].max, mesh.triangleBounds[i].max);
+		}
+		for (int axis{ 0 }; axis < 3; ++axis)
+		{
+			EXPECT_EQ(parallelTriangles.v0[axis], mesh.precomputedTriangles.v0[axis]);
+			EXPECT_EQ(parallelTriangles.edge1[axis], mesh.precomputedTriangles.edge1[axis]);
+			EXPECT_EQ(parallelTriangles.edge2[axis], mesh.precomputedTriangles.edge2[axis]);
+			EXPECT_EQ(parallelTriangles.normal[axis], mesh.precomputedTriangles.normal[axis]);
+		}
+	}
+
+	TEST(TriangleMeshInstance, MatchesTransformedMesh) {
+		//Non-uniform scale and a rotation, so the instance normals only match with the inverse transpose
+		const Vector3 scale{ 2.f, .5f, 1.5f }, translation{ 3.f, -1.f, 2.f };
+		constexpr float yaw{ .8f };
+
+		const TriangleMesh sharedMesh{ CreateRandomMesh(12345, 300) };
+		TriangleMesh mesh{ sharedMesh };
+		mesh.Scale(scale);
+		mesh.RotateY(yaw);
+		mesh.Translate(translation);
+		mesh.UpdateTransforms();
+
+		TriangleMeshInstance instance{};
+		instance.Scale(scale);
+		instance.RotateY(yaw);
+		instance.Translate(translation);
+		instance.UpdateTransforms();
+
+		uint32_t seed{ 678 };
+		int hitCount{ 0 };
+		for (int i{ 0 }; i < 500; ++i)
+		{
+			const Vector3 origin{ RandomFloat(seed, -15.f, 15.f), RandomFloat(seed, -15.f, 15.f), -25.f };
+			const Vector3 target{ RandomFloat(seed, -8.f, 8.f), RandomFloat(seed, -4.f, 4.f), RandomFloat(seed, -6.f, 6.f) };
+			const Ray ray{ origin, (target - origin + translation).Normalized() };
+
+			HitRecord expected{}, actual{};
+			const bool isHit{ GeometryUtils::HitTest_TriangleMesh(mesh, ray, expected) };
+			ASSERT_EQ(isHit, GeometryUtils::HitTest_TriangleMeshInstance(instance, sharedMesh, ray, actual));
+			if (!isHit) continue;
+
+			++hitCount;
+			EXPECT_NEAR(expected.t, actual.t, 1e-3f);
+			for (int axis{ 0 }; axis < 3; ++axis)
+			{
+				EXPECT_NEAR(expected.origin[axis], actual.origin[axis], 1e-3f);
+				EXPECT_NEAR(expected.normal[axis], actual.normal[axis], 1e-4f);
+			}
+		}
+		EXPECT_GT(hitCount, 50);
+	}
+
+	TEST(Occlusion, SphereAndPlaneMatchHitTests) {
+		const Sphere sphere{ { 1.f, 2.f, 3.f }, 2.f };
+		const Plane plane{ { 0.f, -1.f, 0.f }, Vector3{ .2f, 1.f, -.1f }.Normalized() };
+		uint32_t seed{ 678 };
+
+		for (int i{ 0 }; i < 1000; ++i)
+		{
+			const Vector3 origin{ RandomFloat(seed, -6.f, 6.f), RandomFloat(seed, -6.f, 6.f), RandomFloat(seed, -6.f, 6.f) };
+			const Vector3 target{ RandomFloat(seed, -3.f, 3.f), RandomFloat(seed, -3.f, 3.f), RandomFloat(seed, -3.f, 3.f) };
+			const Ray ray{ origin, (target - origin).Normalized(), 0.0001f, RandomFloat(seed, 1.f, 10.f) };
+
+			HitRecord hitRecord{};
+			EXPECT_EQ(GeometryUtils::HitTest_Sphere(sphere, ray, hitRecord), GeometryUtils::HitTest_Sphere(sphere, ray));
+			EXPECT_EQ(GeometryUtils::HitTest_Plane(plane, ray, hitRecord), GeometryUtils::HitTest_Plane(plane, ray));
+		}
+	}
+
+	//A random mesh, an instance of it and a few spheres, to trace shadow rays through the top level
+	class OccluderTestScene final : public Scene
+	{
+	public:
+		void Initialize() override
+		{
+			m_TriangleMeshGeometries.emplace_back(CreateRandomMesh(12345, 300));
+
+			m_SharedTriangleMeshes.emplace_back(CreateRandomMesh(54321, 300));
+			TriangleMeshInstance* pInstance = AddTriangleMeshInstance(&m_SharedTriangleMeshes.back());
+			pInstance->Translate({ 0.f, 0.f, 12.f });
+			pInstance->UpdateTransforms();
+
+			AddSphere({ 0.f, 8.f, 0.f }, 2.f);
+			AddSphere({ 4.f, 8.f, 6.f }, 1.f);
+
+			UpdateAccelerationStructure();
+		}
+	};
+
+	TEST(Occlusion, OccluderCacheMatchesUncachedQueries) {
+		OccluderTestScene scene{};
+		scene.Initialize();
+		const SceneView view{ scene.CreateView() };
+
+		const Vector3 lights[2]{ { 0.f, 20.f, 6.f }, { -15.f, 3.f, 6.f } };
+		OccluderCache cache{};
+		uint32_t seed{ 678 };
+
+		//A coherent row of shadow rays per light, like the pixels of a block
+		for (int i{ 0 }; i < 2000; ++i)
+		{
+			const uint32_t lightIndex{ static_cast<uint32_t>(i % 2) };
+			const Vector3 origin{ RandomFloat(seed, -6.f, 6.f), -8.f, RandomFloat(seed, -6.f, 18.f) };
+			const Vector3 toLight{ lights[lightIndex] - origin };
+			const Ray ray{ origin, toLight.Normalized(), 0.0001f, toLight.Magnitude() };
+
+			EXPECT_EQ(view.DoesHit(ray), view.DoesHit(ray, lightIndex, cache));
+		}
+
+		EXPECT_EQ(2000u, cache.stats.shadowRays);
+		EXPECT_GT(cache.stats.hits, 0u);
+		EXPECT_LE(cache.stats.hits, cache.stats.lookups);
+	}
+
+	// CPU dispatch
+	TEST(CpuDispatch, KernelVariantsMatchBaseline) {
+		const TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+		const InstructionSet selected{ CpuDispatch::GetInstructionSet() };
+
+		for (const InstructionSet instructionSet : { InstructionSet::SSE42, InstructionSet::AVX2, InstructionSet::AVX512 })
+		{
+			InstructionSet parsed{};
+			EXPECT_TRUE(CpuDispatch::ParseInstructionSet(CpuDispatch::GetName(instructionSet), parsed));
+			EXPECT_EQ(instructionSet, parsed);
+
+			if (!CpuDispatch::SelectInstructionSet(instructionSet)) continue;
+			const Kernels& kernels{ CpuDispatch::GetKernels() };
+			EXPECT_EQ(instructionSet, kernels.instructionSet);
+
+			uint32_t seed{ 678 };
+			for (int i{ 0 }; i < 200; ++i)
+			{
+				const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+				const Vector3 target{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+				const Ray ray{ origin, (target - origin).Normalized() };
+
+				HitRecord expected{}, actual{};
+				EXPECT_EQ(GeometryUtils::HitTest_TriangleMesh(mesh, ray, expected), kernels.hitTestTriangleMesh(mesh, ray, actual, false));
+				if (expected.didHit)
+				{
+					EXPECT_NEAR(expected.t, actual.t, 1e-4f);
+				}
+				EXPECT_EQ(GeometryUtils::HitTest_TriangleMesh(mesh, ray), kernels.occlusionTestTriangleMesh(mesh, ray, nullptr));
+			}
+
+			const ColorRGB colors[4]{ { 0.f, .5f, 1.f }, { 2.f, 1.f, .5f }, { .25f, .75f, .1f }, { 0.f, 0.f, 4.f } };
+			uint32_t pixels[4]{};
+			kernels.packPixels(colors, 4, PixelFormat{ 16, 8, 0, 0xFF000000 }, pixels);
+			for (int i{ 0 }; i < 4; ++i)
+			{
+				ColorRGB color{ colors[i] };
+				color.MaxToOne();
+				EXPECT_EQ(0xFF000000 | uint32_t(uint8_t(color.r * 255)) << 16 | uint32_t(uint8_t(color.g * 255)) << 8 | uint8_t(color.b * 255), pixels[i]);
+			}
+		}
+
+		EXPECT_TRUE(CpuDispatch::SelectInstructionSet(selected));
+	}
+
+	// Materials
+	//The BRDFs composed like the per material Shade functions the table replaced
+	static ColorRGB ShadeReference(const MaterialDesc& desc, const MaterialSample& sample)
+	{
+		const Vector3& n = sample.normal;
+		const Vector3& l = sample.l;
+		const Vector3& v = sample.v;
+
+		switch (desc.type)
+		{
+		case MaterialType::Lambert:
+			return BRDF::Lambert(desc.parameters[0], desc.color);
+		case MaterialType::LambertPhong:
+			return BRDF::Lambert(desc.parameters[0], desc.color) + BRDF::Phong(desc.parameters[1], desc.parameters[2], l, -v, n);
+		case MaterialType::CookTorrence:
+		{
+			const float metalness{ desc.parameters[0] }, roughness{ desc.parameters[1] };
+			const ColorRGB f0 = (metalness > 0.0f) ? desc.color : ColorRGB(0.04f, 0.04f, 0.04f);
+			const Vector3 halfVector = (v + l).Normalized();
+
+			const float dotNormalLight = std::max(0.0f, Vector3::Dot(n, l));
+			const float dotNormalView = std::max(0.0f, Vector3::Dot(n, v));
+
+			const ColorRGB fresnel = BRDF::FresnelFunction_Schlick(halfVector, v, f0);
+			const float normalDistribution = BRDF::NormalDistribution_GGX(n, halfVector, roughness);
+			const float geometry = BRDF::GeometryFunction_Smith(n, v, l, roughness);
+
+			const ColorRGB specularReflection = (fresnel * normalDistribution * geometry) / (4.0f * dotNormalLight * dotNormalView + FLT_EPSILON);
+			const float diffuseWeight = (metalness > 0.0f) ? 0.0f : 1.0f - fresnel.r;
+			return dotNormalLight * (diffuseWeight * BRDF::Lambert(1.0f, desc.color) + specularReflection);
+		}
+		case MaterialType::SolidColor:
+		default:
+			return desc.color;
+		}
+	}
+
+	TEST(Material, TableMatchesReferenceShading) {
+		const MaterialDesc descs[]{
+			MaterialDesc::SolidColor({ 1.f, 0.f, 0.f }),
+			MaterialDesc::Lambert({ .49f, .57f, .57f }, 1.f),
+			MaterialDesc::LambertPhong({ .2f, .4f, .9f }, .6f, .4f, 20.f),
+			MaterialDesc::CookTorrence({ .972f, .960f, .915f }, 1.f, .6f),
+			MaterialDesc::CookTorrence({ .75f, .75f, .75f }, 0.f, .1f)
+		};
+
+		MaterialTable table{};
+		for (const MaterialDesc& desc : descs) ASSERT_TRUE(table.Add(desc));
+		ASSERT_EQ(std::size(descs), table.GetSize());
+
+		uint32_t seed{ 97 };
+		std::vector<MaterialSample> samples{};
+		for (int i{ 0 }; i < 37; ++i)
+		{
+			const Vector3 normal{ Vector3{ RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f) }.Normalized() };
+			Vector3 l{ Vector3{ RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f) }.Normalized() };
+			//Lights behind the surface are never shaded
+			if (Vector3::Dot(normal, l) < 0.f) l = -l;
+			samples.push_back({ normal, l, Vector3{ RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f), RandomFloat(seed, -1.f, 1.f) }.Normalized() });
+		}
+
+		std::vector<ColorRGB> brdfs(samples.size());
+		for (size_t materialIndex{ 0 }; materialIndex < std::size(descs); ++materialIndex)
+		{
+			EXPECT_EQ(descs[materialIndex].type, table.GetType(static_cast<unsigned char>(materialIndex)));
+			table.Shade(static_cast<unsigned char>(materialIndex), samples.data(), static_cast<uint32_t>(samples.size()), brdfs.data());
+
+			for (size_t i{ 0 }; i < samples.size(); ++i)
+			{
+				const ColorRGB expected{ ShadeReference(descs[materialIndex], samples[i]) };
+				EXPECT_FLOAT_EQ(expected.r, brdfs[i].r);
+				EXPECT_FLOAT_EQ(expected.g, brdfs[i].g);
+				EXPECT_FLOAT_EQ(expected.b, brdfs[i].b);
+			}
+		}
+
+		//Material indices are unsigned char
+		for (size_t i{ table.GetSize() }; i < MaterialTable::MaxSize; ++i) ASSERT_TRUE(table.Add(descs[1]));
+		EXPECT_FALSE(table.Add(descs[1]));
+	}
+
+	// Grid
+	TEST(Grid, ClosestHitMatchesLinearScan) {
+		const TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+		TwoLevelGrid grid{};
+		grid.Build(mesh.triangleBounds);
+
+		const auto hitTriangle = [&](uint32_t triangleIndex, const Ray& ray, HitRecord& hitRecord)
+			{
+				const std::vector<Vector3>& positions = mesh.transformedPositions;
+				const size_t t{ triangleIndex * size_t(3) };
+				Triangle triangle{ positions[mesh.indices[t]], positions[mesh.indices[t + 1]], positions[mesh.indices[t + 2]], mesh.transformedNormals[triangleIndex] };
+				triangle.cullMode = mesh.cullMode;
+				return GeometryUtils::HitTest_Triangle(triangle, ray, hitRecord);
+			};
+
+		uint32_t seed{ 678 };
+		for (int i{ 0 }; i < 200; ++i)
+		{
+			const Vector3 origin{ RandomFloat(seed, -10.f, 10.f), RandomFloat(seed, -10.f, 10.f), -20.f };
+			const Vector3 target{ RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f), RandomFloat(seed, -5.f, 5.f) };
+			const Ray ray{ origin, (target - origin).Normalized() };
+
+			HitRecord expected{};
+			for (uint32_t triangleIndex{ 0 }; triangleIndex < mesh.indices.size() / 3; ++triangleIndex)
+			{
+				HitRecord hit{};
+				if (hitTriangle(triangleIndex, ray, hit) && hit.t < expected.t) expected = hit;
+			}
+
+			Ray closestRay{ ray };
+			HitRecord actual{};
+			GeometryUtils::TraverseGrid(grid, closestRay, [&](uint32_t triangleIndex)
+				{
+					HitRecord hit{};
+					if (hitTriangle(triangleIndex, closestRay, hit) && hit.t < actual.t)
+					{
+						actual = hit;
+						closestRay.max = hit.t;
+					}
+					return false;
+				});
+
+			EXPECT_EQ(expected.didHit, actual.didHit);
+			if (expected.didHit)
+			{
+				EXPECT_FLOAT_EQ(expected.t, actual.t);
+			}
+
+			HitRecord anyHit{};
+			EXPECT_EQ(expected.didHit, GeometryUtils::TraverseGrid(grid, ray, [&](uint32_t triangleIndex) { return hitTriangle(triangleIndex, ray, anyHit); }));
+		}
+	}
+
+	// Snapshots
+	TEST(Snapshot, TriangleMeshRoundTrip) {
+		const TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+
+		SnapshotWriter writer{};
+		Snapshot::WriteTriangleMesh(writer, mesh);
+
+		const std::string path{ ::testing::TempDir() + "mesh.snapshot" };
+		ASSERT_TRUE(writer.SaveToFile(path));
+
+		const MappedFile file{ path };
+		ASSERT_TRUE(file.IsOpen());
+
+		SnapshotReader reader{ file.GetData(), file.GetSize() };
+		TriangleMesh loaded{};
+		Snapshot::ReadTriangleMesh(reader, loaded);
+
+		EXPECT_TRUE(reader.IsValid());
+		EXPECT_EQ(mesh.bvh.nodes.size(), loaded.bvh.nodes.size());
+		EXPECT_EQ(mesh.wideBvh.nodes.size(), loaded.wideBvh.nodes.size());
+		ExpectMeshMatchesLinearScan(loaded, 678);
+
+		//A cut off snapshot is rejected instead of read out of bounds
+		SnapshotReader truncatedReader{ file.GetData(), file.GetSize() / 2 };
+		TriangleMesh truncated{};
+		Snapshot::ReadTriangleMesh(truncatedReader, truncated);
+		EXPECT_FALSE(truncatedReader.IsValid());
+	}
+
+	TEST(Snapshot, OutOfRangeDataIsRejected) {
+		const TriangleMesh mesh{ CreateRandomMesh(12345, 500) };
+		const std::string path{ ::testing::TempDir() + "corrupt.snapshot" };
+
+		const auto isReadBack = [&](const TriangleMesh& source)
+			{
+				SnapshotWriter writer{};
+				Snapshot::WriteTriangleMesh(writer, source);
+				EXPECT_TRUE(writer.SaveToFile(path));
+
+				const MappedFile file{ path };
+				SnapshotReader reader{ file.GetData(), file.GetSize() };
+				TriangleMesh loaded{};
+				Snapshot::ReadTriangleMesh(reader, loaded);
+				return reader.IsValid();
+			};
+		ASSERT_TRUE(isReadBack(mesh));
+
+		TriangleMesh badVertex{ mesh };
+		badVertex.indices[4] = static_cast<int>(mesh.positions.size());
+		EXPECT_FALSE(isReadBack(badVertex));
+
+		TriangleMesh badChild{ mesh };
+		badChild.bvh.nodes[0].leftFirst = 0;
+		EXPECT_FALSE(isReadBack(badChild));
+
+		TriangleMesh badPrimitive{ mesh };
+		badPrimitive.bvh.primitiveIndices.back() = mesh.bvh.primitiveCount;
+		EXPECT_FALSE(isReadBack(badPrimitive));
+
+		TriangleMesh badWideChild{ mesh };
+		ASSERT_FALSE(badWideChild.wideBvh.nodes.empty());
+		badWideChild.wideBvh.nodes[0].children[0] = UINT32_MAX;
+		EXPECT_FALSE(isReadBack(badWideChild));
+
+		//Bytes that are no bool or enumerator
+		SnapshotWriter writer{};
+		writer.Write<uint8_t>(2);
+		writer.Write<int>(3);
+		writer.Write<int>(-1);
+		ASSERT_TRUE(writer.SaveToFile(path));
+
+		const MappedFile file{ path };
+		SnapshotReader boolReader{ file.GetData(), file.GetSize() };
+		boolReader.ReadBool();
+		EXPECT_FALSE(boolReader.IsValid());
+
+		SnapshotReader enumReader{ file.GetData() + 1, file.GetSize() - 1 };
+		EXPECT_EQ(TriangleCullMode::FrontFaceCulling, enumReader.ReadEnum(TriangleCullMode::NoCulling));
+		EXPECT_FALSE(enumReader.IsValid());
+
+		SnapshotReader negativeReader{ file.GetData() + 5, file.GetSize() - 5 };
+		negativeReader.ReadEnum(TriangleCullMode::NoCulling);
+		EXPECT_FALSE(negativeReader.IsValid());
+	}
+
+	// Thread pool
+	TEST(ThreadPool, RunsEveryTaskOnce) {
+		for (uint32_t threadCount : { 1u, 4u })
+		{
+			ThreadPool threadPool{ threadCount };
+			ASSERT_EQ(threadCount, threadPool.GetThreadCount());
+
+			//Uneven task costs, so the threads run out of work at different times and steal
+			for (uint32_t taskCount : { 0u, 1u, 3u, 1000u })
+			{
+				std::vector<std::atomic<uint32_t>> runCounts(taskCount);
+				threadPool.ResetStats();
+				threadPool.Run(taskCount, [&](uint32_t taskIndex, uint32_t threadIndex)
+					{
+						EXPECT_LT(threadIndex, threadCount);
+						volatile uint32_t work{};
+						for (uint32_t i{ 0 }; i < (taskIndex % 7) * 1000; ++i) work = work + i;
+						++runCounts[taskIndex];
+					});
+
+				uint64_t taskSum{};
+				for (uint32_t threadIndex{ 0 }; threadIndex < threadCount; ++threadIndex)
+				{
+					taskSum += threadPool.GetThreadStats(threadIndex).tasks;
+				}
+				EXPECT_EQ(taskCount, taskSum);
+				for (const std::atomic<uint32_t>& runCount : runCounts) EXPECT_EQ(1u, runCount.load());
+			}
+		}
+	}
+
+	// Tile order
+	TEST(TileOrder, CurvesVisitEveryTileOnce) {
+		for (TileOrder order : { TileOrder::Scanline, TileOrder::Morton, TileOrder::Hilbert })
+		{
+			//A power of two grid and one the curves only partly cover
+			for (const auto& [tilesX, tilesY] : { std::pair{ 8u, 8u }, std::pair{ 40u, 30u } })
+			{
+				std::vector<uint32_t> tileIndices{};
+				TileOrdering::Build(order, tilesX, tilesY, tileIndices);
+				ASSERT_EQ(tilesX * tilesY, tileIndices.size());
+
+				std::vector<uint32_t> sorted{ tileIndices };
+				std::sort(sorted.begin(), sorted.end());
+				for (uint32_t i{ 0 }; i < sorted.size(); ++i) EXPECT_EQ(i, sorted[i]);
+			}
+		}
+
+		//On a power of two grid every Hilbert tile is next to the one before it
+		std::vector<uint32_t> tileIndices{};
+		TileOrdering::Build(TileOrder::Hilbert, 8, 8, tileIndices);
+		for (uint32_t i{ 1 }; i < tileIndices.size(); ++i)
+		{
+			const int dx{ int(tileIndices[i] % 8) - int(tileIndices[i - 1] % 8) }, dy{ int(tileIndices[i] / 8) - int(tileIndices[i - 1] / 8) };
+			EXPECT_EQ(1, std::abs(dx) + std::abs(dy));
+		}
+
+		//Morton order fills 2x2 blocks first
+		TileOrdering::Build(TileOrder::Morton, 8, 8, tileIndices);
+		EXPECT_EQ((std::vector<uint32_t>{ 0, 1, 8, 9, 2, 3, 10, 11 }), std::vector<uint32_t>(tileIndices.begin(), tileIndices.begin() + 8));
+	}
+
 	int main(int argc, char** argv) {
 		::testing::InitGoogleTest(&argc, argv);
 		return RUN_ALL_TESTS();